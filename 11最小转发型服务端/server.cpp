@@ -9,6 +9,8 @@
 #include <sstream>
 #include <vector>
 #include <mutex>
+#include <cerrno>
+#include "../fileserver/linebuffer.h"
 
 constexpr int PORT = 9999;
 constexpr int MAX_EVENTS = 1024;
@@ -17,6 +19,16 @@ constexpr int BUFFER_SIZE = 4096;
 std::unordered_map<std::string, int> nameToFd;
 std::unordered_map<int, std::string> fdToName;
 std::mutex mapMutex;
+// 每个连接的输入状态，只在事件循环线程中访问
+struct ClientInput {
+    LineBuffer in;                   // 已收到、尚未处理的数据
+    std::vector<std::string> lines;  // 当前命令已经收到的行（SEND 的命令占三行）
+    int targetFd = -1;               // 正在转发的文件的接收方，-1 表示丢弃（接收方不在线）
+    std::string target, filename;    // 接收方名称和文件名，转发完成时输出
+    size_t size = 0;                 // 文件大小
+    size_t left = 0;                 // 文件数据还剩多少字节没有转发
+};
+std::unordered_map<int, ClientInput> clients;
 
 void setNonBlocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -55,62 +67,27 @@ void closeConnection(int fd, int epollFd) {
         }
     }
 
+    // 丢弃该连接尚未处理的输入
+    clients.erase(fd);
+
     // 关闭文件描述符fd
     close(fd);
 }
 
 /**
- * @brief 从文件描述符中读取一行文本
- *
- * 从指定的文件描述符中读取一行文本，直到遇到换行符（\n）为止。
- *
- * @param fd 文件描述符
- * @param line 用于存储读取到的行的字符串引用
- *
- * @return 如果成功读取到一行文本，则返回 true；否则返回 false
- */
-bool readLine(int fd, std::string& line) {
-    // 初始化字符变量
-    char c;
-    // 清空字符串
-    line.clear();
-    // 循环读取字符直到遇到换行符或读取失败
-    while (true) {
-        // 从文件描述符fd中读取1个字符到变量c中
-        ssize_t n = recv(fd, &c, 1, 0);
-        // 如果读取到的字节数小于等于0，则表示读取失败或连接关闭，返回false
-        if (n <= 0) return false;
-        // 如果读取到的字符是换行符，则跳出循环
-        if (c == '\n') break;
-        // 将读取到的字符追加到字符串line中
-        line += c;
-    }
-    // 读取成功，返回true
-    return true;
-}
-
-/**
- * @brief 处理客户端请求
+ * @brief 执行一条已经收齐的命令
  *
- * 根据传入的文件描述符 fd 和 epoll 文件描述符 epollFd 处理客户端请求
+ * 命令的各行已在 c.lines 中。SEND 的三行没有收齐时什么也不做，等待更多数据。
  *
  * @param fd 客户端的文件描述符
  * @param epollFd epoll 的文件描述符
+ * @param c 该连接的输入状态
+ *
+ * @return 连接被关闭时返回 false
  */
- //handleClient 是在服务器监听到已连接客户端有数据可读事件时被调用的，无论客户端发送的是什么数据（比如客户端名称、文件传输请求等），
- // 只要数据到达服务器并触发了可读事件，handleClient 就会被执行来处理这些数据。
-
-void handleClient(int fd, int epollFd) {
-    std::string line;
-    // 读取客户端发送的数据行
-    if (!readLine(fd, line)) {
-        // 如果读取失败，则关闭连接
-        closeConnection(fd, epollFd);
-        return;
-    }
-
+bool runCommand(int fd, int epollFd, ClientInput& c) {
     // 使用istringstream解析数据行
-    std::istringstream iss(line);
+    std::istringstream iss(c.lines[0]);
     std::string cmd, arg;
     iss >> cmd >> arg;
 
@@ -129,52 +106,85 @@ void handleClient(int fd, int epollFd) {
     <文件名>\n
     <文件大小>\n
     <文件数据>
-    由于上面已经读取了send 目标名
+    文件名和文件大小这两行还没收到时留到下次可读事件
     */
     else if (cmd == "SEND") {
-        std::string filename, sizeLine;
-        // 读取文件名和文件大小，这是读取两行数据
-        if (!readLine(fd, filename) || !readLine(fd, sizeLine)) {
-            std::cerr << "读取文件信息失败\n";
-            closeConnection(fd, epollFd);
-            return;
-        }
+        if (c.lines.size() < 3) return true;
+        const std::string& filename = c.lines[1];
+        const std::string& sizeLine = c.lines[2];
 
-        size_t filesize = std::stoull(sizeLine);// 将字符串转换为无符号长整型，表示文件大小
+        c.size = c.left = std::stoull(sizeLine);// 将字符串转换为无符号长整型，表示文件大小
+        c.target = arg;
+        c.filename = filename;
         std::lock_guard<std::mutex> lock(mapMutex);
-        // 检查接收方是否在线
+        // 检查接收方是否在线，不在线时仍要读走文件数据，否则会被当成下一条命令
         if (!nameToFd.count(arg)) {
             std::string err = "ERROR 接收方 " + arg + " 不在线\n";
             send(fd, err.c_str(), err.size(), 0);
-            return;
+            c.targetFd = -1;
+        } else {
+            c.targetFd = nameToFd[arg];  // 获取目标客户端的文件描述符
+            std::string notify = "INCOMING " + filename + " " + sizeLine + "\n";
+            send(c.targetFd, notify.c_str(), notify.size(), 0);
         }
+    } 
+    // 处理未知命令
+    else {
+        std::cerr << "未知命令: " << c.lines[0] << "\n";
+        closeConnection(fd, epollFd);
+        return false;
+    }
+    c.lines.clear();
+    return true;
+}
 
-        int targetFd = nameToFd[arg];  // 获取目标客户端的文件描述符
-        std::string notify = "INCOMING " + filename + " " + sizeLine + "\n";
-        send(targetFd, notify.c_str(), notify.size(), 0);
+/**
+ * @brief 处理客户端请求
+ *
+ * 根据传入的文件描述符 fd 和 epoll 文件描述符 epollFd 处理客户端请求
+ *
+ * 每次 recv 一整块数据放进该连接的输入缓冲区，再处理其中完整的命令和文件数据。
+ * 套接字暂时没有数据时立即回到事件循环，不完整的行留在缓冲区中等下一次可读事件，
+ * 一个只发了半行的客户端不会卡住其他客户端。
+ *
+ * @param fd 客户端的文件描述符
+ * @param epollFd epoll 的文件描述符
+ */
+ //handleClient 是在服务器监听到已连接客户端有数据可读事件时被调用的，无论客户端发送的是什么数据（比如客户端名称、文件传输请求等），
+ // 只要数据到达服务器并触发了可读事件，handleClient 就会被执行来处理这些数据。
 
-        size_t sent = 0;
+void handleClient(int fd, int epollFd) {
+    ClientInput& c = clients[fd];
+    while (true) {
+        // 先转发缓冲区中的文件数据，再处理其中完整的命令行
         char buffer[BUFFER_SIZE];
-        while (sent < filesize) {
-            // 从客户端接收数据并转发到目标客户端
-            ssize_t n = recv(fd, buffer, std::min(static_cast<size_t>(BUFFER_SIZE), filesize - sent), 0);
-
-            if (n <= 0) {
-                std::cerr << "接收中断，终止转发\n";
-                closeConnection(fd, epollFd);
-                return;
+        while (c.left > 0 && !c.in.empty()) {
+            size_t n = c.in.take(buffer, std::min(static_cast<size_t>(BUFFER_SIZE), c.left));
+            if (c.targetFd >= 0) send(c.targetFd, buffer, n, 0);
+            c.left -= n;
+            // 输出转发完成信息
+            if (c.left == 0 && c.targetFd >= 0) {
+                std::cout << "已转发 " << c.filename << " (" << c.size << " 字节) 到 " << c.target << "\n";
             }
-            send(targetFd, buffer, n, 0);
-            sent += n;
+        }
+        // 一次处理一行，SEND 收齐后回到循环开头转发紧跟在命令之后的文件数据
+        std::string line;
+        if (c.left == 0 && c.in.getLine(line)) {
+            c.lines.push_back(line);
+            if (!runCommand(fd, epollFd, c)) return;  // 连接已关闭
+            continue;
         }
 
-        // 输出转发完成信息
-        std::cout << "已转发 " << filename << " (" << filesize << " 字节) 到 " << arg << "\n";
-    } 
-    // 处理未知命令
-    else {
-        std::cerr << "未知命令: " << line << "\n";
-        closeConnection(fd, epollFd);
+        // 读取客户端发送的数据
+        ssize_t n = c.in.fill(fd);
+        // 暂时没有数据，回到事件循环
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            // 如果读取失败或连接关闭，则关闭连接
+            if (c.left > 0) std::cerr << "接收中断，终止转发\n";
+            closeConnection(fd, epollFd);
+            return;
+        }
     }
 }
 
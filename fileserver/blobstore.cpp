@@ -0,0 +1,186 @@
+#include "blobstore.h"
+#include "sha256.h"
+#include "crc32c.h"
+#include "staging.h"
+#include "filecache.h"
+#include "mappedfile.h"
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <sys/random.h>
+
+static const std::string BLOB_DIR = "filedir/.blobs/";
+static const char* CRC_ATTR = "user.crc32c";
+static constexpr uint64_t PROOF_LENGTH = 64 * 1024;  // 秒传挑战的范围长度，文件更小时为整个文件
+
+static std::string blobPath(const std::string& hex) {
+    return BLOB_DIR + hex;
+}
+
+// filedir/<basename> 已被替换：丢弃下载缓存和文件映射中的旧内容
+static void replaced(const std::string& basename) {
+    invalidateCachedFile(basename);
+    invalidateMappedFile(basename);
+}
+
+// 替换 filedir/ 中的文件名与回收内容互斥：检查 inode 和改名之间不会被别的存入插进来，
+// 回收检查引用数和删除之间也不会有新的链接
+static std::mutex placeMutex;
+
+// 把 path 改名为 filedir/<basename>；replaces 不为空时只替换这个 inode 的文件，文件已被别的上传替换时
+// 返回 false（errno 为 ESTALE），调用者负责删除 path。调用时持有 placeMutex
+static bool place(const std::string& path, const std::string& basename, const ino_t* replaces) {
+    std::string target = "filedir/" + basename;
+    struct stat st{};
+    if (replaces && (stat(target.c_str(), &st) != 0 || st.st_ino != *replaces)) {
+        errno = ESTALE;
+        return false;
+    }
+    if (std::rename(path.c_str(), target.c_str()) != 0) return false;
+    replaced(basename);
+    return true;
+}
+
+/**
+ * @brief 把内容链接为 filedir/<basename>
+ *
+ * 先在暂存区建立一个临时链接，再改名覆盖目标，读者看到的要么是旧文件要么是新文件；
+ * 替换之后再使下载缓存和文件映射失效，正在读取旧文件的下载不会把旧内容放回缓存。
+ * 内容已被回收（releaseBlob）时失败，errno 为 ENOENT。
+ */
+static bool publish(const std::string& blob, const std::string& basename, const ino_t* replaces) {
+    // 同名文件可能由不同的事件循环同时替换，临时链接名加上序号互不冲突
+    static std::atomic<uint64_t> sequence{0};
+    std::string tmp = stagingTempPath("link" + std::to_string(sequence++));
+    std::remove(tmp.c_str());
+    std::lock_guard<std::mutex> lock(placeMutex);
+    if (link(blob.c_str(), tmp.c_str()) != 0) return false;
+    if (!place(tmp, basename, replaces)) {
+        int saved = errno;
+        std::remove(tmp.c_str());
+        errno = saved;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 创建内容目录并回收无人引用的内容
+ *
+ * 覆盖或删除 filedir/ 中的文件后，原来的内容只剩内容目录中的一个链接（st_nlink == 1），
+ * 启动时把这些内容删除。运行期间只有服务端自己替换的文件（releaseBlob）立即回收，
+ * 上传覆盖留下的内容不在运行期间扫描回收。
+ */
+bool createBlobStore() {
+    if (mkdir(BLOB_DIR.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    DIR* dir = opendir(BLOB_DIR.c_str());
+    if (!dir) return false;
+    size_t removed = 0;
+    while (dirent* entry = readdir(dir)) {
+        std::string path = BLOB_DIR + entry->d_name;
+        struct stat st{};
+        if (entry->d_name[0] == '.' || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (st.st_nlink == 1 && unlink(path.c_str()) == 0) ++removed;
+    }
+    closedir(dir);
+    if (removed > 0) std::cout << "已清理无引用的内容: " << removed << " 个" << std::endl;
+    return true;
+}
+
+bool validDigest(const std::string& hex) {
+    if (hex.size() != 64) return false;
+    for (char ch : hex) {
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'))) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 存入一个上传完成的文件
+ *
+ * 计算暂存文件的摘要后把它硬链接到内容目录：链接成功说明是新内容，暂存文件本身改名为
+ * filedir/<basename>，不复制任何数据；目标已存在（EEXIST）说明服务端已有相同内容，
+ * 链接到已有的内容后删除暂存文件，重复的数据不占磁盘空间。已有的内容恰好在这之间被回收时
+ * 重新按新内容存入。
+ */
+bool storeBlob(const std::string& stagedPath, const std::string& basename, const uint32_t* expectedCrc,
+               const ino_t* replaces) {
+    std::string hex;
+    uint32_t crc;
+    if (!sha256File(stagedPath, hex, &crc)) return false;
+    if (expectedCrc && *expectedCrc != crc) {
+        errno = EBADMSG;
+        return false;
+    }
+    // 文件系统不支持扩展属性时只是没有记录，不影响存入
+    std::string value = crc32cHex(crc);
+    setxattr(stagedPath.c_str(), CRC_ATTR, value.data(), value.size(), 0);
+    std::string blob = blobPath(hex);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (link(stagedPath.c_str(), blob.c_str()) == 0) {
+            // 没能替换时内容目录中的链接留到下次启动清理
+            std::lock_guard<std::mutex> lock(placeMutex);
+            return place(stagedPath, basename, replaces);
+        }
+        if (errno != EEXIST) return false;
+        setxattr(blob.c_str(), CRC_ATTR, value.data(), value.size(), 0);  // 补上旧版本存入的内容缺少的记录
+        if (publish(blob, basename, replaces)) {
+            std::cout << "内容已存在，去重保存: " << basename << " -> " << hex.substr(0, 12) << std::endl;
+            std::remove(stagedPath.c_str());
+            return true;
+        }
+        if (errno != ENOENT) return false;
+    }
+    return false;
+}
+
+void releaseBlob(const std::string& hex) {
+    std::string blob = blobPath(hex);
+    std::lock_guard<std::mutex> lock(placeMutex);
+    struct stat st{};
+    if (stat(blob.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1) unlink(blob.c_str());
+}
+
+bool challengeBlob(const std::string& hex, uint64_t size, BlobChallenge& challenge) {
+    if (!validDigest(hex)) return false;
+    struct stat st{};
+    if (stat(blobPath(hex).c_str(), &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != size) return false;
+    uint8_t random[16 + 8];
+    if (getrandom(random, sizeof(random), 0) != (ssize_t)sizeof(random)) return false;
+    challenge.hex = hex;
+    challenge.size = size;
+    challenge.length = std::min(PROOF_LENGTH, size);
+    uint64_t pick;
+    memcpy(&pick, random + 16, sizeof(pick));
+    challenge.offset = pick % (size - challenge.length + 1);
+    static const char digits[] = "0123456789abcdef";
+    challenge.nonce.clear();
+    for (int i = 0; i < 16; ++i) {
+        challenge.nonce += digits[random[i] >> 4];
+        challenge.nonce += digits[random[i] & 15];
+    }
+    return true;
+}
+
+bool linkBlob(const BlobChallenge& challenge, const std::string& answer, const std::string& basename) {
+    std::string blob = blobPath(challenge.hex);
+    std::string expected;
+    if (!sha256Proof(blob, challenge.nonce, challenge.offset, challenge.length, expected) || answer != expected) return false;
+    struct stat st{};
+    if (stat(blob.c_str(), &st) != 0 || (uint64_t)st.st_size != challenge.size) return false;
+    return publish(blob, basename, nullptr);
+}
+
+bool storedChecksum(int fd, uint32_t& crc) {
+    char value[8];
+    return fgetxattr(fd, CRC_ATTR, value, sizeof(value)) == (ssize_t)sizeof(value) &&
+           parseCrc32c(std::string(value, sizeof(value)), crc);
+}
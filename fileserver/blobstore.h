@@ -0,0 +1,59 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+ * @brief 按内容寻址的去重存储
+ *
+ * 文件内容以 SHA-256 摘要为名保存在 filedir/.blobs/<摘要> 中，每份内容只保存一次；
+ * filedir/<文件名> 是指向对应内容的硬链接，因此下载流程不需要任何改动，
+ * 相同内容的多个文件名共用同一份磁盘空间。内容文件一旦写入就不再修改，
+ * 上传同名文件时用改名原子地替换 filedir/ 中的链接。
+ *
+ * 客户端可以先发送 "HASH name size sha256\n"：服务端已经有这份内容时回复一个挑战
+ * "PROVE offset length nonce\n"，客户端用 "PROOF name answer\n" 证明自己确实有这份内容
+ * （answer 见 sha256Proof），正确时服务端直接建立链接并回复 "OK size\n"（秒传）；
+ * 服务端没有这份内容或回答不对时回复 "NEED\n"，客户端再正常上传。
+ * 只知道摘要的客户端因此无法把别人上传的内容链接到自己的文件名下再下载出来。
+ * 存入时在计算摘要的同一遍读取中算出整个文件的 CRC32C，记录在内容文件的扩展属性中，
+ * 所有指向它的文件名共享这条记录，校验下载时不需要重新读取整个文件。
+ * 以下函数会读写磁盘，在磁盘线程中调用。
+ */
+
+// 创建内容目录并清理已经没有文件名引用的内容（服务端启动时调用）
+bool createBlobStore();
+
+// 摘要格式是否合法：64 个小写十六进制字符
+bool validDigest(const std::string& hex);
+
+// 把上传完成的暂存文件存入内容目录并链接为 filedir/<basename>；内容已存在时丢弃暂存文件
+// expectedCrc 不为空时校验整个文件的 CRC32C，不一致时不存入并返回 false（errno 为 EBADMSG）；
+// replaces 不为空时只替换 inode 为 *replaces 的文件，文件已被别的上传替换时返回 false（errno 为 ESTALE）
+bool storeBlob(const std::string& stagedPath, const std::string& basename, const uint32_t* expectedCrc,
+               const ino_t* replaces = nullptr);
+
+// 某个文件名改为链接到别的内容之后，原来的内容已经没有文件名引用时立即删除（见 compressStoredPcd）
+void releaseBlob(const std::string& hex);
+
+// 读取内容的 CRC32C（存入时记录在扩展属性 user.crc32c 中），没有记录时返回 false
+bool storedChecksum(int fd, uint32_t& crc);
+
+// 秒传的挑战：内容中随机的一段和一个随机数，由回答 HASH 的连接保存到客户端发来 PROOF
+struct BlobChallenge {
+    std::string hex;      // 要链接的内容的摘要
+    uint64_t size = 0;
+    uint64_t offset = 0;  // 要求客户端证明的范围
+    uint64_t length = 0;
+    std::string nonce;    // 32 个十六进制字符，防止客户端重放以前的回答
+};
+
+// 内容目录中有摘要为 hex、大小为 size 的内容时生成挑战并返回 true
+bool challengeBlob(const std::string& hex, uint64_t size, BlobChallenge& challenge);
+
+// 秒传：客户端对挑战的回答正确时把内容链接为 filedir/<basename> 并返回 true
+bool linkBlob(const BlobChallenge& challenge, const std::string& answer, const std::string& basename);
+
+#endif // BLOBSTORE_H
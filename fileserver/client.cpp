@@ -1,177 +1,809 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include "linebuffer.h"
+#include "cmdoption.h"
+#include "sha256.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "delta.h"
 #define SERVER_IP "43.143.168.49"
 #define PORT 8888
 #define BUFFER_SIZE 1024
 
-// 读取一行直到 \n
+// 创建到服务器的连接，失败返回 -1
+int connectServer() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(PORT);
+    inet_pton(AF_INET, SERVER_IP, &serverAddr.sin_addr);
+    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// 检查持久连接是否仍然可用（服务端可能因空闲超时关闭了连接）
+bool connectionAlive(int sock) {
+    pollfd pfd{sock, POLLIN, 0};
+    if (poll(&pfd, 1, 0) == 0) return true;  // 没有任何事件：连接正常
+    char c;
+    return recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+// 本地文件大小，无法打开时返回 false
+bool localFileSize(const std::string& filename, size_t& size) {
+    struct stat st{};
+    if (stat(filename.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) return false;
+    size = st.st_size;
+    return true;
+}
+
+// 完整发送 len 字节
+bool sendAll(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 文件开头不是已知的压缩格式（PNG、gzip 等），值得压缩传输
+bool compressible(const std::string& filename) {
+    char magic[16];
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return !looksCompressed(magic, file.gcount());
+}
+
+// 从 reader 中已读入的数据或 socket 读满 len 字节
+bool recvAll(int sock, LineBuffer& reader, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = !reader.empty() ? reader.take(data, len) : recv(sock, data, len, 0);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 接收一帧压缩数据并解压到 out（至少 COMPRESS_BLOCK 字节），返回原始长度；出错或超过 maxRaw 时返回 0
+size_t recvFrame(int sock, LineBuffer& reader, std::vector<char>& frame, char* out, size_t maxRaw) {
+    size_t rawLen, storedLen;
+    if (frame.size() < FRAME_HEADER + COMPRESS_BLOCK) frame.resize(FRAME_HEADER + COMPRESS_BLOCK);
+    if (!recvAll(sock, reader, frame.data(), FRAME_HEADER) || !parseFrameHeader(frame.data(), rawLen, storedLen) ||
+        rawLen > maxRaw || !recvAll(sock, reader, frame.data(), storedLen) ||
+        !decodeFrame(frame.data(), storedLen, out, rawLen)) {
+        return 0;
+    }
+    return rawLen;
+}
+
+constexpr int VERIFY_ATTEMPTS = 3;  // 校验和不匹配时同一范围最多传输的次数
+
+// 服务端响应（"NEED lzf crc32c"）中是否带有 option
+bool offers(const std::string& response, const char* option) {
+    std::istringstream ss(response);
+    std::string token;
+    while (ss >> token) {
+        if (token == option) return true;
+    }
+    return false;
+}
+
+// 计算本地文件前 length 字节的校验和，读取失败返回 false
+bool fileChecksum(const std::string& path, size_t length, uint32_t& crc) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> buffer(1024 * 1024);
+    crc = 0;
+    while (length > 0 && file.read(buffer.data(), std::min(buffer.size(), length))) {
+        crc = crc32c(crc, buffer.data(), file.gcount());
+        length -= file.gcount();
+    }
+    return length == 0;
+}
+
+// 读取 QUERY 的响应 "OK <bytes>\n"：服务端已经持有的字节数，出错时返回 0
+size_t recvQueryReply(int sock, LineBuffer& reader) {
+    std::string response;
+    if (!reader.readLine(sock, response) || response.substr(0, 2) != "OK") return 0;
+    try {
+        return std::stoull(response.substr(3));
+    } catch (const std::exception& e) {
+        return 0;
+    }
+}
+
+// 发送上传命令、文件大小和从 offset 开始的文件内容，不等待确认；返回是否已发送（需要读取确认）
+// compress 为 true 时命令带上 lzf，文件内容逐块压缩成帧发送；
+// fileCrc 不为空时命令带上 crc32c，数据之后发送 "<这次发送的数据的校验和> <整个文件的校验和>\n"
+bool sendUpload(int sock, const std::string& filename, size_t offset, bool compress, const uint32_t* fileCrc) {
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "无法打开文件: " << filename << std::endl;
+        return false;
+    }
+
+    // 获取文件大小
+    file.seekg(0, std::ios::end);
+    size_t file_size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    // 发送命令：UPLOAD filename\n，以及文件大小；续传时大小行为 "size offset"
+    std::string header = "UPLOAD " + only_filename + (compress ? std::string(" ") + COMPRESS_OPTION : "") +
+                         (fileCrc ? std::string(" ") + CHECKSUM_OPTION : "") + "\n" + std::to_string(file_size);
+    if (offset > 0 && offset <= file_size) {
+        std::cout << "继续上传文件: " << only_filename << " (从 " << offset << " 字节处续传，总大小: " << file_size << " 字节)" << std::endl;
+        header += " " + std::to_string(offset);
+        file.seekg(offset);
+    } else {
+        std::cout << "开始上传文件: " << only_filename << " (总大小: " << file_size << " 字节)" << std::endl;
+        offset = 0;
+    }
+    header += "\n";
+    send(sock, header.c_str(), header.size(), MSG_NOSIGNAL);
+
+    // 发送文件内容；压缩时每次读一整块，编码成一帧后发送
+    std::vector<char> buffer(compress ? COMPRESS_BLOCK : BUFFER_SIZE);
+    std::vector<char> frames(compress ? frameBound(COMPRESS_BLOCK) : 0);
+    size_t sent = offset;
+    uint32_t crc = 0;
+    while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+        size_t len = file.gcount();
+        if (fileCrc) crc = crc32c(crc, buffer.data(), len);
+        if (compress) {
+            if (!sendAll(sock, frames.data(), encodeFrames(buffer.data(), len, frames.data()))) {
+                std::cerr << "发送文件内容时出错" << std::endl;
+                break;
+            }
+            sent += len;
+        } else {
+            ssize_t bytes_sent = send(sock, buffer.data(), len, MSG_NOSIGNAL);
+            if (bytes_sent < 0) {
+                std::cerr << "发送文件内容时出错" << std::endl;
+                break;
+            }
+            sent += bytes_sent;
+        }
+
+        // 每发送1MB显示一次进度，或者在发送完成时显示
+        if (sent % (1024 * 1024) == 0 || sent == file_size) {
+            float progress = (float)sent / file_size * 100;
+            std::cout << "已上传: " << sent << "/" << file_size
+                     << " 字节 (" << std::fixed << std::setprecision(2) << progress << "%)" << std::endl;
+        }
+    }
+    if (sent < file_size) {
+        std::cerr << "上传未完成，实际发送: " << sent << "/" << file_size << " 字节" << std::endl;
+    }
+    if (fileCrc) {
+        std::string trailer = crc32cHex(crc) + " " + crc32cHex(*fileCrc) + "\n";
+        sendAll(sock, trailer.data(), trailer.size());
+    }
+    return true;
+}
+
+constexpr size_t DELTA_MIN_SIZE = 1024 * 1024;  // 不小于此大小的文件才尝试增量上传
+
 /**
- * @brief 从指定套接字接收一行数据
+ * @brief 增量上传（见 delta.h）：取得服务端旧版本的块签名，只发送变化的部分
  *
- * 从指定的套接字中接收一行数据，直到遇到换行符（\n）或接收失败。
+ * 服务端没有旧版本（或不支持增量上传）时返回 false，调用者改用完整上传。
+ * DELTA 失败时服务端可能已经关闭连接，alive 置为 false，调用者重新连接。
+ */
+bool deltaUpload(int sock, LineBuffer& reader, const std::string& filename, size_t size, uint32_t crc, bool& alive) {
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    std::string command = "SIGNATURE " + only_filename + "\n", response, status;
+    alive = sendAll(sock, command.data(), command.size()) && reader.readLine(sock, response);
+    if (!alive) return false;
+    uint64_t baseSize = 0, blockSize = 0, blocks = 0;
+    std::istringstream ss(response);
+    if (!(ss >> status >> baseSize >> blockSize >> blocks) || status != "OK") return false;
+    std::string signatures(blocks * DELTA_SIGNATURE, '\0');
+    if (!(alive = recvAll(sock, reader, &signatures[0], signatures.size()))) return false;
+    if (blocks == 0) return false;  // 旧版本不到一块，没有可复用的数据
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, size, MADV_SEQUENTIAL);
+    std::cout << "开始增量上传: " << only_filename << " (总大小: " << size << " 字节，服务端旧版本: " << baseSize << " 字节)" << std::endl;
+    command = "DELTA " + only_filename + " " + std::to_string(size) + " " + std::to_string(blockSize) + " " + crc32cHex(crc) + "\n";
+    uint64_t reused = 0, sent = 0;
+    bool ok = sendAll(sock, command.data(), command.size()) &&
+              encodeDelta((const char*)data, size, signatures, blockSize, [&](const char* p, size_t n) {
+                  sent += n;
+                  return sendAll(sock, p, n);
+              }, reused) &&
+              reader.readLine(sock, response) && response.substr(0, 2) == "OK";
+    munmap(data, size);
+    if (!ok) {
+        std::cerr << "增量上传失败: " << only_filename << " " << response << "，改用完整上传" << std::endl;
+        alive = false;
+        return false;
+    }
+    std::cout << "增量上传完成: " << only_filename << " (总大小: " << size << " 字节，复用 " << reused
+              << " 字节，实际发送: " << sent << " 字节)" << std::endl;
+    return true;
+}
+
+// 读取上传确认 "OK <size>\n"，返回是否成功；服务端发现校验和不匹配时 corrupted 为 true，
+// 这次发送的数据已被丢弃，连接仍可继续使用
+bool recvUploadAck(int sock, LineBuffer& reader, const std::string& filename, bool& corrupted) {
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    std::string response;
+    corrupted = false;
+    if (!reader.readLine(sock, response) || response.substr(0, 2) != "OK") {
+        std::cerr << "上传失败: " << only_filename << " " << response << std::endl;
+        corrupted = response == "ERROR 校验和不匹配";
+        return corrupted;
+    }
+    std::cout << "上传完成: " << only_filename << " (服务端确认: " << response << ")" << std::endl;
+    return true;
+}
+
+// 下载过程中数据先写入 <文件名>.part，完整后再改名，中断后留下的 .part 文件用于续传
+std::string partName(const std::string& only_filename) {
+    return only_filename + ".part";
+}
+
+// 构造下载命令：本地有未完成的 .part 文件时从它的长度处续传；compress 为 true 时请求压缩传输，
+// verify 为 true 时请求校验传输
+std::string downloadCommand(const std::string& filename, bool compress, bool verify) {
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    std::string command = "DOWNLOAD " + only_filename;
+    struct stat st{};
+    if (stat(partName(only_filename).c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        command += " " + std::to_string(st.st_size);
+    }
+    if (compress) command += std::string(" ") + COMPRESS_OPTION;
+    if (verify) command += std::string(" ") + CHECKSUM_OPTION;
+    return command + "\n";
+}
+
+/**
+ * @brief 接收一个下载响应和文件数据
+ *
+ * 同一连接上可能紧跟着下一个响应，因此 recv 最多只读到当前文件的末尾，
+ * 之前多读入 reader 的数据也只取当前文件需要的部分。
+ * 续传的响应头为 "OK <size> <offset> <length>"，数据写到本地文件的 offset 处。
+ * 响应头末尾带 lzf 时数据为压缩帧序列，逐帧解压后写入。
+ * 响应头末尾带 crc32c 时数据之后还有一行校验和：这次收到的数据不匹配时截掉这部分，
+ * 本地续传的部分与整个文件的校验和不匹配时删除 .part，两种情况都把 corrupted 置为 true 以便重新下载。
+ *
+ * @return 连接仍可继续使用时返回 true
+ */
+bool recvDownload(int sock, LineBuffer& reader, const std::string& filename, bool& corrupted) {
+    corrupted = false;
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    std::string response;
+    if (!reader.readLine(sock, response)) {
+        std::cerr << "连接已断开" << std::endl;
+        return false;
+    }
+    if (response.substr(0, 5) == "ERROR") {
+        std::cerr << "服务端错误: " << only_filename << " " << response << std::endl;
+        if (response.find("范围无效") != std::string::npos) {
+            // 服务器上的文件比未完成的部分还小，说明文件已经变了，丢弃 .part 下次重新下载
+            std::remove(partName(only_filename).c_str());
+            std::cerr << "服务器上的文件已变化，已删除未完成的部分，请重新下载" << std::endl;
+        }
+        return true;
+    }
+    //OK <filesize> [<offset> <length>] [lzf] [crc32c]\n 服务端响应格式，解析文件大小,比如OK 1048576\n
+    bool framed = takeOption(response, COMPRESS_OPTION);
+    bool checked = takeOption(response, CHECKSUM_OPTION);
+    size_t filesize = 0, offset = 0;
+    std::istringstream ss(response);
+    std::string status;
+    ss >> status >> filesize;
+    if (!(ss >> offset)) offset = 0;
+
+    std::string part = partName(only_filename);
+    std::ofstream outfile;
+    if (offset > 0) {
+        std::cout << "继续下载文件: " << only_filename << " (从 " << offset << " 字节处续传，总大小: " << filesize << " 字节)" << std::endl;
+        outfile.open(part, std::ios::binary | std::ios::in | std::ios::out);
+        outfile.seekp(offset);
+    } else {
+        std::cout << "开始下载文件: " << only_filename << " (总大小: " << filesize << " 字节)" << std::endl;
+        outfile.open(part, std::ios::binary);
+    }
+    std::vector<char> buffer(framed ? COMPRESS_BLOCK : BUFFER_SIZE);
+    std::vector<char> frame;
+    size_t received = offset;
+    uint32_t crc = 0;
+    while (received < filesize) {
+        ssize_t len;
+        if (framed) {
+            len = recvFrame(sock, reader, frame, buffer.data(), filesize - received);
+        } else {
+            size_t want = std::min<size_t>(BUFFER_SIZE, filesize - received);
+            len = !reader.empty() ? reader.take(buffer.data(), want) : recv(sock, buffer.data(), want, 0);
+        }
+        if (len <= 0) break;
+        outfile.write(buffer.data(), len);
+        received += len;
+        if (checked) crc = crc32c(crc, buffer.data(), len);
+
+        // 每接收1MB数据显示一次进度，或者在接收完成时显示
+        if (received % (1024 * 1024) == 0 || received == filesize) {
+            float progress = (float)received / filesize * 100;
+            std::cout << "已下载: " << received << "/" << filesize
+                        << " 字节 (" << std::fixed << std::setprecision(2) << progress << "%)" << std::endl;
+        }
+    }
+
+    outfile.close();
+    if (received < filesize) {
+        std::cerr << "下载未完成，实际接收: " << received << "/" << filesize << " 字节，再次下载将从断点续传" << std::endl;
+        return false;
+    }
+    if (checked) {
+        // "<范围校验和> [<整个文件的校验和>]"
+        std::string trailer, rangeHex, fileHex;
+        if (!reader.readLine(sock, trailer)) {
+            std::cerr << "连接已断开，未收到校验和" << std::endl;
+            return false;
+        }
+        std::istringstream ts(trailer);
+        ts >> rangeHex >> fileHex;
+        if (rangeHex != crc32cHex(crc)) {
+            std::cerr << "校验和不匹配: " << only_filename << " [" << offset << ", " << filesize << ")，丢弃这部分数据" << std::endl;
+            truncate(part.c_str(), offset);
+            corrupted = true;
+            return true;
+        }
+        // 续传时重新读一遍本地的 .part 核对整个文件
+        uint32_t whole = crc;
+        bool intact = fileHex.empty() || ((offset == 0 || fileChecksum(part, filesize, whole)) && fileHex == crc32cHex(whole));
+        if (!intact) {
+            if (offset == 0) {
+                // 收到的数据与服务端读出的一致，但与存入时的记录不一致：服务器上的文件已损坏，重传也无济于事
+                std::cerr << "服务器上的文件已损坏: " << only_filename << std::endl;
+            } else {
+                std::cerr << "文件校验和不匹配: " << only_filename << "，已删除未完成的部分，重新下载" << std::endl;
+                corrupted = true;
+            }
+            std::remove(part.c_str());
+            return true;
+        }
+    }
+    std::rename(part.c_str(), only_filename.c_str());
+    std::cout << "下载完成: " << only_filename << " (总大小: " << received << " 字节)" << std::endl;
+    return true;
+}
+
+constexpr size_t PARALLEL_MIN_SIZE = 16 * 1024 * 1024;  // 不小于此大小的文件使用多连接分块传输
+constexpr size_t CHUNK_SIZE = 8 * 1024 * 1024;           // 分块大小
+constexpr size_t STREAM_BUFFER = 256 * 1024;             // 分块传输时每个连接的缓冲区
+
+/**
+ * @brief 多连接分块传输
  *
- * @param sock 套接字描述符
- * @return 接收到的行数据
+ * 把文件切成 CHUNK_SIZE 的分块，streams 个线程各自建立连接，依次领取下一个分块：
+ * 上传时用 pread 读出后以 "CHUNK name\nsize offset length\n" 发送，等待 "OK length"；
+ * 下载时发送带范围的 DOWNLOAD，收到的数据 pwrite 到本地文件的对应偏移。
+ * compress 为 true 时命令带上 lzf：每个线程各自压缩/解压自己的分块，多个核同时工作。
+ * verify 为 true 时命令带上 crc32c：每个分块的数据之后跟一行校验和，上传时为分块和整个文件
+ * 的校验和（fileCrc），下载时由服务端给出，整个文件的校验和记入 fileCrc。
+ * 校验和不匹配的分块单独重传，最多 VERIFY_ATTEMPTS 次；其他任何一个分块失败，整个传输失败。
  */
-std::string recvLine(int sock) {
-    // 定义一个字符变量ch
-    char ch;
-    // 定义一个字符串变量line用于存储接收到的行数据
-    std::string line;
-    // 循环接收数据直到遇到换行符或接收失败
-    while (recv(sock, &ch, 1, 0) > 0) {
-        // 如果接收到换行符，则跳出循环
-        if (ch == '\n') break;
-        // 将接收到的字符添加到line中
-        line += ch;
-    }
-    // 返回接收到的行数据
-    return line;
-}
-
-int main() {
+bool parallelTransfer(bool upload, const std::string& only_filename, int fd, size_t size, int streams,
+                      bool compress, bool verify, std::string& fileCrc) {
+    size_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    streams = std::max<size_t>(1, std::min<size_t>(streams, chunks));
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<size_t> done{0};
+    std::atomic<bool> failed{false};
+    std::mutex outputMutex;
+
+    auto worker = [&]() {
+        int sock = connectServer();
+        if (sock < 0) {
+            failed = true;
+            return;
+        }
+        LineBuffer reader;
+        std::vector<char> buffer(STREAM_BUFFER);
+        std::vector<char> frames(compress ? frameBound(STREAM_BUFFER) : 0);
+        std::string option = std::string(compress ? std::string(" ") + COMPRESS_OPTION : "") +
+                             (verify ? std::string(" ") + CHECKSUM_OPTION : "");
+        while (!failed) {
+            size_t offset = nextChunk++ * CHUNK_SIZE;
+            if (offset >= size) break;
+            size_t length = std::min(CHUNK_SIZE, size - offset);
+            std::string range = std::to_string(offset) + " " + std::to_string(length);
+            std::string response;
+            bool ok;
+            bool corrupted = false;
+            for (int attempt = 1;; ++attempt) {
+                uint32_t crc = 0;
+                if (upload) {
+                    std::string header = "CHUNK " + only_filename + option + "\n" + std::to_string(size) + " " + range + "\n";
+                    ok = sendAll(sock, header.data(), header.size());
+                    for (size_t sent = 0; ok && sent < length;) {
+                        ssize_t n = pread(fd, buffer.data(), std::min(buffer.size(), length - sent), offset + sent);
+                        if (verify && n > 0) crc = crc32c(crc, buffer.data(), n);
+                        if (compress) {
+                            ok = n > 0 && sendAll(sock, frames.data(), encodeFrames(buffer.data(), n, frames.data()));
+                        } else {
+                            ok = n > 0 && sendAll(sock, buffer.data(), n);
+                        }
+                        sent += std::max<ssize_t>(n, 0);
+                    }
+                    if (verify) {
+                        std::string trailer = crc32cHex(crc) + " " + fileCrc + "\n";
+                        ok = ok && sendAll(sock, trailer.data(), trailer.size());
+                    }
+                    ok = ok && reader.readLine(sock, response) && response == "OK " + std::to_string(length);
+                    corrupted = response == "ERROR 校验和不匹配";
+                } else {
+                    std::string command = "DOWNLOAD " + only_filename + " " + range + option + "\n";
+                    std::string expected = "OK " + std::to_string(size) + " " + range;
+                    ok = sendAll(sock, command.data(), command.size()) && reader.readLine(sock, response);
+                    // 服务端可能不压缩（已经是压缩格式的文件）或不支持校验，以响应头为准
+                    bool framed = takeOption(response, COMPRESS_OPTION);
+                    bool checked = takeOption(response, CHECKSUM_OPTION);
+                    ok = ok && response == expected;
+                    for (size_t got = 0; ok && got < length;) {
+                        ssize_t n;
+                        if (framed) {
+                            n = recvFrame(sock, reader, frames, buffer.data(), length - got);
+                        } else {
+                            size_t want = std::min(buffer.size(), length - got);
+                            n = !reader.empty() ? reader.take(buffer.data(), want) : recv(sock, buffer.data(), want, 0);
+                        }
+                        ok = n > 0 && pwrite(fd, buffer.data(), n, offset + got) == n;
+                        if (checked && ok) crc = crc32c(crc, buffer.data(), n);
+                        got += std::max<ssize_t>(n, 0);
+                    }
+                    std::string trailer, rangeHex, fileHex;
+                    if (ok && checked && (ok = reader.readLine(sock, trailer))) {
+                        std::istringstream ts(trailer);
+                        ts >> rangeHex >> fileHex;
+                        corrupted = rangeHex != crc32cHex(crc);
+                        ok = !corrupted;
+                        response = trailer;
+                        std::lock_guard<std::mutex> lock(outputMutex);
+                        if (!fileHex.empty()) fileCrc = fileHex;
+                    }
+                }
+                if (ok || !corrupted || attempt == VERIFY_ATTEMPTS) break;
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << "校验和不匹配，重传分块: " << only_filename << " [" << offset << ", " << offset + length << ")" << std::endl;
+            }
+            if (!ok) {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << "分块传输失败: " << only_filename << " [" << offset << ", " << offset + length << ") " << response << std::endl;
+                failed = true;
+                break;
+            }
+            size_t total = done += length;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << (upload ? "已上传: " : "已下载: ") << total << "/" << size << " 字节 ("
+                      << std::fixed << std::setprecision(2) << (float)total / size * 100 << "%)" << std::endl;
+        }
+        close(sock);
+    };
+
+    std::cout << (upload ? "开始分块上传: " : "开始分块下载: ") << only_filename << " (总大小: " << size
+              << " 字节，" << chunks << " 个分块，" << streams << " 个连接)" << std::endl;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < streams; ++i) threads.emplace_back(worker);
+    for (auto& t : threads) t.join();
+    return !failed;
+}
+
+// 多连接分块上传一个本地文件；所有分块确认后服务端已经把文件移入 filedir/
+// fileCrc 不为空时校验上传，服务端移入前核对整个文件的校验和
+bool parallelUpload(const std::string& filename, size_t size, int streams, bool compress, const uint32_t* fileCrc) {
+    std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "无法打开文件: " << filename << std::endl;
+        return false;
+    }
+    std::string crcHex = fileCrc ? crc32cHex(*fileCrc) : "";
+    bool ok = parallelTransfer(true, only_filename, fd, size, streams, compress, fileCrc != nullptr, crcHex);
+    close(fd);
+    if (ok) std::cout << "上传完成: " << only_filename << " (总大小: " << size << " 字节)" << std::endl;
+    return ok;
+}
+
+// 多连接分块下载到预分配的 .part 文件，完整后改名；失败时 .part 中有空洞，不能按长度续传，直接删除
+// verify 为 true 时每个分块单独校验，服务端给出整个文件的校验和时再核对整个文件
+bool parallelDownload(const std::string& only_filename, size_t size, int streams, bool compress, bool verify) {
+    std::string part = partName(only_filename);
+    int fd = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        std::cerr << "无法创建文件: " << part << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    std::string crcHex;
+    bool ok = parallelTransfer(false, only_filename, fd, size, streams, compress, verify, crcHex);
+    close(fd);
+    uint32_t crc;
+    if (ok && !crcHex.empty() && (!fileChecksum(part, size, crc) || crc32cHex(crc) != crcHex)) {
+        std::cerr << "文件校验和不匹配: " << only_filename << std::endl;
+        ok = false;
+    }
+    if (!ok) {
+        std::remove(part.c_str());
+        std::cerr << "下载未完成: " << only_filename << std::endl;
+        return false;
+    }
+    std::rename(part.c_str(), only_filename.c_str());
+    std::cout << "下载完成: " << only_filename << " (总大小: " << size << " 字节)" << std::endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // 解析命令行参数：--streams=N 为大文件分块传输使用的连接数，1 表示不分块；
+    // --compress 请求压缩传输（服务端支持且文件不是已经压缩过的格式时生效）；
+    // --verify 请求校验传输（CRC32C），损坏的范围自动重传；
+    // --delta 重新上传服务端已有旧版本的文件时只发送变化的部分
+    int streams = 4;
+    bool compress = false;
+    bool verify = false;
+    bool delta = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--compress") {
+            compress = true;
+            continue;
+        }
+        if (arg == "--verify") {
+            verify = true;
+            continue;
+        }
+        if (arg == "--delta") {
+            delta = true;
+            continue;
+        }
+        if (arg.rfind("--streams=", 0) == 0) {
+            try {
+                streams = std::stoi(arg.substr(10));
+            } catch (const std::exception& e) {
+                streams = 0;
+            }
+        }
+        if (streams < 1 || arg.rfind("--streams=", 0) != 0) {
+            std::cerr << "用法: " << argv[0] << " [--streams=N] [--compress] [--verify] [--delta]\n";
+            return 1;
+        }
+    }
+
+    // 持久连接：多条命令复用同一个连接，服务端关闭后在下一条命令前重新连接
+    int sock = -1;
+    LineBuffer reader;
     while (true){
-        std::cout << "\n请输入命令（upload/download 文件名 或 exit）: ";
+        std::cout << "\n请输入命令（upload/download 文件名... 或 exit）: ";
         std::string input;
-        std::getline(std::cin, input);
+        if (!std::getline(std::cin, input)) input = "exit";
         if (input == "exit") {
-            int sock = socket(AF_INET, SOCK_STREAM, 0);
-            sockaddr_in serverAddr{};
-            serverAddr.sin_family = AF_INET;
-            serverAddr.sin_port = htons(PORT);
-            inet_pton(AF_INET, SERVER_IP, &serverAddr.sin_addr);
-        
-            if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == 0) {
+            if (sock >= 0 && connectionAlive(sock)) {
                 std::string command = "EXIT\n";
-                send(sock, command.c_str(), command.size(), 0);
+                send(sock, command.c_str(), command.size(), MSG_NOSIGNAL);
             }
-            close(sock);
+            if (sock >= 0) close(sock);
             break;
         }
         std::istringstream iss(input);
         std::string cmd, filename;
-        iss >> cmd >> filename;
-        if (cmd != "upload" && cmd != "download") {
-            std::cerr << "无效的命令，请输入 'upload' 或 'download'" << std::endl;
+        std::vector<std::string> filenames;
+        iss >> cmd;
+        while (iss >> filename) filenames.push_back(filename);
+        if ((cmd != "upload" && cmd != "download") || filenames.empty()) {
+            std::cerr << "无效的命令，请输入 'upload' 或 'download' 加一个或多个文件名" << std::endl;
             continue;
         }
-        // 提取文件名（不含路径）最好不带路径
-        std::string only_filename = filename.substr(filename.find_last_of("/\\") + 1);
-
-        // 创建连接
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        sockaddr_in serverAddr{};
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(PORT);
-        inet_pton(AF_INET, SERVER_IP, &serverAddr.sin_addr);
 
-        if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-            std::cerr << "连接服务器失败" << std::endl;
-            continue;
+        if (sock >= 0 && !connectionAlive(sock)) {
+            close(sock);
+            sock = -1;
         }
-        if (cmd == "upload"){//上传文件
-            std::ifstream file(filename, std::ios::binary);
-            if (!file.is_open()) {
-                std::cerr << "无法打开文件: " << filename << std::endl;
-                close(sock);
+        if (sock < 0) {
+            sock = connectServer();
+            reader = LineBuffer();
+            if (sock < 0) {
+                std::cerr << "连接服务器失败" << std::endl;
                 continue;
             }
-        
-            // 获取文件大小
-            file.seekg(0, std::ios::end);
-            size_t file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            
-            std::cout << "开始上传文件: " << only_filename << " (总大小: " << file_size << " 字节)" << std::endl;
-        
-            // 发送命令：UPLOAD filename\n
-            std::string command = "UPLOAD " + only_filename + "\n";
-            send(sock, command.c_str(), command.size(), 0);
-        
-            // 发送文件大小
-            std::string file_size_str = std::to_string(file_size) + "\n";
-            send(sock, file_size_str.c_str(), file_size_str.size(), 0);
-        
-            // 发送文件内容
-            char buffer[BUFFER_SIZE];
-            size_t sent = 0;
-            while (file.read(buffer, BUFFER_SIZE) || file.gcount() > 0) {
-                ssize_t bytes_sent = send(sock, buffer, file.gcount(), 0);
-                if (bytes_sent < 0) {
-                    std::cerr << "发送文件内容时出错" << std::endl;
-                    close(sock);
+        }
+
+        // 流水线：先把所有请求发出去，再按顺序读取响应，省去每个文件一次往返的等待
+        bool ok = true;
+        if (cmd == "upload"){//上传文件
+            // 先发送每个文件的摘要，服务端已有相同内容时直接秒传，不再发送文件数据
+            // 校验上传和增量上传时整个文件的校验和在计算摘要的同一遍读取中算出
+            std::vector<std::string> candidates;
+            std::vector<size_t> sizes;
+            std::vector<uint32_t> crcs;
+            std::string hashes;
+            for (const auto& f : filenames) {
+                size_t size;
+                std::string hex;
+                uint32_t crc = 0;
+                if (!localFileSize(f, size) || !sha256File(f, hex, verify || delta ? &crc : nullptr)) {
+                    std::cerr << "无法打开文件: " << f << std::endl;
+                    continue;
+                }
+                candidates.push_back(f);
+                sizes.push_back(size);
+                crcs.push_back(crc);
+                hashes += "HASH " + f.substr(f.find_last_of("/\\") + 1) + " " + std::to_string(size) + " " + hex + "\n";
+            }
+            send(sock, hashes.c_str(), hashes.size(), MSG_NOSIGNAL);
+
+            // 服务端已有相同内容时回复挑战 "PROVE offset length nonce"，用 PROOF 回答文件中这一段的摘要（见 blobstore.h）
+            // 服务端在 NEED 后面带上 lzf/crc32c 表示接受压缩/校验上传
+            std::vector<size_t> needed;
+            std::vector<bool> packs(candidates.size());
+            std::vector<const uint32_t*> checked(candidates.size());
+            std::vector<size_t> proving;
+            std::string proofs;
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                const std::string& f = candidates[i];
+                std::string response;
+                if (!reader.readLine(sock, response)) {
+                    ok = false;
                     break;
                 }
-                sent += bytes_sent;
-                
-                // 每发送1MB显示一次进度，或者在发送完成时显示
-                if (sent % (1024 * 1024) == 0 || sent == file_size) {
-                    float progress = (float)sent / file_size * 100;
-                    std::cout << "已上传: " << sent << "/" << file_size 
-                             << " 字节 (" << std::fixed << std::setprecision(2) << progress << "%)" << std::endl;
+                std::istringstream challenge(response);
+                std::string word, nonce, answer;
+                uint64_t offset = 0, length = 0;
+                if (challenge >> word >> offset >> length >> nonce && word == "PROVE" &&
+                    sha256Proof(f, nonce, offset, length, answer)) {
+                    proofs += "PROOF " + f.substr(f.find_last_of("/\\") + 1) + " " + answer + "\n";
+                    proving.push_back(i);
+                    continue;
                 }
+                packs[i] = compress && offers(response, COMPRESS_OPTION) && compressible(f);
+                checked[i] = verify && offers(response, CHECKSUM_OPTION) ? &crcs[i] : nullptr;
+                needed.push_back(i);
             }
-        
-            file.close();
-            if (sent < file_size) {
-                std::cerr << "上传未完成，实际发送: " << sent << "/" << file_size << " 字节" << std::endl;
-            } else {
-                std::cout << "上传完成: " << only_filename << " (总大小: " << sent << " 字节)" << std::endl;
+            if (ok && !proofs.empty()) send(sock, proofs.c_str(), proofs.size(), MSG_NOSIGNAL);
+            for (size_t i : proving) {
+                const std::string& f = candidates[i];
+                std::string response;
+                if (!ok || !reader.readLine(sock, response)) {
+                    ok = false;
+                    break;
+                }
+                if (response.substr(0, 2) == "OK") {
+                    std::cout << "秒传完成: " << f.substr(f.find_last_of("/\\") + 1) << " (服务端已有相同内容，大小: " << sizes[i] << " 字节)" << std::endl;
+                    continue;
+                }
+                packs[i] = compress && offers(response, COMPRESS_OPTION) && compressible(f);
+                checked[i] = verify && offers(response, CHECKSUM_OPTION) ? &crcs[i] : nullptr;
+                needed.push_back(i);
             }
-        }else if (cmd =="download"){
-            // 发送下载命令
-            std::string command = "DOWNLOAD " + only_filename + "\n";
-            send(sock, command.c_str(), command.size(), 0);
-
-            std::string response = recvLine(sock);  // 接收服务器的响应
-            if (response.substr(0, 5) == "ERROR") {
-                std::cerr << "服务端错误: " << response << std::endl;
-                close(sock);
-                continue;
+            std::sort(needed.begin(), needed.end());
+
+            // 增量上传：服务端有旧版本的文件只发送变化的部分，其余文件（以及增量上传失败的）完整上传
+            if (delta && ok) {
+                std::vector<size_t> rest;
+                for (size_t i : needed) {
+                    bool alive = true;
+                    if (sock >= 0 && sizes[i] >= DELTA_MIN_SIZE && deltaUpload(sock, reader, candidates[i], sizes[i], crcs[i], alive)) continue;
+                    rest.push_back(i);
+                    if (alive && sock >= 0) continue;
+                    close(sock);
+                    sock = connectServer();
+                    reader = LineBuffer();
+                }
+                needed.swap(rest);
+                ok = sock >= 0;
             }
-            //OK <filesize>\n 服务端响应格式，解析文件大小,比如OK 1048576\n
-            size_t filesize = 0;
-            std::istringstream ss(response);
-            std::string status;
-            ss >> status >> filesize;
-
-            std::cout << "开始下载文件: " << only_filename << " (总大小: " << filesize << " 字节)" << std::endl;
-           
-            std::ofstream outfile(only_filename, std::ios::binary);
-            char buffer[BUFFER_SIZE];
-            size_t received = 0;
-            while (received < filesize) {
-                ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
-                if (len <= 0) break;
-                outfile.write(buffer, len);
-                received += len;
-
-                // 每接收1MB数据显示一次进度，或者在接收完成时显示
-                if (received % (1024 * 1024) == 0 || received == filesize) {
-                    float progress = (float)received / filesize * 100;
-                    std::cout << "已下载: " << received << "/" << filesize 
-                                << " 字节 (" << std::fixed << std::setprecision(2) << progress << "%)" << std::endl;
+
+            // 其余文件先查询服务端是否已有未完成的上传，只发送剩余部分
+            // 大文件使用多连接分块上传，其余文件在持久连接上流水线上传
+            std::vector<std::string> files;
+            std::vector<bool> packed;
+            std::vector<const uint32_t*> checks;
+            std::string queries;
+            for (size_t i : needed) {
+                const std::string& f = candidates[i];
+                if (!ok) break;
+                if (streams > 1 && sizes[i] >= PARALLEL_MIN_SIZE) {
+                    parallelUpload(f, sizes[i], streams, packs[i], checked[i]);
+                    continue;
                 }
+                files.push_back(f);
+                packed.push_back(packs[i]);
+                checks.push_back(checked[i]);
+                queries += "QUERY " + f.substr(f.find_last_of("/\\") + 1) + " " + std::to_string(sizes[i]) + "\n";
             }
+            if (ok) send(sock, queries.c_str(), queries.size(), MSG_NOSIGNAL);
+            std::vector<size_t> offsets;
+            for (size_t i = 0; ok && i < files.size(); ++i) offsets.push_back(recvQueryReply(sock, reader));
 
-            outfile.close();
-            if (received < filesize) {
-                std::cerr << "下载未完成，实际接收: " << received << "/" << filesize << " 字节" << std::endl;
-            } else {
-                std::cout << "下载完成: " << only_filename << " (总大小: " << received << " 字节)" << std::endl;
+            // 校验和不匹配的文件在这一轮结束后从同一偏移重新上传
+            std::vector<size_t> pending;
+            for (size_t i = 0; ok && i < files.size(); ++i) pending.push_back(i);
+            for (int attempt = 1; ok && !pending.empty(); ++attempt) {
+                std::vector<size_t> sent;
+                for (size_t i : pending) {
+                    if (sendUpload(sock, files[i], offsets[i], packed[i], checks[i])) sent.push_back(i);
+                }
+                pending.clear();
+                for (size_t i : sent) {
+                    bool corrupted;
+                    if (!(ok = recvUploadAck(sock, reader, files[i], corrupted))) break;
+                    if (corrupted && attempt < VERIFY_ATTEMPTS) pending.push_back(i);
+                }
+            }
+        }else if (cmd =="download"){
+            // 先用长度为 0 的范围请求查询文件大小，大文件使用多连接分块下载
+            // （有未完成的 .part 文件时仍按顺序续传）
+            std::vector<std::string> files = filenames;
+            if (streams > 1) {
+                std::string probes;
+                for (const auto& f : filenames) probes += "DOWNLOAD " + f.substr(f.find_last_of("/\\") + 1) + " 0 0\n";
+                send(sock, probes.c_str(), probes.size(), MSG_NOSIGNAL);
+                files.clear();
+                for (const auto& f : filenames) {
+                    std::string only_filename = f.substr(f.find_last_of("/\\") + 1);
+                    std::string response, status;
+                    size_t size = 0;
+                    if (!reader.readLine(sock, response)) {
+                        ok = false;
+                        break;
+                    }
+                    std::istringstream ss(response);
+                    ss >> status >> size;
+                    struct stat st{};
+                    if (status == "OK" && size >= PARALLEL_MIN_SIZE && stat(partName(only_filename).c_str(), &st) < 0) {
+                        parallelDownload(only_filename, size, streams, compress, verify);
+                    } else {
+                        files.push_back(f);
+                    }
+                }
+            }
+            // 校验和不匹配的文件在这一轮结束后重新下载（从截断后的 .part 续传）
+            for (int attempt = 1; ok && !files.empty(); ++attempt) {
+                std::string commands;
+                for (const auto& f : files) commands += downloadCommand(f, compress, verify);
+                send(sock, commands.c_str(), commands.size(), MSG_NOSIGNAL);
+                std::vector<std::string> again;
+                for (const auto& f : files) {
+                    bool corrupted;
+                    if (!(ok = recvDownload(sock, reader, f, corrupted))) break;
+                    if (corrupted && attempt < VERIFY_ATTEMPTS) again.push_back(f);
+                }
+                files.swap(again);
             }
         }
-
-        close(sock);
+        // 传输中途出错时连接的状态不确定，下次重新连接
+        if (!ok) {
+            close(sock);
+            sock = -1;
+        }
     }
 
-
-
     return 0;
 }
@@ -0,0 +1,36 @@
+#include "cmdoption.h"
+#include <sstream>
+#include <vector>
+
+// 在命令和文件名之后查找第一个满足 match 的词，找到时把它从命令行中去掉并返回
+static bool takeToken(std::string& line, bool (*match)(const std::string&, const std::string&),
+                      const std::string& key, std::string& found) {
+    std::istringstream iss(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (iss >> token) tokens.push_back(token);
+    size_t i = 2;
+    while (i < tokens.size() && !match(tokens[i], key)) ++i;
+    if (i >= tokens.size()) return false;
+    found = tokens[i];
+    tokens.erase(tokens.begin() + i);
+    line.clear();
+    for (const std::string& t : tokens) line += (line.empty() ? "" : " ") + t;
+    return true;
+}
+
+bool takeOption(std::string& line, const std::string& option) {
+    std::string found;
+    return takeToken(line, [](const std::string& token, const std::string& key) { return token == key; }, option, found);
+}
+
+bool takeOptionValue(std::string& line, const std::string& name, std::string& value) {
+    std::string found;
+    if (!takeToken(line, [](const std::string& token, const std::string& key) {
+            return token.size() > key.size() && token.compare(0, key.size(), key) == 0 && token[key.size()] == '=';
+        }, name, found)) {
+        return false;
+    }
+    value = found.substr(name.size() + 1);
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef CMDOPTION_H
+#define CMDOPTION_H
+
+#include <string>
+
+/**
+ * @brief 命令行和响应头中的可选项
+ *
+ * 选项跟在命令和文件名之后，如 "DOWNLOAD a.pcd voxel=0.1 lzf" 或响应头 "OK 1024 crc32c"。
+ * 服务端取出认识的选项后按原来的方式解析剩下的部分，客户端用同样的函数解析响应头。
+ */
+
+// 命令行中命令和文件名之后带有选项 option（如 "lzf"、"crc32c"）时去掉它并返回 true，
+// 只有命令和文件名两部分时不当作选项，避免把同名的文件当成选项
+bool takeOption(std::string& line, const std::string& option);
+// 带值的选项 "name=value"：找到时去掉它，把值放进 value 并返回 true，规则同 takeOption
+bool takeOptionValue(std::string& line, const std::string& name, std::string& value);
+
+#endif // CMDOPTION_H
@@ -0,0 +1,175 @@
+#include "command.h"
+#include "cmdoption.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "blobstore.h"
+#include <sstream>
+#include <algorithm>
+
+bool parseNumber(const std::string& s, uint64_t& value) {
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos) return false;
+    try {
+        value = std::stoull(s);
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return true;
+}
+
+bool ByteRange::parse(std::istream& in) {
+    ranged = false;
+    offset = 0;
+    length = UINT64_MAX;
+    std::string offsetStr, lengthStr, extra;
+    if (!(in >> offsetStr)) return true;  // 不带范围
+    ranged = true;
+    if (!parseNumber(offsetStr, offset)) return false;
+    if (in >> lengthStr && !parseNumber(lengthStr, length)) return false;
+    return !(in >> extra);
+}
+
+bool ByteRange::resolve(uint64_t fileSize) {
+    if (offset > fileSize) return false;
+    length = std::min(length, fileSize - offset);
+    return true;
+}
+
+std::string ByteRange::header(uint64_t fileSize) const {
+    if (!ranged) return "OK " + std::to_string(fileSize) + "\n";
+    return "OK " + std::to_string(fileSize) + " " + std::to_string(offset) + " " + std::to_string(length) + "\n";
+}
+
+static CommandType commandType(const std::string& command) {
+    static const struct { const char* name; CommandType type; } names[] = {
+        {"EXIT", CommandType::Exit}, {"UPLOAD", CommandType::Upload}, {"CHUNK", CommandType::Chunk},
+        {"QUERY", CommandType::Query}, {"HASH", CommandType::Hash}, {"PROOF", CommandType::Proof},
+        {"SIGNATURE", CommandType::Signature}, {"DELTA", CommandType::Delta}, {"FIND", CommandType::Find},
+        {"STAT", CommandType::Stat}, {"MERGE", CommandType::Merge}, {"BOX", CommandType::Box},
+        {"DOWNLOAD", CommandType::Download},
+    };
+    for (const auto& entry : names) {
+        if (command == entry.name) return entry.type;
+    }
+    return CommandType::Unknown;
+}
+
+bool validBasename(const std::string& basename) {
+    return !basename.empty() && basename[0] != '.';
+}
+
+// 命令的第二部分是否为文件名（FIND/MERGE 为文件名模式，EXIT 没有参数）
+static bool takesBasename(CommandType type) {
+    return type != CommandType::Exit && type != CommandType::Find && type != CommandType::Merge &&
+           type != CommandType::Unknown;
+}
+
+Command parseCommand(std::string line) {
+    Command cmd;
+    // 命令行末尾的 lzf 请求压缩传输，crc32c 请求校验传输（UPLOAD/CHUNK/DOWNLOAD）
+    cmd.compress = takeOption(line, COMPRESS_OPTION);
+    cmd.verify = takeOption(line, CHECKSUM_OPTION);
+    // 下载命令中的 voxel=<边长> 等选项请求服务端处理点云（见 pcd.h）
+    bool pcdValid = cmd.transform.take(line);
+    // 将接收到的命令和文件名解析出来
+    std::istringstream iss(line);
+    std::string command, filename;
+    iss >> command >> filename;
+    cmd.type = commandType(command);
+    // 获取文件名（不包含路径）
+    cmd.basename = filename.substr(filename.find_last_of("/\\") + 1);
+    if (takesBasename(cmd.type) && !validBasename(cmd.basename)) {
+        cmd.error = "ERROR 文件名无效\n";
+        // 上传的大小行和数据、增量上传的操作序列无法与命令区分
+        cmd.closeOnError = cmd.type == CommandType::Upload || cmd.type == CommandType::Chunk ||
+                           cmd.type == CommandType::Delta;
+        return cmd;
+    }
+
+    switch (cmd.type) {
+    case CommandType::Query: {
+        // "QUERY name size\n"
+        std::string sizeStr;
+        if (!(iss >> sizeStr) || !parseNumber(sizeStr, cmd.size)) cmd.error = "ERROR 文件大小格式错误\n";
+        break;
+    }
+    case CommandType::Hash: {
+        // "HASH name size sha256\n"
+        std::string sizeStr;
+        if (!(iss >> sizeStr >> cmd.digest) || !parseNumber(sizeStr, cmd.size) || !validDigest(cmd.digest)) {
+            cmd.error = "ERROR 摘要格式错误\n";
+        }
+        break;
+    }
+    case CommandType::Proof:
+        // "PROOF name answer\n"，没有回答时按回答错误处理
+        iss >> cmd.answer;
+        break;
+    case CommandType::Delta: {
+        // "DELTA name size blocksize crc32c\n" + 操作序列
+        std::string sizeStr, blockStr, crcHex;
+        iss >> sizeStr >> blockStr >> crcHex;
+        if (!parseNumber(sizeStr, cmd.size) || cmd.size == 0 || !parseNumber(blockStr, cmd.blockSize) ||
+            !parseCrc32c(crcHex, cmd.crc)) {
+            cmd.error = "ERROR 增量上传参数错误\n";
+            cmd.closeOnError = true;
+        }
+        break;
+    }
+    case CommandType::Find: {
+        // "FIND pattern [条件...]\n"
+        std::istringstream args(line);
+        args >> command;
+        if (!cmd.query.parse(args)) cmd.error = "ERROR 查询条件格式错误\n";
+        break;
+    }
+    case CommandType::Merge: {
+        // "MERGE pattern [first=N] [last=N]\n"，合并结果不支持点云处理选项
+        std::istringstream args(line);
+        args >> command;
+        if (!cmd.merge.parse(args) || !pcdValid || cmd.transform.active()) cmd.error = "ERROR 合并参数错误\n";
+        break;
+    }
+    case CommandType::Box:
+        // "BOX name minx miny minz maxx maxy maxz\n"
+        if (!cmd.box.parse(iss) || !pcdValid) cmd.error = "ERROR 范围查询参数错误\n";
+        break;
+    case CommandType::Download:
+        // "DOWNLOAD name [offset [length]]\n"
+        if (!cmd.range.parse(iss)) {
+            cmd.error = "ERROR 范围格式错误\n";
+        } else if (!pcdValid) {
+            cmd.error = "ERROR 点云处理选项错误\n";
+        }
+        break;
+    default:
+        break;
+    }
+    return cmd;
+}
+
+bool parseSizeLine(const std::string& line, bool chunked, SizeLine& out, std::string& error) {
+    // 确保收到了文件大小信息
+    if (line.empty()) {
+        error = "未收到文件大小信息";
+        return false;
+    }
+    // 大小行为 "size" 或 "size offset"，后者表示从 offset 处续传；分块上传为 "size offset length"
+    std::istringstream iss(line);
+    std::string sizeStr, offsetStr, lengthStr;
+    iss >> sizeStr >> offsetStr >> lengthStr;
+    out = SizeLine();
+    bool valid = parseNumber(sizeStr, out.size) && (offsetStr.empty() || parseNumber(offsetStr, out.offset)) &&
+                 out.offset <= out.size;
+    if (chunked) {
+        valid = valid && parseNumber(lengthStr, out.length) && out.length > 0 && out.length <= out.size - out.offset;
+    }
+    if (!valid) {
+        error = "文件大小格式错误: " + line;
+        return false;
+    }
+    if (out.size == 0) {
+        error = "文件大小为0，拒绝接收";
+        return false;
+    }
+    return true;
+}
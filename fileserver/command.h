@@ -0,0 +1,79 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <string>
+#include <istream>
+#include <cstdint>
+#include "pcd.h"
+#include "pcdindex.h"
+#include "pcdcatalog.h"
+#include "pcdmerge.h"
+
+/**
+ * @brief 客户端命令行和上传大小行的解析
+ *
+ * epoll 后端（Connection）和 io_uring 后端（UringServer）都只按这里的解析结果分派命令，
+ * 参数检查也在这里完成，两个后端回复的错误相同。解析不访问磁盘。
+ */
+
+// 解析非负十进制整数，拒绝负号、空串和多余字符
+bool parseNumber(const std::string& s, uint64_t& value);
+
+/**
+ * @brief 下载请求的字节范围："DOWNLOAD name [offset [length]]"
+ *
+ * 不带范围时发送整个文件，响应头为 "OK <size>\n"；带范围时只发送
+ * [offset, offset + length)，响应头为 "OK <size> <offset> <length>\n"。
+ * 省略 length 表示一直到文件末尾，超出文件末尾的部分被截掉。
+ */
+struct ByteRange {
+    bool ranged = false;
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+
+    bool parse(std::istream& in);                 // 解析命令行中文件名之后的部分，格式错误返回 false
+    bool resolve(uint64_t fileSize);              // 按文件大小截断 length，offset 超出文件末尾返回 false
+    std::string header(uint64_t fileSize) const;  // 下载响应头
+    bool probe() const { return ranged && length == 0; }  // 长度为 0 的范围，客户端用来查询文件大小
+};
+
+enum class CommandType { Exit, Upload, Chunk, Query, Hash, Proof, Signature, Delta, Find, Stat, Merge, Box, Download, Unknown };
+
+// 一条命令行的解析结果，各字段只对用到它的命令有意义
+struct Command {
+    CommandType type = CommandType::Unknown;
+    std::string basename;    // 文件名（不包含路径）
+    bool compress = false;   // 末尾带 lzf，请求压缩传输
+    bool verify = false;     // 末尾带 crc32c，请求校验传输
+    PcdTransform transform;  // 点云处理选项（见 pcd.h）
+    uint64_t size = 0;       // QUERY/HASH/DELTA 的文件大小
+    std::string digest;      // HASH 的 sha256
+    std::string answer;      // PROOF 的回答
+    uint64_t blockSize = 0;  // DELTA 的块大小
+    uint32_t crc = 0;        // DELTA 的 crc32c
+    ByteRange range;         // DOWNLOAD 的字节范围
+    PcdQuery query;          // FIND 的条件
+    PcdMergeRequest merge;   // MERGE 的参数
+    PcdBox box;              // BOX 的范围
+    std::string error;       // 参数错误时要回复的 "ERROR ...\n"，为空表示命令有效
+    bool closeOnError = false;  // 随后的数据无法与命令区分，回复错误后关闭连接
+};
+
+// 客户端可以使用的文件名：非空且不以 '.' 开头。filedir 中以 '.' 开头的是服务端自己的目录和文件
+// （.partial/、.blobs/、.pcdindex/、.pcdstats/、.pcdcatalog 和各种临时文件），不能被下载或覆盖
+bool validBasename(const std::string& basename);
+
+// 解析命令行（不含换行符）并检查参数，带文件名的命令文件名无效时回复 "ERROR 文件名无效"
+Command parseCommand(std::string line);
+
+// 上传的大小行："size"、续传的 "size offset" 或分块上传的 "size offset length"
+struct SizeLine {
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;  // 只用于分块上传
+};
+
+// 解析大小行，为空、格式错误或大小为 0 时返回 false 并把日志信息放进 error，调用方随后关闭连接
+bool parseSizeLine(const std::string& line, bool chunked, SizeLine& out, std::string& error);
+
+#endif // COMMAND_H
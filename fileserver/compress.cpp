@@ -0,0 +1,197 @@
+#include "compress.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+constexpr int HASH_LOG = 14;
+constexpr size_t MAX_OFFSET = 1 << 13;  // 回溯距离上限（控制字节 5 位 + 1 字节）
+constexpr size_t MAX_MATCH = 264;       // 匹配长度上限（3 位 + 1 字节 + 2）
+constexpr size_t MAX_LITERAL = 32;      // 一段字面量的长度上限
+
+static inline uint32_t hash3(const uint8_t* p) {
+    uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// 每个线程一张哈希表，各次压缩共用，不再每块分配并清零一次。表项为 base + 位置 + 1，
+// 不大于 base 的表项是之前的调用留下的，当作空；base 快要溢出时才整张清零
+struct HashTable {
+    std::vector<uint32_t> slots = std::vector<uint32_t>(1 << HASH_LOG, 0);
+    uint32_t base = 0;
+};
+static thread_local HashTable hashTable;
+
+/**
+ * @brief LZF 压缩（与 liblzf 的格式兼容）
+ *
+ * 控制字节 000LLLLL：随后 L+1 个字面量字节；
+ * LLLooooo：长度为 L+2（L 为 7 时再加下一个字节）的回溯匹配，距离为 ((ooooo << 8) | 下一个字节) + 1。
+ * 用 3 字节哈希表查找候选匹配，单遍扫描。
+ */
+size_t lzfCompress(const char* input, size_t inLen, char* output, size_t outCap) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+    uint8_t* out = reinterpret_cast<uint8_t*>(output);
+    if (inLen == 0 || outCap < 2) return 0;
+    HashTable& hash = hashTable;
+    if (inLen >= UINT32_MAX - hash.base) {
+        std::fill(hash.slots.begin(), hash.slots.end(), 0);
+        hash.base = 0;
+    }
+    const uint32_t base = hash.base;
+    hash.base += inLen;
+    uint32_t* table = hash.slots.data();
+
+    size_t ip = 0;
+    size_t op = 1;   // out[op - lit - 1] 是当前字面量段的控制字节
+    size_t lit = 0;
+    while (ip < inLen) {
+        size_t len = 0;
+        size_t ref = 0;
+        if (ip + 2 < inLen) {
+            uint32_t h = hash3(in + ip);
+            ref = table[h] > base ? table[h] - base : 0;  // 位置 + 1，0 表示空
+            table[h] = base + ip + 1;
+            if (ref > 0 && ip - ref < MAX_OFFSET && std::memcmp(in + ref - 1, in + ip, 3) == 0) {
+                size_t maxLen = std::min(MAX_MATCH, inLen - ip);
+                len = 3;
+                while (len < maxLen && in[ref - 1 + len] == in[ip + len]) ++len;
+            }
+        }
+        if (len == 0) {
+            if (op + 2 > outCap) return 0;
+            out[op++] = in[ip++];
+            if (++lit == MAX_LITERAL) {
+                out[op - lit - 1] = lit - 1;
+                lit = 0;
+                ++op;
+            }
+            continue;
+        }
+        // 结束当前字面量段，没有字面量时去掉预留的控制字节
+        if (lit > 0) {
+            out[op - lit - 1] = lit - 1;
+        } else {
+            --op;
+        }
+        if (op + 4 > outCap) return 0;
+        size_t off = ip - ref;  // 回溯距离 - 1
+        size_t code = len - 2;
+        if (code < 7) {
+            out[op++] = (off >> 8) + (code << 5);
+        } else {
+            out[op++] = (off >> 8) + (7 << 5);
+            out[op++] = code - 7;
+        }
+        out[op++] = off & 0xff;
+        lit = 0;
+        ++op;
+        // 匹配末尾的位置也放进哈希表，提高后续匹配的命中率
+        ip += len;
+        if (ip + 2 < inLen) table[hash3(in + ip - 1)] = base + ip;
+    }
+    if (lit > 0) {
+        out[op - lit - 1] = lit - 1;
+    } else {
+        --op;
+    }
+    return op;
+}
+
+size_t lzfDecompress(const char* input, size_t inLen, char* output, size_t outCap) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+    uint8_t* out = reinterpret_cast<uint8_t*>(output);
+    size_t ip = 0, op = 0;
+    while (ip < inLen) {
+        size_t ctrl = in[ip++];
+        if (ctrl < 32) {
+            size_t len = ctrl + 1;
+            if (ip + len > inLen || op + len > outCap) return 0;
+            std::memcpy(out + op, in + ip, len);
+            ip += len;
+            op += len;
+            continue;
+        }
+        size_t len = ctrl >> 5;
+        if (len == 7) {
+            if (ip >= inLen) return 0;
+            len += in[ip++];
+        }
+        len += 2;
+        if (ip >= inLen) return 0;
+        size_t back = ((ctrl & 0x1f) << 8) + in[ip++] + 1;
+        if (back > op || op + len > outCap) return 0;
+        // 源和目标可能重叠（重复的短模式），逐字节复制
+        for (size_t i = 0; i < len; ++i, ++op) out[op] = out[op - back];
+    }
+    return op;
+}
+
+static void putBE32(char* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t getBE32(const char* p) {
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+}
+
+size_t frameBound(size_t len) {
+    return len + (len + COMPRESS_BLOCK - 1) / COMPRESS_BLOCK * FRAME_HEADER;
+}
+
+size_t encodeFrames(const char* in, size_t len, char* out) {
+    size_t written = 0;
+    for (size_t pos = 0; pos < len; pos += COMPRESS_BLOCK) {
+        size_t raw = std::min(COMPRESS_BLOCK, len - pos);
+        char* frame = out + written;
+        // 压缩后不比原始数据小时按原样存储
+        size_t stored = lzfCompress(in + pos, raw, frame + FRAME_HEADER, raw - 1);
+        if (stored == 0) {
+            std::memcpy(frame + FRAME_HEADER, in + pos, raw);
+            stored = raw;
+        }
+        putBE32(frame, raw);
+        putBE32(frame + 4, stored);
+        written += FRAME_HEADER + stored;
+    }
+    return written;
+}
+
+bool parseFrameHeader(const char* header, size_t& rawLen, size_t& storedLen) {
+    rawLen = getBE32(header);
+    storedLen = getBE32(header + 4);
+    return rawLen > 0 && rawLen <= COMPRESS_BLOCK && storedLen > 0 && storedLen <= rawLen;
+}
+
+bool decodeFrame(const char* stored, size_t storedLen, char* out, size_t rawLen) {
+    if (storedLen == rawLen) {
+        std::memcpy(out, stored, rawLen);
+        return true;
+    }
+    return lzfDecompress(stored, storedLen, out, rawLen) == rawLen;
+}
+
+bool looksCompressed(const char* data, size_t len) {
+    static const struct { const char* magic; size_t len; } formats[] = {
+        {"\x89PNG\r\n\x1a\n", 8},  // PNG
+        {"\xff\xd8\xff", 3},       // JPEG
+        {"GIF8", 4},               // GIF
+        {"\x1f\x8b", 2},           // gzip
+        {"PK\x03\x04", 4},         // zip（含 docx/jar 等）
+        {"BZh", 3},                // bzip2
+        {"\xfd" "7zXZ", 5},        // xz
+        {"\x28\xb5\x2f\xfd", 4},   // zstd
+        {"7z\xbc\xaf\x27\x1c", 6}, // 7z
+        {"Rar!", 4},               // rar
+    };
+    for (const auto& f : formats) {
+        if (len >= f.len && std::memcmp(data, f.magic, f.len) == 0) return true;
+    }
+    // WebP 与 MP4/MOV 的标识不在文件开头
+    if (len >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) return true;
+    if (len >= 8 && std::memcmp(data + 4, "ftyp", 4) == 0) return true;
+    return false;
+}
@@ -0,0 +1,38 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief 压缩传输：LZF 分块编解码，不依赖外部库，服务端和客户端共用
+ *
+ * 客户端在命令行末尾加上 COMPRESS_OPTION（"UPLOAD name lzf"、"CHUNK name lzf"、
+ * "DOWNLOAD name [offset [length]] lzf"）请求压缩传输。文件数据按 COMPRESS_BLOCK 切成
+ * 互相独立的块，每块编码为一帧：8 字节帧头（原始长度、存储长度，均为大端 32 位）+ 存储的数据；
+ * 存储长度等于原始长度表示这一块压缩后没有变小，按原样存储。
+ * 块之间没有依赖，多个连接（分块传输）可以在不同的核上同时压缩和解压同一个文件的不同部分。
+ */
+
+constexpr const char* COMPRESS_OPTION = "lzf";
+constexpr size_t COMPRESS_BLOCK = 64 * 1024;  // 每帧的最大原始长度
+constexpr size_t FRAME_HEADER = 8;
+
+// LZF 压缩，结果不能放进 outCap 字节时返回 0
+size_t lzfCompress(const char* in, size_t inLen, char* out, size_t outCap);
+// LZF 解压，数据损坏或超出 outCap 时返回 0，否则返回解压后的长度
+size_t lzfDecompress(const char* in, size_t inLen, char* out, size_t outCap);
+
+// 编码 len 字节为若干帧所需的最大空间
+size_t frameBound(size_t len);
+// 把 in 切成块逐块编码写入 out（至少 frameBound(len) 字节），返回写入的字节数
+size_t encodeFrames(const char* in, size_t len, char* out);
+// 解析帧头，长度不合法时返回 false
+bool parseFrameHeader(const char* header, size_t& rawLen, size_t& storedLen);
+// 把一帧存储的数据还原为 rawLen 字节写入 out，数据损坏时返回 false
+bool decodeFrame(const char* stored, size_t storedLen, char* out, size_t rawLen);
+
+// 按文件开头的魔数判断是否已经是压缩格式（PNG、JPEG、gzip、zip 等），这类文件不再压缩
+bool looksCompressed(const char* data, size_t len);
+
+#endif // COMPRESS_H
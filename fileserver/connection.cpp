@@ -0,0 +1,1520 @@
+#include "connection.h"
+#include "staging.h"
+#include "blobstore.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "delta.h"
+#include "pcd.h"
+#include "pcdindex.h"
+#include "pcdcatalog.h"
+#include "pcdstats.h"
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+constexpr size_t IO_CHUNK = 64 * 1024;                // 单次 recv/read/splice 的最大字节数（默认管道容量）
+constexpr int SPLICE_PIPE_SIZE = 1024 * 1024;          // splice 上传的管道容量，攒满后一次交给线程池写盘
+constexpr size_t MAX_BYTES_PER_EVENT = 1024 * 1024;   // 每次事件最多传输的字节数，超过后让出给其他连接
+constexpr size_t MAX_LINE = 4096;                     // 命令行/大小行的最大长度
+constexpr size_t MAP_PREFETCH = 4 * 1024 * 1024;      // Mmap 模式每次通知内核预读的窗口
+constexpr size_t MAX_CHALLENGES = 4096;               // 每个连接最多保留的秒传挑战，超过后直接要求上传
+constexpr size_t COMPRESS_FRAMES = 4;                 // 压缩传输每批的帧数，同一批的帧在不同线程上并行编解码
+constexpr size_t COMPRESS_BATCH = COMPRESS_FRAMES * COMPRESS_BLOCK;  // 压缩下载每次读盘并压缩的字节数
+
+Connection::Connection(int fd, ConnectionHost& host, const ServerConfig& config)
+    : sockFd(fd), host(host), config(config) {
+    //获取客户端的IP地址和端口号
+    sockaddr_in peerAddr{};
+    socklen_t peerLen = sizeof(peerAddr);
+    char ipStr[INET_ADDRSTRLEN] = {0};
+    int port = 0;
+    if (getpeername(fd, (sockaddr*)&peerAddr, &peerLen) == 0) {
+        inet_ntop(AF_INET, &peerAddr.sin_addr, ipStr, sizeof(ipStr));
+        port = ntohs(peerAddr.sin_port);
+    }
+    peer = std::string(ipStr) + ":" + std::to_string(port);
+    lastActive = std::chrono::steady_clock::now();
+}
+
+Connection::~Connection() {
+    if (fileFd >= 0) close(fileFd);
+    if (pipeFds[0] >= 0) close(pipeFds[0]);
+    if (pipeFds[1] >= 0) close(pipeFds[1]);
+    if (!lent) close(sockFd);
+}
+
+Connection::Connection(int fd, ConnectionHost& host, const ServerConfig& config, const std::string& pending)
+    : Connection(fd, host, config) {
+    lent = true;
+    inBuf.append(pending.data(), pending.size());
+}
+
+bool Connection::lendDone() const {
+    return lent && commandRead && state == ConnState::ReadCommand && !diskPending && !writePending;
+}
+
+std::string Connection::takeInput() {
+    std::string rest(inBuf.size(), '\0');
+    inBuf.take(&rest[0], rest.size());
+    return rest;
+}
+
+uint32_t Connection::interest() const {
+    if (diskPending || writeBlocked || lendDone()) return 0;
+    switch (state) {
+        case ConnState::ReadCommand:
+        case ConnState::ReadSize:
+        case ConnState::RecvBody:
+            return EPOLLIN;
+        case ConnState::SendHeader:
+            return EPOLLOUT;
+        case ConnState::SendFile:
+            // Stream 模式缓冲区为空时需要先读磁盘，此时由 diskPending 暂停监听
+            return EPOLLOUT;
+        default:
+            return 0;
+    }
+}
+
+void Connection::handleEvent(uint32_t /*events*/) {
+    // 具体的错误/挂断由随后的 recv/send 返回值给出，这里只负责推进状态机
+    lastActive = std::chrono::steady_clock::now();
+    budget = MAX_BYTES_PER_EVENT;
+    drive();
+}
+
+void Connection::onDiskDone() {
+    diskPending = false;
+    lastActive = std::chrono::steady_clock::now();
+    auto then = std::move(diskThen);
+    diskThen = nullptr;
+    then();
+    budget = MAX_BYTES_PER_EVENT;
+    drive();
+}
+
+/**
+ * @brief 后台写盘的数据块已写完
+ *
+ * 归还缓冲区并开始写下一块；写入失败则中断上传。之前因写队列已满而暂停的接收在这里恢复，
+ * 中断的上传在这里继续保存进度。
+ */
+void Connection::onWriteDone() {
+    writePending = false;
+    writeBlocked = false;
+    lastActive = std::chrono::steady_clock::now();
+    bool ok = writer.finishWrite();
+    if (abortPending) {
+        abortPending = false;
+        saveAbortedUpload();
+    } else if (!ok) {
+        abortUpload(std::string("写入文件失败: ") + strerror(errno));
+    } else {
+        kickWrite();
+    }
+    budget = MAX_BYTES_PER_EVENT;
+    drive();
+}
+
+/**
+ * @brief 空闲超时检查
+ *
+ * 超过 idleTimeout 秒没有任何 socket 事件或磁盘完成时关闭连接；
+ * 上传途中超时会删除不完整的文件。有磁盘任务在执行或等待写盘时不检查。
+ */
+void Connection::checkIdle(std::chrono::steady_clock::time_point now) {
+    if (config.idleTimeout <= 0 || diskPending || writeBlocked || state == ConnState::Closed) return;
+    if (now - lastActive < std::chrono::seconds(config.idleTimeout)) return;
+    if (state == ConnState::RecvBody && patching) {
+        abortDelta("连接空闲超时，增量数据不完整: " + peer);
+    } else if (state == ConnState::RecvBody) {
+        abortUpload("连接空闲超时，接收文件不完整: " + peer);  // 已收到的部分保留在暂存区
+    } else {
+        std::cout << "连接空闲超时: " << peer << std::endl;
+        if (fileFd >= 0) {
+            close(fileFd);
+            fileFd = -1;
+        }
+        state = ConnState::Closed;
+    }
+}
+
+/**
+ * @brief 把一个磁盘操作交给线程池
+ *
+ * work 在线程池中执行，只能访问本连接的文件相关成员；then 在事件循环线程中执行。
+ * 任务执行期间连接不监听 socket 事件，也不会被回收。
+ */
+void Connection::runDisk(std::function<void()> work, std::function<void()> then) {
+    diskPending = true;
+    diskThen = std::move(then);
+    host.submitDisk(*this, std::move(work));
+}
+
+// 与 runDisk 相同，但 work 中的各个任务互相独立，分给线程池的多个线程同时执行；
+// 全部完成后由最后完成的线程执行 join，再在事件循环线程中执行 then
+void Connection::runParallel(std::vector<std::function<void()>> work, std::function<void()> join, std::function<void()> then) {
+    diskPending = true;
+    diskThen = std::move(then);
+    host.submitBatch(*this, std::move(work), std::move(join));
+}
+
+// 推进状态机，直到需要等待 socket 事件、磁盘任务、后台写盘或连接结束
+void Connection::drive() {
+    while (!diskPending && !writeBlocked && state != ConnState::Closed) {
+        Step step = Step::Wait;
+        switch (state) {
+            case ConnState::ReadCommand: step = lendDone() ? Step::Wait : readCommand(); break;
+            case ConnState::ReadSize:    step = readSize();    break;
+            case ConnState::RecvBody:    step = recvBody();    break;
+            case ConnState::SendHeader:  step = sendHeader();  break;
+            case ConnState::SendFile:    step = sendFile();    break;
+            case ConnState::Closed:      break;
+        }
+        if (step == Step::Wait) return;
+    }
+}
+
+/**
+ * @brief 非阻塞地读取一行（不含 \n）
+ *
+ * 先在输入缓冲区中查找换行符，没有完整的一行时再 recv 一大块数据，
+ * 一个协议头通常只需要一次 recv。
+ *
+ * @param line 读到的一行
+ * @param done 读到完整一行时置为 true，否则需要等待更多数据
+ * @return 对端关闭、出错或行过长时返回 false
+ */
+bool Connection::readLine(std::string& line, bool& done) {
+    done = false;
+    while (!inBuf.getLine(line)) {
+        if (inBuf.size() > MAX_LINE) return false;
+        ssize_t n = inBuf.fill(sockFd);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+        if (n == 0) return false;
+    }
+    done = true;
+    return true;
+}
+
+Connection::Step Connection::readCommand() {
+    std::string line;
+    bool done;
+    if (!readLine(line, done)) {
+        // 如果接收失败或连接关闭，关闭客户端连接
+        state = ConnState::Closed;
+        return Step::Continue;
+    }
+    if (!done) return Step::Wait;
+    commandRead = true;
+
+    Command cmd = parseCommand(line);
+    compress = cmd.compress;
+    verify = cmd.verify;
+    pcdTransform = cmd.transform;
+    basename = cmd.basename;
+    // 构造文件的完整路径
+    fullpath = "filedir/" + basename;
+    if (!cmd.error.empty()) {
+        reply(cmd.error, cmd.closeOnError ? ConnState::Closed : ConnState::ReadCommand);
+        return Step::Continue;
+    }
+
+    switch (cmd.type) {
+    case CommandType::Exit:
+        std::cout << "断开连接: " << peer << std::endl;
+        state = ConnState::Closed;
+        break;
+    case CommandType::Upload:
+    case CommandType::Chunk:
+        if (cmd.type == CommandType::Upload) std::cout << "客户端 " << peer << " 请求上传文件" << std::endl;
+        chunked = cmd.type == CommandType::Chunk;
+        state = ConnState::ReadSize;
+        break;
+    case CommandType::Query:
+        // 查询未完成的上传已经收到了多少字节："QUERY name size\n" -> "OK <bytes>\n"
+        fileSize = cmd.size;
+        runDisk([this] {
+            diskResult = stagedBytes(basename, fileSize);
+        }, [this] {
+            reply("OK " + std::to_string(diskResult) + "\n", ConnState::ReadCommand);
+        });
+        break;
+    case CommandType::Hash: {
+        // 秒传第一步："HASH name size sha256\n"，服务端已有这份内容时回复挑战 "PROVE <offset> <length> <nonce>\n"，
+        // 否则回复 "NEED\n"（见 blobstore.h）
+        fileSize = cmd.size;
+        auto challenge = std::make_shared<BlobChallenge>();
+        bool room = challenges.size() < MAX_CHALLENGES;
+        runDisk([this, hex = cmd.digest, challenge, room] {
+            diskResult = room && challengeBlob(hex, fileSize, *challenge) ? 0 : -1;
+        }, [this, challenge] {
+            if (diskResult < 0) {
+                // 同时告知客户端可以压缩上传和校验上传
+                reply(std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n", ConnState::ReadCommand);
+                return;
+            }
+            reply("PROVE " + std::to_string(challenge->offset) + " " + std::to_string(challenge->length) + " " +
+                  challenge->nonce + "\n", ConnState::ReadCommand);
+            challenges[basename] = std::move(*challenge);
+        });
+        break;
+    }
+    case CommandType::Proof: {
+        // 秒传第二步："PROOF name answer\n"，回答正确时链接为该文件名并回复 "OK <size>\n"，否则回复 "NEED\n"
+        auto it = challenges.find(basename);
+        if (it == challenges.end()) {
+            reply(std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n", ConnState::ReadCommand);
+            break;
+        }
+        auto challenge = std::make_shared<BlobChallenge>(std::move(it->second));
+        challenges.erase(it);
+        fileSize = challenge->size;
+        runDisk([this, challenge, answer = cmd.answer] {
+            diskResult = linkBlob(*challenge, answer, basename) ? 0 : -1;
+            if (diskResult == 0) recordPcdFile(basename, nullptr);
+        }, [this] {
+            if (diskResult < 0) {
+                std::cerr << "秒传证明不正确: " << basename << " 来自 " << peer << std::endl;
+                reply(std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n", ConnState::ReadCommand);
+                return;
+            }
+            std::cout << "秒传完成: " << basename << " (大小: " << fileSize << " 字节) 来自 " << peer << std::endl;
+            afterStore(nullptr);
+            reply("OK " + std::to_string(fileSize) + "\n", ConnState::ReadCommand);
+        });
+        break;
+    }
+    case CommandType::Signature: {
+        // 增量上传第一步："SIGNATURE name\n" -> "OK <size> <blocksize> <count>\n" + 每块的签名（见 delta.h）
+        auto signatures = std::make_shared<std::string>();
+        runDisk([this, signatures] {
+            diskResult = -1;
+            int fd = open(fullpath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return;
+            struct stat st{};
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                fileSize = st.st_size;
+                diskResult = fileSignatures(fd, fileSize, deltaBlockSize(fileSize), *signatures) ? 0 : -1;
+            }
+            close(fd);
+        }, [this, signatures] {
+            if (diskResult < 0) {
+                reply("ERROR 文件不存在\n", ConnState::ReadCommand);
+                return;
+            }
+            reply("OK " + std::to_string(fileSize) + " " + std::to_string(deltaBlockSize(fileSize)) + " " +
+                  std::to_string(signatures->size() / DELTA_SIGNATURE) + "\n" + *signatures, ConnState::ReadCommand);
+        });
+        break;
+    }
+    case CommandType::Delta:
+        // 增量上传第二步："DELTA name size blocksize crc32c\n" + 操作序列
+        std::cout << "客户端 " << peer << " 请求增量上传文件" << std::endl;
+        fileSize = cmd.size;
+        fileCrc = cmd.crc;
+        startDelta(cmd.blockSize);
+        break;
+    case CommandType::Find: {
+        // 点云元数据查询："FIND pattern [条件...]\n" -> "OK <count>\n" + 每个文件一行，只查内存中的目录（见 pcdcatalog.h）
+        std::vector<PcdMeta> found = findPcdFiles(cmd.query);
+        std::string lines;
+        for (const PcdMeta& meta : found) lines += formatPcdMeta(meta);
+        reply("OK " + std::to_string(found.size()) + "\n" + lines, ConnState::ReadCommand);
+        break;
+    }
+    case CommandType::Stat: {
+        // 点云统计："STAT name\n" -> 包围盒、点数和直方图（见 pcdstats.h）
+        auto stats = std::make_shared<PcdStats>();
+        auto error = std::make_shared<std::string>();
+        runDisk([this, stats, error] {
+            loadPcdStats(basename, *stats, *error);
+        }, [this, stats, error] {
+            if (!error->empty()) {
+                reply("ERROR " + *error + "\n", ConnState::ReadCommand);
+                return;
+            }
+            reply(formatPcdStats(*stats), ConnState::ReadCommand);
+        });
+        break;
+    }
+    case CommandType::Merge:
+        // 点云帧序列合并下载："MERGE pattern [first=N] [last=N]\n"，响应与下载相同（见 pcdmerge.h）
+        std::cout << "客户端 " << peer << " 请求合并点云帧" << std::endl;
+        startMerge(cmd.merge);
+        break;
+    case CommandType::Box:
+        // 点云范围查询："BOX name minx miny minz maxx maxy maxz\n"，响应与下载相同（见 pcdindex.h）
+        std::cout << "客户端 " << peer << " 请求点云范围查询" << std::endl;
+        range = ByteRange();
+        startBoxQuery(cmd.box);
+        break;
+    case CommandType::Download:
+        std::cout << "客户端 " << peer << " 请求下载文件" << std::endl;
+        range = cmd.range;
+        // 热点小文件直接从内存缓存发送，不访问文件系统
+        // Mmap 模式下其他下载已经映射过的文件直接共用映射；压缩下载总是读文件后逐块压缩，
+        // 校验下载需要在发送的同时计算校验和，不使用映射
+        if (pcdTransform.active()) {
+            startPcdDownload();
+        } else if (compress) {
+            startDownload();
+        } else if (CachedFilePtr entry = lookupCachedFile(basename)) {
+            sendCached(std::move(entry));
+        } else if (MappedFilePtr mapping = config.downloadMode == DownloadMode::Mmap && !verify ? lookupMappedFile(basename) : nullptr) {
+            sendMapped(std::move(mapping));
+        } else {
+            startDownload();
+        }
+        break;
+    default:
+        state = ConnState::Closed;
+        break;
+    }
+    return Step::Continue;
+}
+
+Connection::Step Connection::readSize() {
+    std::string sizeLine;
+    bool done;
+    if (!readLine(sizeLine, done)) {
+        std::cerr << "客户端关闭了连接" << std::endl;
+        state = ConnState::Closed;
+        return Step::Continue;
+    }
+    if (!done) return Step::Wait;
+
+    SizeLine sizes;
+    std::string error;
+    if (!parseSizeLine(sizeLine, chunked, sizes, error)) {
+        std::cerr << error << std::endl;
+        state = ConnState::Closed;
+        return Step::Continue;
+    }
+    fileSize = sizes.size;
+    uint64_t offset = sizes.offset;
+    if (chunked) {
+        startChunk(offset, sizes.length);
+        return Step::Continue;
+    }
+    std::cout << "准备接收文件: " << basename << " (预期大小: " << fileSize << " 字节";
+    if (offset > 0) std::cout << "，从 " << offset << " 字节处续传";
+    if (compress) std::cout << "，压缩传输";
+    std::cout << ") 来自 " << peer << std::endl;
+    startUpload(offset);
+    return Step::Continue;
+}
+
+/**
+ * @brief 打开暂存文件准备接收
+ *
+ * offset 为 0 时新建（截断）暂存文件；大于 0 时续传，服务端必须已经持有
+ * 至少 offset 字节，否则回复错误并关闭连接（随后的文件数据无法与命令区分）。
+ * 进度记录先写成 offset，中断时再更新为实际收到的字节数。
+ */
+void Connection::startUpload(uint64_t offset) {
+    runDisk([this, offset] {
+        diskResult = 0;
+        if (offset > 0 && stagedBytes(basename, fileSize) < offset) {
+            diskResult = -1;  // 续传位置无效
+            return;
+        }
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0);
+        fileFd = openUploadFile(stagingPath(basename), flags);
+        diskErrno = errno;
+        if (fileFd < 0) return;
+        // 文件大小事先已知，一次预分配剩余部分，避免文件随写入逐步增长产生碎片
+        preallocateUpload(fileFd, offset, fileSize - offset);
+        writeStagingRecord(basename, fileSize, offset);
+    }, [this, offset] {
+        if (diskResult < 0) {
+            std::cerr << "续传位置无效: " << basename << " 偏移 " << offset << std::endl;
+            reply("ERROR 续传位置无效\n", ConnState::Closed);
+            return;
+        }
+        if (fileFd < 0) {
+            std::cerr << "无法创建文件: " << stagingPath(basename) << std::endl;
+            state = ConnState::Closed;
+            return;
+        }
+        transferred = rangeStart = offset;
+        rangeEnd = fileSize;
+        pipeBytes = 0;
+        sniffer.start(basename, offset);
+        statsBuilder.start(basename, offset);
+        codecLen = ioLen = ioOff = 0;
+        blocks.clear();
+        writer.start(fileFd, offset, verify);
+        // 管道在同一连接的多次上传之间复用；压缩上传需要在用户态解压、校验上传需要在用户态计算校验和，不使用 splice
+        zeroCopy = !compress && !verify && config.uploadMode == UploadMode::Splice && openPipe();
+        state = ConnState::RecvBody;
+    });
+}
+
+// 在线程池中准备预分配的暂存文件并打开，分块数据写到 [offset, offset + length)
+void Connection::startChunk(uint64_t offset, uint64_t length) {
+    runDisk([this] {
+        fileFd = prepareChunkTarget(basename, fileSize) ? openUploadFile(stagingPath(basename), O_WRONLY | O_CLOEXEC) : -1;
+    }, [this, offset, length] {
+        if (fileFd < 0) {
+            std::cerr << "无法创建文件: " << stagingPath(basename) << std::endl;
+            state = ConnState::Closed;
+            return;
+        }
+        transferred = rangeStart = offset;
+        rangeEnd = offset + length;
+        pipeBytes = 0;
+        sniffer.start(basename, offset);
+        statsBuilder.start(std::string(), offset);  // 分块上传在文件存入后统计
+        codecLen = ioLen = ioOff = 0;
+        blocks.clear();
+        writer.start(fileFd, offset, verify);
+        zeroCopy = !compress && !verify && config.uploadMode == UploadMode::Splice && openPipe();
+        state = ConnState::RecvBody;
+    });
+}
+
+/**
+ * @brief 接收上传的文件数据
+ *
+ * Splice 模式：socket -> pipe -> file，数据全程不进入用户态。socket -> pipe 在事件循环中非阻塞地进行；
+ * pipe -> file 会等待磁盘（页缓存回写、日志、分配磁盘块），管道攒满、收齐或暂时没有数据可收时
+ * 交给线程池（drainPipe），期间连接暂停接收，未读的数据留在内核接收缓冲区。
+ * 系统不支持 splice（EINVAL/ENOSYS）且尚未接收任何数据时回退到 Stream 模式。
+ * Stream/Direct 模式：recv 到写入引擎的对齐缓冲区，攒满一整块后交给写盘线程在后台 pwrite，
+ * 同时换一块缓冲区继续接收；写队列已满时暂停接收，直到写盘追上。
+ * 输入缓冲区中协议头之后多读到的数据总是先经写入引擎写入。
+ * 压缩上传按帧接收并解压（recvCompressed），解压后的数据同样经写入引擎写入。
+ * 所有数据写入文件之后才结束上传；校验上传还要先核对数据之后的校验和行（readTrailer）。
+ * 增量上传接收的是操作序列，由 recvDelta 处理。
+ */
+Connection::Step Connection::recvBody() {
+    if (patching) return recvDelta();
+    if (transferred == rangeEnd) {
+        if (!writer.idle()) {
+            writer.seal();
+            kickWrite();
+            writeBlocked = true;
+            return Step::Wait;
+        }
+        if (verify) return readTrailer();
+        finishUpload();
+        return Step::Continue;
+    }
+    if (compress) return recvCompressed();
+
+    if (!inBuf.empty()) {
+        // 协议头之后已经读入缓冲区的文件数据，先写入文件；Splice 模式随后直接写文件，不再经过写入引擎
+        if (!writer.acceptsData()) {
+            writeBlocked = true;
+            return Step::Wait;
+        }
+        size_t n = inBuf.take(writer.space(), std::min(writer.room(), rangeEnd - transferred));
+        sniffer.feed(transferred, writer.space(), n);
+        statsBuilder.feed(transferred, writer.space(), n);
+        writer.commit(n);
+        transferred += n;
+        if (zeroCopy || writer.full() || transferred == rangeEnd) {
+            writer.seal();
+            kickWrite();
+        }
+        return Step::Continue;
+    }
+
+    if (zeroCopy) {
+        size_t received = transferred + pipeBytes;
+        if (received == rangeEnd || pipeBytes == pipeCapacity || budget == 0) {
+            if (pipeBytes == 0) return Step::Wait;
+            drainPipe();
+            return Step::Continue;
+        }
+        size_t want = std::min({IO_CHUNK, rangeEnd - received, pipeCapacity - pipeBytes});
+        ssize_t peeked = 0;
+        if (statsBuilder.active() || sniffer.wants(received)) {
+            // 点云文件的数据先窥视一份（不取走数据）交给截取和统计，随后照常 splice 窥视到的这些字节
+            if (ioBuf.size() < IO_CHUNK) ioBuf.resize(IO_CHUNK);
+            peeked = recv(sockFd, ioBuf.data(), want, MSG_PEEK);
+            if (peeked > 0) want = peeked;
+        }
+        ssize_t n = splice(sockFd, nullptr, pipeFds[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR) return Step::Continue;
+        if (n <= 0 && pipeBytes > 0) {
+            // 暂时没有数据或接收结束：先把管道中已收到的数据写入文件，不让它们在等待期间滞留
+            drainPipe();
+            return Step::Continue;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+            if ((errno == EINVAL || errno == ENOSYS) && transferred == rangeStart) {
+                std::cerr << "系统不支持 splice，回退到普通接收" << std::endl;
+                zeroCopy = false;
+                return Step::Continue;
+            }
+            abortUpload(std::string("接收文件数据失败: ") + strerror(errno));
+            return Step::Continue;
+        }
+        if (n == 0) {
+            abortUpload("客户端断开连接，接收文件不完整");
+            return Step::Continue;
+        }
+        if (peeked > 0) {
+            sniffer.feed(received, ioBuf.data(), n);
+            statsBuilder.feed(received, ioBuf.data(), n);
+        }
+        pipeBytes += n;
+        budget -= std::min<size_t>(budget, n);
+        return Step::Continue;
+    }
+
+    if (budget == 0) return Step::Wait;
+    if (!writer.acceptsData()) {
+        // 背压：写盘跟不上网络时暂停从 socket 读取，数据留在内核接收缓冲区，由 TCP 流控减慢对端
+        writeBlocked = true;
+        return Step::Wait;
+    }
+    ssize_t n = recv(sockFd, writer.space(), std::min(writer.room(), rangeEnd - transferred), 0);
+    if (n < 0) {
+        if (errno == EINTR) return Step::Continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+        abortUpload(std::string("接收文件数据失败: ") + strerror(errno));
+        return Step::Continue;
+    }
+    if (n == 0) {
+        abortUpload("客户端断开连接，接收文件不完整");
+        return Step::Continue;
+    }
+    sniffer.feed(transferred, writer.space(), n);
+    statsBuilder.feed(transferred, writer.space(), n);
+    writer.commit(n);
+    size_t before = transferred;
+    transferred += n;
+    budget -= std::min<size_t>(budget, n);
+    reportProgress("已接收", before);
+    if (writer.full() || transferred == rangeEnd) {
+        writer.seal();
+        kickWrite();
+    }
+    return Step::Continue;
+}
+
+// 创建（或复用）splice 上传的内核管道，容量尽量加大到 SPLICE_PIPE_SIZE，减少交给线程池写盘的次数
+bool Connection::openPipe() {
+    if (pipeFds[0] >= 0) return true;
+    if (pipe2(pipeFds, O_CLOEXEC) < 0) return false;
+    fcntl(pipeFds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);  // 超过系统上限时保持原来的容量
+    int size = fcntl(pipeFds[1], F_GETPIPE_SZ);
+    pipeCapacity = size > 0 ? size : IO_CHUNK;
+    return true;
+}
+
+// 在线程池中把管道中的数据全部写入文件，写入失败时中断上传（已写入的部分保留以便续传）
+void Connection::drainPipe() {
+    runDisk([this] {
+        loff_t offset = transferred;
+        size_t left = pipeBytes;
+        diskErrno = 0;
+        while (left > 0) {
+            ssize_t w = splice(pipeFds[0], nullptr, fileFd, &offset, left, SPLICE_F_MOVE);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                diskErrno = w == 0 ? EIO : errno;
+                break;
+            }
+            left -= w;
+        }
+        diskResult = pipeBytes - left;
+    }, [this] {
+        size_t before = transferred;
+        transferred += diskResult;
+        pipeBytes -= diskResult;
+        reportProgress("已接收", before);
+        if (diskErrno != 0) abortUpload(std::string("写入文件失败: ") + strerror(diskErrno));
+    });
+}
+
+/**
+ * @brief 接收压缩上传的数据
+ *
+ * 先收齐一批帧（最多 COMPRESS_FRAMES 帧，或者到上传范围的末尾）到 codecBuf，
+ * 交给线程池并行解压到 ioBuf（decodeBatch），再分几次交给写入引擎。
+ * 帧头不合法、解压失败或数据超出上传范围时中断上传，已写入的部分照常保留以便续传。
+ */
+Connection::Step Connection::recvCompressed() {
+    if (ioOff < ioLen) {
+        if (!writer.acceptsData()) {
+            writeBlocked = true;
+            return Step::Wait;
+        }
+        size_t n = std::min(writer.room(), ioLen - ioOff);
+        memcpy(writer.space(), ioBuf.data() + ioOff, n);
+        sniffer.feed(transferred, writer.space(), n);
+        statsBuilder.feed(transferred, writer.space(), n);
+        writer.commit(n);
+        ioOff += n;
+        size_t before = transferred;
+        transferred += n;
+        reportProgress("已接收", before);
+        if (writer.full() || transferred == rangeEnd) {
+            writer.seal();
+            kickWrite();
+        }
+        return Step::Continue;
+    }
+
+    if (codecBuf.size() < COMPRESS_FRAMES * (FRAME_HEADER + COMPRESS_BLOCK)) {
+        codecBuf.resize(COMPRESS_FRAMES * (FRAME_HEADER + COMPRESS_BLOCK));
+    }
+    size_t need;  // 要把 codecBuf 收到多长
+    size_t frameStart = blocks.empty() ? 0 : blocks.back().codedOff + blocks.back().codedLen;
+    if (codecLen >= frameStart) {
+        // 之前的帧都已收齐
+        size_t batchRaw = blocks.empty() ? 0 : blocks.back().rawOff + blocks.back().rawLen;
+        if (blocks.size() == COMPRESS_FRAMES || transferred + batchRaw == rangeEnd) {
+            decodeBatch();
+            return Step::Continue;
+        }
+        if (codecLen >= frameStart + FRAME_HEADER) {
+            size_t rawLen = 0, storedLen = 0;
+            if (!parseFrameHeader(codecBuf.data() + frameStart, rawLen, storedLen)) {
+                if (decodeBatch()) return Step::Continue;  // 先写入之前收齐的帧
+                abortUpload("压缩数据格式错误: " + peer);
+                return Step::Continue;
+            }
+            if (rawLen > rangeEnd - transferred - batchRaw) {
+                if (decodeBatch()) return Step::Continue;
+                abortUpload("压缩数据超出上传范围: " + peer);
+                return Step::Continue;
+            }
+            blocks.push_back(CodecBlock{batchRaw, rawLen, frameStart + FRAME_HEADER, storedLen, false, 0});
+            return Step::Continue;
+        }
+        need = frameStart + FRAME_HEADER;
+    } else {
+        need = frameStart;
+    }
+
+    if (!inBuf.empty()) {
+        codecLen += inBuf.take(codecBuf.data() + codecLen, need - codecLen);
+        return Step::Continue;
+    }
+    if (budget == 0) return Step::Wait;
+    ssize_t n = recv(sockFd, codecBuf.data() + codecLen, need - codecLen, 0);
+    if (n < 0) {
+        if (errno == EINTR) return Step::Continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+        if (decodeBatch()) return Step::Continue;  // 先写入已收齐的帧，之后再 recv 会再次报告错误
+        abortUpload(std::string("接收文件数据失败: ") + strerror(errno));
+        return Step::Continue;
+    }
+    if (n == 0) {
+        if (decodeBatch()) return Step::Continue;
+        abortUpload("客户端断开连接，接收文件不完整");
+        return Step::Continue;
+    }
+    codecLen += n;
+    budget -= std::min<size_t>(budget, n);
+    return Step::Continue;
+}
+
+/**
+ * @brief 解压这一批中已收齐的帧
+ *
+ * 帧之间没有依赖，在线程池中各自解压到 ioBuf 中属于自己的位置。
+ * 上传将要中断时也先解压已收齐的帧，写入的进度越多，续传时要重传的越少；
+ * 还没收齐的最后一帧留在 codecBuf 的开头，作为下一批的第一帧继续接收。
+ *
+ * @return 没有收齐的帧时返回 false
+ */
+bool Connection::decodeBatch() {
+    if (!blocks.empty() && codecLen < blocks.back().codedOff + blocks.back().codedLen) blocks.pop_back();
+    if (blocks.empty()) return false;
+    if (ioBuf.size() < COMPRESS_BATCH) ioBuf.resize(COMPRESS_BATCH);
+    std::vector<std::function<void()>> work;
+    for (CodecBlock& b : blocks) {
+        work.push_back([this, &b] {
+            b.ok = decodeFrame(codecBuf.data() + b.codedOff, b.codedLen, ioBuf.data() + b.rawOff, b.rawLen);
+        });
+    }
+    runParallel(std::move(work), nullptr, [this] {
+        for (const CodecBlock& b : blocks) {
+            if (!b.ok) {
+                abortUpload("解压文件数据失败: " + peer);
+                return;
+            }
+        }
+        size_t used = blocks.back().codedOff + blocks.back().codedLen;
+        memmove(codecBuf.data(), codecBuf.data() + used, codecLen - used);
+        codecLen -= used;
+        ioLen = blocks.back().rawOff + blocks.back().rawLen;
+        ioOff = 0;
+        blocks.clear();
+    });
+    return true;
+}
+
+/**
+ * @brief 校验上传：读取数据之后的 "<范围校验和> <整个文件的校验和>\n"
+ *
+ * 范围校验和与写入引擎边收边算的结果一致才结束上传，整个文件的校验和在存入时核对；
+ * 不一致时丢弃这次收到的数据（rejectUpload），客户端只需重传这个范围。
+ */
+Connection::Step Connection::readTrailer() {
+    std::string line;
+    bool done;
+    if (!readLine(line, done)) {
+        // 数据已经写入暂存区，下次续传完成时由整个文件的校验和发现其中的错误
+        abortUpload("客户端断开连接，未收到校验和");
+        return Step::Continue;
+    }
+    if (!done) return Step::Wait;
+    std::istringstream iss(line);
+    std::string rangeHex, fileHex;
+    uint32_t expected = 0;
+    iss >> rangeHex >> fileHex;
+    if (!parseCrc32c(rangeHex, expected) || !parseCrc32c(fileHex, fileCrc) || expected != writer.checksum()) {
+        rejectUpload();
+        return Step::Continue;
+    }
+    finishUpload();
+    return Step::Continue;
+}
+
+// 范围校验和不一致：关闭暂存文件，顺序上传把进度退回这次传输的起点，分块上传不记录这个分块
+void Connection::rejectUpload() {
+    std::cerr << "校验和不匹配: " << basename << " [" << rangeStart << ", " << rangeEnd << ") 来自 " << peer << std::endl;
+    runDisk([this] {
+        close(fileFd);
+        fileFd = -1;
+        writer.release();
+        if (!chunked) writeStagingRecord(basename, fileSize, rangeStart);
+    }, [this] {
+        reply("ERROR 校验和不匹配\n", ConnState::ReadCommand);
+    });
+}
+
+/**
+ * @brief 在线程池中打开旧版本并创建重建新版本的临时文件
+ *
+ * 旧版本已不存在或块大小与客户端拿到的签名不一致（文件在两条命令之间变了）时
+ * 回复错误并关闭连接，客户端改用完整上传。
+ */
+void Connection::startDelta(uint64_t blockSize) {
+    runDisk([this, blockSize] {
+        diskResult = delta.open(fullpath, deltaPath(basename), fileSize, blockSize) ? 0 : -1;
+        diskErrno = errno;
+    }, [this] {
+        if (diskResult < 0) {
+            std::cerr << "无法增量上传: " << basename << " " << strerror(diskErrno) << std::endl;
+            reply(diskErrno == ESTALE ? "ERROR 基准文件已变化\n" : "ERROR 无法增量上传\n", ConnState::Closed);
+            return;
+        }
+        patching = true;
+        state = ConnState::RecvBody;
+    });
+}
+
+/**
+ * @brief 接收增量上传的操作序列
+ *
+ * 数据直接收进 DeltaApplier 的缓冲区，每次最多收到当前操作的末尾，不会读走下一条命令；
+ * 攒满一批或全部收到后交给线程池写入临时文件，期间暂停接收。
+ */
+Connection::Step Connection::recvDelta() {
+    if (delta.full() || (delta.complete() && delta.pending())) {
+        runDisk([this] {
+            diskResult = delta.apply() ? 0 : -1;
+            diskErrno = errno;
+        }, [this] {
+            if (diskResult < 0) abortDelta(std::string("写入增量数据失败: ") + strerror(diskErrno));
+        });
+        return Step::Continue;
+    }
+    if (delta.complete()) {
+        finishDelta();
+        return Step::Continue;
+    }
+    size_t n;
+    if (!inBuf.empty()) {
+        n = inBuf.take(delta.space(), delta.want());
+    } else {
+        if (budget == 0) return Step::Wait;
+        ssize_t got = recv(sockFd, delta.space(), delta.want(), 0);
+        if (got < 0) {
+            if (errno == EINTR) return Step::Continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+            abortDelta(std::string("接收增量数据失败: ") + strerror(errno));
+            return Step::Continue;
+        }
+        if (got == 0) {
+            abortDelta("客户端断开连接，增量数据不完整");
+            return Step::Continue;
+        }
+        n = got;
+        budget -= std::min<size_t>(budget, n);
+    }
+    if (!delta.commit(n)) abortDelta("增量数据格式错误: " + peer);
+    return Step::Continue;
+}
+
+// 新版本重建完成：核对整个文件的校验和后存入内容目录，原子地替换旧版本
+void Connection::finishDelta() {
+    runDisk([this] {
+        diskResult = delta.finish() && storeBlob(deltaPath(basename), basename, &fileCrc) ? 0 : -1;
+        diskErrno = errno;
+        if (diskResult < 0) delta.discard();
+        if (diskResult == 0) recordPcdFile(basename, nullptr);
+    }, [this] {
+        patching = false;
+        if (diskResult < 0 && diskErrno == EBADMSG) {
+            std::cerr << "增量重建的文件校验和不匹配，已丢弃: " << basename << std::endl;
+            reply("ERROR 文件校验和不匹配\n", ConnState::ReadCommand);
+            return;
+        }
+        if (diskResult < 0) {
+            std::cerr << "保存文件失败: " << basename << " " << strerror(diskErrno) << std::endl;
+            reply("ERROR 保存文件失败\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "增量上传完成: " << basename << " (大小: " << fileSize << " 字节，复用旧版本 " << delta.reused()
+                  << " 字节) 来自 " << peer << std::endl;
+        afterStore(nullptr);
+        reply("OK " + std::to_string(fileSize) + "\n", ConnState::ReadCommand);
+    });
+}
+
+// 增量上传中断：删除临时文件，旧版本保持不变；剩余的操作序列无法与命令区分，结束连接
+void Connection::abortDelta(const std::string& reason) {
+    std::cerr << reason << std::endl;
+    patching = false;
+    runDisk([this] {
+        delta.discard();
+    }, [this] {
+        state = ConnState::Closed;
+    });
+}
+
+// 没有数据块在写盘时，把写队列的下一块交给写盘线程
+void Connection::kickWrite() {
+    if (writePending || !writer.startWrite()) return;
+    writePending = true;
+    host.submitWrite(*this, [this] { writer.writeBlock(); });
+}
+
+// 打开上传的目标文件；Direct 模式加上 O_DIRECT，文件系统不支持（EINVAL）时退回普通写入
+int Connection::openUploadFile(const std::string& path, int flags) {
+    if (config.uploadMode == UploadMode::Direct) {
+        int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0 || errno != EINVAL) return fd;
+    }
+    return open(path.c_str(), flags, 0644);
+}
+
+// 上传完成：在线程池中关闭暂存文件并移入 filedir/，然后回复 "OK <size>\n"，继续读取下一条命令
+void Connection::finishUpload() {
+    if (chunked) {
+        finishChunk();
+        return;
+    }
+    auto stats = std::make_shared<PcdStats>();
+    auto streamed = std::make_shared<bool>(false);  // 统计已在接收时算出
+    runDisk([this, stats, streamed] {
+        close(fileFd);
+        fileFd = -1;
+        writer.release();
+        diskResult = promoteStaged(basename, verify ? &fileCrc : nullptr) ? 0 : -1;
+        diskErrno = errno;
+        if (diskResult == 0) recordPcdFile(basename, sniffer.prefix(fileSize));
+        *streamed = diskResult == 0 && statsBuilder.finish(fileSize, *stats);
+        if (*streamed) savePcdStats(basename, *stats);
+    }, [this, stats, streamed] {
+        if (diskResult < 0 && diskErrno == EBADMSG) {
+            std::cerr << "文件校验和不匹配，已丢弃: " << basename << std::endl;
+            reply("ERROR 文件校验和不匹配\n", ConnState::ReadCommand);
+            return;
+        }
+        if (diskResult < 0) {
+            std::cerr << "保存文件失败: " << basename << " " << strerror(diskErrno) << std::endl;
+            reply("ERROR 保存文件失败\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "上传完成: " << basename << " (大小: " << transferred << " 字节) 来自 " << peer << std::endl;
+        afterStore(*streamed ? stats : nullptr);
+        reply("OK " + std::to_string(transferred) + "\n", ConnState::ReadCommand);
+    });
+}
+
+// 点云文件已存入并记入点云目录：回复之后在线程池中按配置转存为 binary_compressed、补算上传时
+// 没有一遍算出的统计（见 finishStoredPcd），不占用连接；streamed 为上传时已经保存的统计
+void Connection::afterStore(std::shared_ptr<const PcdStats> streamed) {
+    if (!isPcdName(basename) || (streamed && !config.pcdCompress)) return;
+    std::string name = basename;
+    bool transcode = config.pcdCompress;
+    host.submitBackground([name, transcode, streamed] { finishStoredPcd(name, transcode, streamed.get()); });
+}
+
+/**
+ * @brief 分块写完：记录区间，回复 "OK <length>\n"
+ *
+ * 如果这是文件的最后一个分块，completeChunk 会在回复之前把文件移入 filedir/，
+ * 因此客户端收齐所有分块的确认时文件一定已经完整可见。
+ */
+void Connection::finishChunk() {
+    runDisk([this] {
+        close(fileFd);
+        fileFd = -1;
+        writer.release();
+        diskResult = (ssize_t)completeChunk(basename, fileSize, rangeStart, rangeEnd - rangeStart, verify ? &fileCrc : nullptr);
+        if ((ChunkStatus)diskResult == ChunkStatus::Complete) recordPcdFile(basename, nullptr);
+    }, [this] {
+        ChunkStatus status = (ChunkStatus)diskResult;
+        if (status == ChunkStatus::Corrupt) {
+            std::cerr << "文件校验和不匹配，已丢弃: " << basename << std::endl;
+            reply("ERROR 文件校验和不匹配\n", ConnState::ReadCommand);
+            return;
+        }
+        if (status == ChunkStatus::Failed) {
+            std::cerr << "保存分块失败: " << basename << " [" << rangeStart << ", " << rangeEnd << ")" << std::endl;
+            reply("ERROR 保存文件失败\n", ConnState::ReadCommand);
+            return;
+        }
+        if (status == ChunkStatus::Complete) {
+            std::cout << "分块上传完成: " << basename << " (大小: " << fileSize << " 字节)" << std::endl;
+            afterStore(nullptr);
+        }
+        reply("OK " + std::to_string(rangeEnd - rangeStart) + "\n", ConnState::ReadCommand);
+    });
+}
+
+// 上传中断：等正在写盘的数据块完成后，在线程池中写出其余已收到的数据、关闭暂存文件并记录
+// 已写入的字节数以便续传，然后结束连接（剩余的文件数据无法再与命令区分）
+void Connection::abortUpload(const std::string& reason) {
+    std::cerr << reason << std::endl;
+    if (writePending) {
+        abortPending = true;
+        writeBlocked = true;
+        return;
+    }
+    saveAbortedUpload();
+}
+
+void Connection::saveAbortedUpload() {
+    runDisk([this] {
+        if (!writer.flushAll()) transferred = std::min<size_t>(transferred, writer.flushed());
+        writer.release();
+        close(fileFd);
+        fileFd = -1;
+        // 分块上传的进度由已完成的分块区间记录，不完整的分块由客户端重传
+        if (!chunked) writeStagingRecord(basename, fileSize, transferred);
+    }, [this] {
+        if (chunked) {
+            state = ConnState::Closed;
+            return;
+        }
+        std::cout << "已保留未完成的上传: " << basename << " (" << transferred << "/" << fileSize << " 字节)，可续传" << std::endl;
+        state = ConnState::Closed;
+    });
+}
+
+// 在线程池中打开并 fstat 要下载的文件，成功后发送 "OK <size>\n"
+void Connection::startDownload() {
+    runDisk([this] {
+        // 打开文件准备读取（直接使用文件描述符，便于 sendfile 零拷贝）
+        uint64_t generation = fileCacheGeneration(basename);
+        uint64_t mapGeneration = mappedFileGeneration(basename);
+        fileFd = open(fullpath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fileFd >= 0 && (fstat(fileFd, &st) < 0 || !S_ISREG(st.st_mode))) {
+            close(fileFd);
+            fileFd = -1;
+        }
+        fileSize = fileFd >= 0 ? st.st_size : 0;
+        if (fileFd >= 0 && verify) fileCrcKnown = storedChecksum(fileFd, fileCrc);
+        if (fileFd >= 0 && compress) {
+            // 已经是压缩格式的文件（PNG 等）再压缩只浪费 CPU，按原样发送
+            char magic[16];
+            ssize_t n = pread(fileFd, magic, sizeof(magic), 0);
+            compress = n <= 0 || !looksCompressed(magic, n);
+            return;
+        }
+        // 小文件整个读入缓存，本次和之后的下载都从内存发送
+        // 其余文件在 Mmap 模式下映射后由之后的下载共用；只查询大小时不读入，以免挤掉真正的热点文件
+        if (fileFd >= 0 && !range.probe() && ((cached = loadCachedFile(fileFd, fileSize, generation)) ||
+                            (config.downloadMode == DownloadMode::Mmap && !verify &&
+                             (mapped = mapFile(fileFd, fileSize, mapGeneration))))) {
+            close(fileFd);
+            fileFd = -1;
+        }
+    }, [this] {
+        // 读入的内容和映射加入本事件循环的缓存和注册表
+        if (cached) {
+            keepCachedFile(basename, cached);
+            sendCached(std::move(cached));
+            return;
+        }
+        if (mapped) {
+            keepMappedFile(basename, mapped);
+            sendMapped(std::move(mapped));
+            return;
+        }
+        if (fileFd < 0) {
+            // 如果文件打开失败，发送错误信息，连接继续处理下一条命令
+            reply("ERROR 文件不存在\n", ConnState::ReadCommand);
+            return;
+        }
+        if (!range.resolve(fileSize)) {
+            close(fileFd);
+            fileFd = -1;
+            reply("ERROR 范围无效\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "准备发送文件: " << basename << " (总大小: " << fileSize << " 字节";
+        if (range.ranged) std::cout << "，范围: " << range.offset << "+" << range.length;
+        if (compress) std::cout << "，压缩传输";
+        std::cout << ") 发送至 " << peer << std::endl;
+        // 只发送请求的范围：从 offset 开始 sendfile/pread
+        transferred = rangeStart = range.offset;
+        rangeEnd = range.offset + range.length;
+        // sendfile 的数据不经过用户态，校验下载改为读出后计算校验和再发送
+        zeroCopy = !compress && !verify && config.downloadMode == DownloadMode::Sendfile;
+        ioLen = ioOff = 0;
+        rangeCrc = 0;
+        reply(responseHeader(), ConnState::SendFile);
+    });
+}
+
+// 在线程池中读入整个点云文件并按选项处理，处理结果作为一次性的内存文件发送（支持范围和校验下载）
+void Connection::startPcdDownload() {
+    auto result = std::make_shared<CachedFile>();
+    auto error = std::make_shared<std::string>();
+    auto points = std::make_shared<std::pair<size_t, size_t>>();
+    runDisk([this, result, error, points] {
+        int fd = open(fullpath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) close(fd);
+            *error = "文件不存在";
+            return;
+        }
+        if (static_cast<uint64_t>(st.st_size) > PCD_MAX_SIZE) {
+            close(fd);
+            *error = "点云文件过大";
+            return;
+        }
+        std::string content(st.st_size, '\0');
+        size_t got = 0;
+        while (got < content.size()) {
+            ssize_t n = pread(fd, &content[got], content.size() - got, got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+        close(fd);
+        if (got < content.size()) {
+            *error = "读取文件失败";
+            return;
+        }
+        if (transformPcd(content.data(), content.size(), pcdTransform, result->data, points->first, points->second, *error)) {
+            result->header = "OK " + std::to_string(result->data.size()) + "\n";
+        }
+    }, [this, result, error, points] {
+        if (!error->empty()) {
+            reply("ERROR " + *error + "\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "点云处理: " << basename << " (" << points->first << " 点 -> " << points->second
+                  << " 点，" << result->data.size() << " 字节) 发送至 " << peer << std::endl;
+        sendPcdResult(result);
+    });
+}
+
+// 在线程池中用空间索引找出长方体内的点（第一次查询时建立索引），结果与点云处理一样从内存发送
+void Connection::startBoxQuery(const PcdBox& box) {
+    auto result = std::make_shared<CachedFile>();
+    auto error = std::make_shared<std::string>();
+    auto points = std::make_shared<std::pair<size_t, size_t>>();
+    auto built = std::make_shared<bool>(false);
+    runDisk([this, box, result, error, points, built] {
+        if (queryPcdBox(basename, box, pcdTransform, result->data, points->first, points->second, *built, *error)) {
+            result->header = "OK " + std::to_string(result->data.size()) + "\n";
+        }
+    }, [this, result, error, points, built] {
+        if (!error->empty()) {
+            reply("ERROR " + *error + "\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "点云范围查询: " << basename << " (" << points->first << " 点中输出 " << points->second
+                  << " 点，" << result->data.size() << " 字节" << (*built ? "，已建立索引" : "") << ") 发送至 "
+                  << peer << std::endl;
+        sendPcdResult(result);
+    });
+}
+
+// 在线程池中选出帧并读出各帧的头部，然后发送响应头和合并后的 PCD 头部，各帧的点数据由 nextMergeFrame 接着发送
+void Connection::startMerge(const PcdMergeRequest& request) {
+    auto plan = std::make_shared<PcdMergePlan>();
+    auto error = std::make_shared<std::string>();
+    runDisk([request, plan, error] {
+        planPcdMerge(request, *plan, *error);
+    }, [this, plan, error] {
+        if (!error->empty()) {
+            reply("ERROR " + *error + "\n", ConnState::ReadCommand);
+            return;
+        }
+        std::cout << "准备合并点云: " << plan->frames.size() << " 帧 (" << plan->header.points << " 点，总大小: "
+                  << plan->size << " 字节) 发送至 " << peer << std::endl;
+        merge = plan;
+        mergeNext = 0;
+        mergeAdvised = 1;
+        compress = verify = false;
+        transferred = rangeStart = rangeEnd = 0;
+        ioLen = ioOff = 0;
+        reply("OK " + std::to_string(plan->size) + "\n" + plan->head, ConnState::SendFile);
+    });
+}
+
+/**
+ * @brief 合并下载的上一帧发送完，在线程池中准备下一帧
+ *
+ * 布局与合并结果相同的帧打开后像普通下载一样发送点数据的范围（sendfile 零拷贝）；
+ * 其余的帧读入并转换后从内存发送。同时通知内核预读之后的 PCD_MERGE_READAHEAD 帧，
+ * 发送这一帧时后面几帧的磁盘读取已经在进行。帧已经被替换时响应无法再补救，关闭连接。
+ */
+void Connection::nextMergeFrame() {
+    if (fileFd >= 0) close(fileFd);
+    fileFd = -1;
+    cached.reset();
+    if (mergeNext == merge->frames.size()) {
+        std::cout << "合并下载完成: " << merge->frames.size() << " 帧 (总大小: " << merge->size << " 字节) 发送至 "
+                  << peer << std::endl;
+        merge.reset();
+        state = ConnState::ReadCommand;
+        return;
+    }
+    auto records = std::make_shared<CachedFile>();
+    auto error = std::make_shared<std::string>();
+    runDisk([this, records, error] {
+        while (mergeAdvised < merge->frames.size() && mergeAdvised <= mergeNext + PCD_MERGE_READAHEAD) {
+            adviseMergeFrame(*merge, merge->frames[mergeAdvised++]);
+        }
+        const PcdMergeFrame& frame = merge->frames[mergeNext];
+        fileFd = openMergeFrame(frame);
+        if (fileFd < 0) {
+            *error = "帧已被替换";
+            return;
+        }
+        if (!frame.direct) {
+            loadMergeFrame(*merge, frame, fileFd, records->data, *error);
+            close(fileFd);
+            fileFd = -1;
+        }
+    }, [this, records, error] {
+        const PcdMergeFrame& frame = merge->frames[mergeNext++];
+        if (!error->empty()) {
+            std::cerr << "合并点云失败: " << frame.name << ": " << *error << std::endl;
+            if (fileFd >= 0) close(fileFd);
+            fileFd = -1;
+            state = ConnState::Closed;
+            return;
+        }
+        ioLen = ioOff = 0;
+        if (frame.direct) {
+            fileSize = frame.size;
+            transferred = rangeStart = frame.dataOffset;
+            rangeEnd = frame.dataOffset + merge->bytes(frame);
+            zeroCopy = config.downloadMode == DownloadMode::Sendfile;
+        } else {
+            fileSize = records->data.size();
+            transferred = rangeStart = 0;
+            rangeEnd = records->data.size();
+            cached = records;
+        }
+    });
+}
+
+// 处理结果只在内存中，不压缩，按原样发送
+void Connection::sendPcdResult(CachedFilePtr result) {
+    compress = false;
+    sendCached(std::move(result));
+}
+
+// 读出下一批数据并压缩成帧：每块的读盘和压缩是线程池中的一个任务，同一批的各块在不同的线程上并行进行
+void Connection::compressNext() {
+    if (codecBuf.size() < COMPRESS_BATCH) codecBuf.resize(COMPRESS_BATCH);
+    if (ioBuf.size() < COMPRESS_FRAMES * frameBound(COMPRESS_BLOCK)) ioBuf.resize(COMPRESS_FRAMES * frameBound(COMPRESS_BLOCK));
+    size_t len = std::min(COMPRESS_BATCH, rangeEnd - transferred);
+    blocks.clear();
+    for (size_t off = 0; off < len; off += COMPRESS_BLOCK) {
+        blocks.push_back(CodecBlock{off, std::min(COMPRESS_BLOCK, len - off), blocks.size() * frameBound(COMPRESS_BLOCK), 0, false, 0});
+    }
+    std::vector<std::function<void()>> work;
+    for (CodecBlock& b : blocks) {
+        work.push_back([this, &b] {
+            ssize_t n = pread(fileFd, codecBuf.data() + b.rawOff, b.rawLen, transferred + b.rawOff);
+            b.ok = n == (ssize_t)b.rawLen;
+            b.err = n < 0 ? errno : EIO;  // 读到的比请求的少说明文件被截断
+            if (b.ok) b.codedLen = encodeFrames(codecBuf.data() + b.rawOff, b.rawLen, ioBuf.data() + b.codedOff);
+        });
+    }
+    runParallel(std::move(work), [this, len] {
+        // 校验和按顺序计算，各帧长度不同，按顺序挪到一起以便连续发送
+        diskResult = len;
+        ioLen = 0;
+        for (const CodecBlock& b : blocks) {
+            if (!b.ok) {
+                diskResult = -1;
+                diskErrno = b.err;
+                return;
+            }
+            if (verify) rangeCrc = crc32c(rangeCrc, codecBuf.data() + b.rawOff, b.rawLen);
+            memmove(ioBuf.data() + ioLen, ioBuf.data() + b.codedOff, b.codedLen);
+            ioLen += b.codedLen;
+        }
+    }, [this] {
+        blocks.clear();
+        if (diskResult <= 0) {
+            std::cerr << "读取文件失败: " << strerror(diskResult < 0 ? diskErrno : EIO) << std::endl;
+            state = ConnState::Closed;
+            return;
+        }
+        ioOff = 0;
+        size_t before = transferred;
+        transferred += diskResult;
+        reportProgress("已发送", before);
+    });
+}
+
+// 从内存中的文件内容发送下载响应，完整文件使用缓存条目中预先生成的响应头
+void Connection::sendCached(CachedFilePtr entry) {
+    fileSize = entry->data.size();
+    if (!range.resolve(fileSize)) {
+        reply("ERROR 范围无效\n", ConnState::ReadCommand);
+        return;
+    }
+    transferred = rangeStart = range.offset;
+    rangeEnd = range.offset + range.length;
+    ioLen = ioOff = 0;
+    if (verify) {
+        // 小文件直接在内存中算出范围和整个文件的校验和
+        rangeCrc = crc32c(0, entry->data.data() + rangeStart, rangeEnd - rangeStart);
+        fileCrc = rangeEnd - rangeStart == fileSize ? rangeCrc : crc32c(0, entry->data.data(), fileSize);
+        fileCrcKnown = true;
+    }
+    reply(range.ranged || verify ? responseHeader() : entry->header, ConnState::SendFile);
+    cached = std::move(entry);
+}
+
+// 从共用的文件映射发送下载响应
+void Connection::sendMapped(MappedFilePtr mapping) {
+    fileSize = mapping->size;
+    if (!range.resolve(fileSize)) {
+        reply("ERROR 范围无效\n", ConnState::ReadCommand);
+        return;
+    }
+    std::cout << "准备发送文件: " << basename << " (总大小: " << fileSize << " 字节";
+    if (range.ranged) std::cout << "，范围: " << range.offset << "+" << range.length;
+    std::cout << ") 发送至 " << peer << std::endl;
+    transferred = rangeStart = prefetchEnd = range.offset;
+    rangeEnd = range.offset + range.length;
+    ioLen = ioOff = 0;
+    reply(range.header(fileSize), ConnState::SendFile);
+    mapped = std::move(mapping);
+}
+
+// 下载响应头；压缩下载末尾带上 lzf（之后的数据为帧序列），校验下载带上 crc32c（数据之后有校验和行）
+std::string Connection::responseHeader() const {
+    std::string header = range.header(fileSize);
+    header.pop_back();
+    if (compress) header += std::string(" ") + COMPRESS_OPTION;
+    if (verify) header += std::string(" ") + CHECKSUM_OPTION;
+    return header + "\n";
+}
+
+// 发送一行响应，发送完成后进入 next 状态
+void Connection::reply(const std::string& msg, ConnState next) {
+    outBuf = msg;
+    outOff = 0;
+    afterReply = next;
+    state = ConnState::SendHeader;
+}
+
+Connection::Step Connection::sendHeader() {
+    while (outOff < outBuf.size()) {
+        ssize_t n = send(sockFd, outBuf.data() + outOff, outBuf.size() - outOff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+            afterReply = ConnState::Closed;
+            break;
+        }
+        outOff += n;
+    }
+    if (afterReply == ConnState::Closed && fileFd >= 0) {
+        close(fileFd);
+        fileFd = -1;
+    }
+    state = afterReply;
+    return Step::Continue;
+}
+
+/**
+ * @brief 发送下载的文件数据
+ *
+ * Sendfile 模式：从页缓存直接发送到 socket，处理部分发送。sendfile 在页缓存未命中时要等待读盘，
+ * 在线程池中执行，每次最多发送一个事件的预算；没有发完（socket 发送缓冲区已满）时等 socket 再次可写。
+ * 文件系统不支持 sendfile 且尚未发送任何数据时回退到 Stream 模式。
+ * Stream 模式：缓冲区为空时交给线程池 pread，读到的数据在 socket 可写时发送。
+ * 压缩下载：线程池 pread 后逐块压缩成帧放入缓冲区，transferred 按原始文件偏移计算。
+ * 校验下载：线程池读出数据后顺便计算校验和，全部发送完后再发送校验和行（finishDownload）。
+ */
+Connection::Step Connection::sendFile() {
+    if (transferred == rangeEnd && ioOff == ioLen) {
+        if (merge) {
+            nextMergeFrame();
+        } else {
+            finishDownload();
+        }
+        return Step::Continue;
+    }
+    if (budget == 0) return Step::Wait;
+
+    if (cached || mapped) {
+        // 从内存发送；映射的文件提前一个窗口通知内核预读
+        if (mapped && prefetchEnd < rangeEnd && transferred + MAP_PREFETCH / 2 >= prefetchEnd) {
+            size_t len = std::min(MAP_PREFETCH, rangeEnd - prefetchEnd);
+            mapped->prefetch(prefetchEnd, len);
+            prefetchEnd += len;
+        }
+        const char* data = cached ? cached->data.data() : mapped->data;
+        ssize_t n = send(sockFd, data + transferred, std::min(budget, rangeEnd - transferred), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) return Step::Continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+            std::cerr << "发送文件数据失败: " << strerror(errno) << std::endl;
+            state = ConnState::Closed;
+            return Step::Continue;
+        }
+        size_t before = transferred;
+        transferred += n;
+        budget -= std::min<size_t>(budget, n);
+        if (mapped) reportProgress("已发送", before);
+        return Step::Continue;
+    }
+
+    if (zeroCopy) {
+        if (socketFull) {
+            // 上一次 sendfile 没有发完，等 socket 再次可写
+            socketFull = false;
+            return Step::Wait;
+        }
+        // sendfile 读不在页缓存中的数据时会等待磁盘，交给线程池；socket 是非阻塞的，线程池中只会等磁盘
+        size_t want = std::min(budget, rangeEnd - transferred);
+        runDisk([this, want] {
+            off_t offset = transferred;
+            diskResult = sendfile(sockFd, fileFd, &offset, want);
+            diskErrno = errno;
+        }, [this, want] {
+            if (diskResult < 0) {
+                if (diskErrno == EINTR) return;
+                if (diskErrno == EAGAIN || diskErrno == EWOULDBLOCK) {
+                    socketFull = true;
+                    return;
+                }
+                if ((diskErrno == EINVAL || diskErrno == ENOSYS) && transferred == rangeStart) {
+                    std::cerr << "文件系统不支持 sendfile，回退到普通发送" << std::endl;
+                    zeroCopy = false;
+                    return;
+                }
+                std::cerr << "发送文件数据失败: " << strerror(diskErrno) << std::endl;
+                state = ConnState::Closed;
+                return;
+            }
+            if (diskResult == 0) {
+                // 文件在发送过程中被截断
+                std::cerr << "发送文件数据失败: 文件被截断" << std::endl;
+                state = ConnState::Closed;
+                return;
+            }
+            size_t before = transferred;
+            transferred += diskResult;
+            socketFull = size_t(diskResult) < want;
+            reportProgress("已发送", before);
+        });
+        return Step::Continue;
+    }
+
+    if (ioOff < ioLen) {
+        ssize_t n = send(sockFd, ioBuf.data() + ioOff, ioLen - ioOff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) return Step::Continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Step::Wait;
+            std::cerr << "发送文件数据失败: " << strerror(errno) << std::endl;
+            state = ConnState::Closed;
+            return Step::Continue;
+        }
+        ioOff += n;
+        budget -= std::min<size_t>(budget, n);
+        return Step::Continue;
+    }
+
+    if (compress) {
+        compressNext();
+        return Step::Continue;
+    }
+
+    // 缓冲区已发送完，从磁盘读取下一块
+    if (ioBuf.size() < IO_CHUNK) ioBuf.resize(IO_CHUNK);
+    runDisk([this] {
+        diskResult = pread(fileFd, ioBuf.data(), std::min(IO_CHUNK, rangeEnd - transferred), transferred);
+        diskErrno = errno;
+        if (diskResult > 0 && verify) rangeCrc = crc32c(rangeCrc, ioBuf.data(), diskResult);
+    }, [this] {
+        if (diskResult <= 0) {
+            std::cerr << "读取文件失败: " << strerror(diskResult < 0 ? diskErrno : EIO) << std::endl;
+            state = ConnState::Closed;
+            return;
+        }
+        ioLen = diskResult;
+        ioOff = 0;
+        size_t before = transferred;
+        transferred += ioLen;
+        reportProgress("已发送", before);
+    });
+    return Step::Continue;
+}
+
+void Connection::finishDownload() {
+    if (fileFd >= 0) close(fileFd);
+    fileFd = -1;
+    mapped.reset();
+    // 缓存命中的都是小文件，不逐个输出日志
+    if (!cached) std::cout << "下载完成: " << basename << " (总大小: " << fileSize << " 字节) 发送至 " << peer << std::endl;
+    cached.reset();
+    if (verify) {
+        // 校验下载：数据之后发送 "<范围校验和> [<整个文件的校验和>]\n"，没有记录时省略整个文件的校验和
+        std::string trailer = crc32cHex(rangeCrc);
+        if (fileCrcKnown) trailer += " " + crc32cHex(fileCrc);
+        fileCrcKnown = false;
+        reply(trailer + "\n", ConnState::ReadCommand);
+        return;
+    }
+    // 保持连接，继续处理下一条命令（可能已在输入缓冲区中）
+    state = ConnState::ReadCommand;
+}
+
+// 每跨过 1MB 边界输出一次传输进度
+void Connection::reportProgress(const char* verb, size_t before) {
+    constexpr size_t MB = 1024 * 1024;
+    if (transferred / MB != before / MB) {
+        std::cout << verb << ": " << transferred << "/" << fileSize << " 字节 ("
+                  << (transferred * 100 / fileSize) << "%)" << std::endl;
+    }
+}
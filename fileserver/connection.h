@@ -0,0 +1,243 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <string>
+#include <istream>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <chrono>
+#include <sys/types.h>
+#include "linebuffer.h"
+#include "filecache.h"
+#include "mappedfile.h"
+#include "uploadwriter.h"
+#include "blobstore.h"
+#include "delta.h"
+#include "pcd.h"
+#include "pcdindex.h"
+#include "pcdcatalog.h"
+#include "pcdstats.h"
+#include "pcdmerge.h"
+#include "command.h"
+
+// 下载模式：Sendfile 直接从页缓存发送到 socket（零拷贝），Stream 为传统的 read + send，
+// Mmap 从同一文件所有下载共用的映射直接 send
+enum class DownloadMode { Stream, Sendfile, Mmap };
+
+// 上传模式：Splice 经内核管道把 socket 数据直接搬进文件（零拷贝），Stream 为 recv 到用户态缓冲区后整块写入，
+// Direct 与 Stream 相同但以 O_DIRECT 写入，不占用页缓存
+enum class UploadMode { Stream, Splice, Direct };
+
+// 事件循环后端：Epoll 为就绪通知 + 线程池磁盘操作，Uring 为 io_uring 完成通知（需 USE_IO_URING 编译）
+enum class Backend { Epoll, Uring };
+
+// 服务端配置，由命令行参数解析得到
+struct ServerConfig {
+#ifdef USE_IO_URING
+    Backend backend = Backend::Uring;
+#else
+    Backend backend = Backend::Epoll;
+#endif
+    DownloadMode downloadMode = DownloadMode::Sendfile;
+    UploadMode uploadMode = UploadMode::Splice;
+    int reactors = 1;  // 事件循环个数，0 表示每个 CPU 核一个
+    int idleTimeout = 60;  // 连接空闲超时（秒），0 表示不超时
+    int cacheMB = 64;      // 热点小文件缓存容量（MB），0 表示不缓存
+    bool pcdCompress = false;  // 上传的 DATA binary 点云转存为 binary_compressed（见 pcd.h）
+};
+
+class Connection;
+
+/**
+ * @brief 驱动 Connection 的事件循环提供的线程池接口
+ *
+ * epoll 后端由 Reactor 实现；io_uring 后端的 UringServer 也实现它，把自己的快速路径不处理的命令
+ * 交给 Connection（见 Connection 的借用构造函数），两个后端共用同一套命令处理。
+ * 以下函数都在事件循环线程中调用。
+ */
+class ConnectionHost {
+public:
+    virtual ~ConnectionHost() = default;
+
+    // 把磁盘任务交给线程池，完成后在事件循环线程回调 conn.onDiskDone()
+    virtual void submitDisk(Connection& conn, std::function<void()> work) = 0;
+    // 把上传数据块的写入交给写盘线程，完成后在事件循环线程回调 conn.onWriteDone()
+    virtual void submitWrite(Connection& conn, std::function<void()> work) = 0;
+    // 把一组互相独立的任务分给线程池的多个线程并行执行，最后完成的线程再执行 join（可为空），
+    // 然后在事件循环线程回调 conn.onDiskDone()
+    virtual void submitBatch(Connection& conn, std::vector<std::function<void()>> work, std::function<void()> join) = 0;
+    // 把不属于任何连接的工作交给线程池（文件存入后的补充处理），完成后不回调
+    virtual void submitBackground(std::function<void()> work) = 0;
+};
+
+// 连接状态
+enum class ConnState {
+    ReadCommand,  // 读取命令行 "UPLOAD name\n" / "CHUNK name\n" / "DOWNLOAD name\n" / "QUERY name size\n" / "HASH name size sha256\n" / "PROOF name answer\n" /
+                  // "SIGNATURE name\n" / "DELTA name size blocksize crc32c\n" / "BOX name minx miny minz maxx maxy maxz\n" /
+                  // "FIND pattern [条件...]\n" / "STAT name\n" /
+                  // "MERGE pattern [first=N] [last=N]\n" / "EXIT\n"，每条命令处理完后回到这里
+    ReadSize,     // 读取上传文件大小行 "size\n"、续传的 "size offset\n" 或分块的 "size offset length\n"
+    RecvBody,     // 接收上传的文件数据或增量上传的操作序列
+    SendHeader,   // 发送一行响应："OK size\n" 或错误信息
+    SendFile,     // 发送下载的文件数据
+    Closed        // 连接已结束，等待 Reactor 回收
+};
+
+/**
+ * @brief 单个客户端连接的非阻塞状态机
+ *
+ * 由事件循环（ConnectionHost）在 socket 可读/可写时调用 handleEvent 驱动，每次只做不会阻塞的工作，
+ * 遇到 EAGAIN 立即返回，因此一个线程可以同时推进成千上万个传输。
+ * 连接是持久的：一条命令处理完后回到 ReadCommand，按顺序处理客户端流水线发送的
+ * 后续命令，直到收到 EXIT、客户端关闭或空闲超时。
+ * 会等待磁盘的操作交给线程池执行（runDisk）：打开/关闭/删除文件、Stream 模式下的文件读写、
+ * sendfile 以及 splice 上传中管道到文件的一段（Mmap 模式从映射发送，只靠预读尽量避免在事件循环中缺页）。
+ * 期间连接暂停监听 socket 事件，完成后由事件循环调用 onDiskDone 继续推进。
+ * Stream/Direct 上传的数据块由写盘线程在后台写入（kickWrite），期间连接继续接收；
+ * 写队列已满时暂停监听（writeBlocked），写完一块后由事件循环调用 onWriteDone 继续。
+ * io_uring 后端借用 Connection 处理一条命令时，socket 仍归 io_uring 后端所有：
+ * 命令处理完后 lendDone() 为 true，剩余的输入由 takeInput 交还，析构时不关闭 socket。
+ */
+class Connection {
+public:
+    Connection(int fd, ConnectionHost& host, const ServerConfig& config);
+    // 借用：处理 pending（已收到、以一条完整命令行开头的数据）中的这一条命令，之后交还连接
+    Connection(int fd, ConnectionHost& host, const ServerConfig& config, const std::string& pending);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    void handleEvent(uint32_t events);  // socket 就绪事件
+    void onDiskDone();                  // 线程池中的磁盘任务已完成（在 Reactor 线程调用）
+    void onWriteDone();                 // 后台写盘的数据块已写完（在 Reactor 线程调用）
+    void checkIdle(std::chrono::steady_clock::time_point now);  // 空闲超时则关闭连接
+
+    int fd() const { return sockFd; }
+    bool closed() const { return state == ConnState::Closed && !writePending; }
+    uint32_t interest() const;  // 当前需要监听的 epoll 事件，0 表示暂停监听
+    bool lendDone() const;      // 借用的连接已处理完命令，可以交还
+    std::string takeInput();    // 取出已收到、尚未处理的输入
+
+private:
+    // 单步推进的结果：Continue 继续下一步，Wait 等待下一次事件
+    enum class Step { Continue, Wait };
+
+    void drive();
+    Step readCommand();
+    Step readSize();
+    Step recvBody();
+    Step recvCompressed();
+    Step readTrailer();
+    Step recvDelta();
+    Step sendHeader();
+    Step sendFile();
+
+    bool readLine(std::string& line, bool& done);
+    void kickWrite();
+    int openUploadFile(const std::string& path, int flags);
+    void startUpload(uint64_t offset);
+    void startChunk(uint64_t offset, uint64_t length);
+    void startDelta(uint64_t blockSize);
+    void startDownload();
+    void startPcdDownload();
+    void startBoxQuery(const PcdBox& box);
+    void sendPcdResult(CachedFilePtr result);
+    void startMerge(const PcdMergeRequest& request);
+    void nextMergeFrame();
+    void compressNext();
+    bool decodeBatch();
+    std::string responseHeader() const;
+    void sendCached(CachedFilePtr entry);
+    void sendMapped(MappedFilePtr mapping);
+    bool openPipe();
+    void drainPipe();
+    void finishUpload();
+    void finishChunk();
+    void abortUpload(const std::string& reason);
+    void rejectUpload();
+    void finishDelta();
+    void afterStore(std::shared_ptr<const PcdStats> streamed);
+    void abortDelta(const std::string& reason);
+    void saveAbortedUpload();
+    void finishDownload();
+    void reply(const std::string& msg, ConnState next);
+    void runDisk(std::function<void()> work, std::function<void()> then);
+    void runParallel(std::vector<std::function<void()>> work, std::function<void()> join, std::function<void()> then);
+    void reportProgress(const char* verb, size_t before);
+
+    int sockFd;
+    ConnectionHost& host;
+    bool lent = false;       // 由 io_uring 后端借用，只处理一条命令，不拥有 socket
+    bool commandRead = false;  // 借用的连接已经读到了那条命令
+    const ServerConfig& config;
+    ConnState state = ConnState::ReadCommand;
+    std::string peer;  // 客户端 ip:port，用于日志
+
+    LineBuffer inBuf;  // 输入缓冲区，协议头之后多读到的字节交给 recvBody
+    std::string basename;
+    std::string fullpath;
+    int fileFd = -1;
+    size_t fileSize = 0;
+    size_t transferred = 0;  // 下一个要接收/发送的文件偏移
+    ByteRange range;         // 下载请求的字节范围
+    PcdTransform pcdTransform;  // 下载请求的点云处理选项
+    size_t rangeStart = 0;   // 本次传输的文件范围 [rangeStart, rangeEnd)
+    size_t rangeEnd = 0;
+    bool chunked = false;    // 当前上传是多连接分块上传中的一个分块
+    PcdSniffer sniffer;      // 上传：截取点云文件的开头，存入后记入点云目录
+    PcdStatsBuilder statsBuilder;  // 上传：边接收边统计点云，存入后保存统计
+    std::unordered_map<std::string, BlobChallenge> challenges;  // 秒传：已回复 PROVE、等待 PROOF 的文件名
+    bool compress = false;   // 当前传输使用 LZF 分块压缩（见 compress.h）
+    bool verify = false;     // 当前传输带 CRC32C 校验和（见 crc32c.h）
+    uint32_t rangeCrc = 0;   // 下载：已读出的范围数据的校验和
+    uint32_t fileCrc = 0;    // 整个文件的校验和：上传时为客户端给出的值，下载时为存入时的记录
+    bool fileCrcKnown = false;
+    CachedFilePtr cached;    // 下载：从内存缓存发送时的文件内容，此时 fileFd 为 -1
+    MappedFilePtr mapped;    // 下载：Mmap 模式下共用的文件映射，此时 fileFd 为 -1
+    size_t prefetchEnd = 0;  // Mmap 模式已经通知内核预读到的文件偏移
+    std::shared_ptr<const PcdMergePlan> merge;  // 合并下载：各帧依次作为一次下载发送，发送完后清空
+    size_t mergeNext = 0;     // 合并下载中下一个要发送的帧
+    size_t mergeAdvised = 0;  // 已经通知内核预读到的帧
+    size_t budget = 0;       // 本次事件剩余可传输的字节数，保证连接之间的公平
+
+    std::string outBuf;  // 待发送的响应
+    size_t outOff = 0;
+    ConnState afterReply = ConnState::ReadCommand;  // 响应发送完后进入的状态
+    std::chrono::steady_clock::time_point lastActive;
+
+    bool zeroCopy = false;      // 当前是否在使用 sendfile/splice
+    bool socketFull = false;    // 上一次 sendfile 没有发完，等 socket 再次可写
+    int pipeFds[2] = {-1, -1};  // splice 使用的内核管道
+    size_t pipeCapacity = 0;    // 管道容量
+    size_t pipeBytes = 0;       // 管道中尚未写入文件的字节数
+
+    UploadWriter writer;        // Stream/Direct 上传模式的写入引擎
+    bool writePending = false;  // 有数据块正在后台写盘
+    bool writeBlocked = false;  // 等待写盘完成：写队列已满、上传数据已收齐或上传中断
+    bool abortPending = false;  // 上传已中断，等正在写盘的数据块完成后保存进度
+    DeltaApplier delta;         // 增量上传：重建新版本
+    bool patching = false;      // 当前上传是增量上传
+    std::vector<char> ioBuf;  // Stream 下载的数据、压缩下载待发送的帧、压缩上传解压后的数据、splice 上传窥视的点云数据
+    size_t ioLen = 0;
+    size_t ioOff = 0;
+    std::vector<char> codecBuf;  // 压缩下载读出的原始数据、压缩上传正在接收的一批帧
+    size_t codecLen = 0;
+    // 压缩传输一批数据中的一块（一帧），同一批的各块由线程池的不同线程同时编解码
+    struct CodecBlock {
+        size_t rawOff, rawLen;      // 原始数据的位置：下载在 codecBuf 中，上传在 ioBuf 中
+        size_t codedOff, codedLen;  // 编码后的位置：下载为 ioBuf 中的整帧，上传为 codecBuf 中帧头之后存储的数据
+        bool ok;
+        int err;
+    };
+    std::vector<CodecBlock> blocks;
+
+    bool diskPending = false;
+    ssize_t diskResult = 0;
+    int diskErrno = 0;
+    std::function<void()> diskThen;
+};
+
+#endif // CONNECTION_H
@@ -0,0 +1,97 @@
+#include "crc32c.h"
+#include <cstring>
+#include <cstdio>
+#if defined(__x86_64__) && !defined(CRC32C_SOFTWARE)
+#include <nmmintrin.h>
+#endif
+
+constexpr uint32_t POLY = 0x82f63b78;  // Castagnoli 多项式（反射形式）
+
+// slicing-by-8 查表：table[k][b] 为字节 b 之后再跟 k 个零字节的校验和
+struct Crc32cTable {
+    uint32_t t[8][256];
+
+    Crc32cTable() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; ++i) crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+            t[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+        }
+    }
+};
+
+static const Crc32cTable table;
+
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = (crc >> 8) ^ table.t[0][(crc ^ *p++) & 0xff];
+        --len;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        word ^= crc;
+        crc = table.t[7][word & 0xff] ^ table.t[6][(word >> 8) & 0xff] ^
+              table.t[5][(word >> 16) & 0xff] ^ table.t[4][(word >> 24) & 0xff] ^
+              table.t[3][(word >> 32) & 0xff] ^ table.t[2][(word >> 40) & 0xff] ^
+              table.t[1][(word >> 48) & 0xff] ^ table.t[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = (crc >> 8) ^ table.t[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__) && !defined(CRC32C_SOFTWARE)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        --len;
+    }
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len-- > 0) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+#endif
+
+bool crc32cHardware() {
+#if defined(__x86_64__) && !defined(CRC32C_SOFTWARE)
+    static const bool hardware = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+    return hardware;
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__) && !defined(CRC32C_SOFTWARE)
+    if (crc32cHardware()) return ~crc32cSse42(~crc, p, len);
+#endif
+    return ~crc32cSoftware(~crc, p, len);
+}
+
+std::string crc32cHex(uint32_t crc) {
+    char buf[9];
+    std::snprintf(buf, sizeof(buf), "%08x", crc);
+    return buf;
+}
+
+bool parseCrc32c(const std::string& hex, uint32_t& crc) {
+    if (hex.size() != 8 || hex.find_first_not_of("0123456789abcdef") != std::string::npos) return false;
+    crc = (uint32_t)std::stoul(hex, nullptr, 16);
+    return true;
+}
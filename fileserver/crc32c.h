@@ -0,0 +1,29 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief CRC32C（Castagnoli）校验和，服务端和客户端共用
+ *
+ * 支持 SSE4.2 的 x86-64 处理器上使用 crc32 指令每次处理 8 字节，其余情况使用
+ * slicing-by-8 查表实现，运行时自动选择，两者结果相同。
+ * 传输时两端边收发边计算，不需要再读一遍数据：客户端在命令行末尾加上 CHECKSUM_OPTION
+ * 后，每个传输范围的数据之后跟一行 "<范围校验和> [<整个文件的校验和>]\n"（8 位十六进制）。
+ */
+
+constexpr const char* CHECKSUM_OPTION = "crc32c";
+
+// 在 crc（之前数据的校验和，初始为 0）的基础上继续计算 data 的校验和
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+// 当前是否使用 SSE4.2 指令
+bool crc32cHardware();
+
+// 8 位小写十六进制
+std::string crc32cHex(uint32_t crc);
+// 解析 8 位十六进制，格式错误返回 false
+bool parseCrc32c(const std::string& hex, uint32_t& crc);
+
+#endif // CRC32C_H
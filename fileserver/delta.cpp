@@ -0,0 +1,354 @@
+#include "delta.h"
+#include "sha256.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+constexpr size_t DELTA_BATCH = 1024 * 1024;         // 服务端每批写入、客户端每次发送的操作序列字节数
+constexpr size_t SIGNATURE_READ = 1024 * 1024;      // 计算签名时每次读取的字节数
+constexpr size_t MIN_BLOCK = 2 * 1024;
+constexpr size_t MAX_BLOCK = 128 * 1024;
+
+static void putBE32(char* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t getBE32(const char* p) {
+    const uint8_t* u = (const uint8_t*)p;
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+}
+
+// 签名的弱校验和先经过 65536 项的标记表过滤，大多数位置不需要查找
+static inline uint32_t weakTag(uint32_t weak) {
+    return (weak ^ (weak >> 16)) & 0xFFFF;
+}
+
+size_t deltaBlockSize(uint64_t fileSize) {
+    size_t size = ((size_t)std::sqrt((double)fileSize) + 1023) / 1024 * 1024;
+    return std::min(std::max(size, MIN_BLOCK), MAX_BLOCK);
+}
+
+void RollingChecksum::reset(const char* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    a = b = 0;
+    len = n;
+    for (size_t i = 0; i < n; ++i) {
+        a += p[i];
+        b += (n - i) * p[i];
+    }
+}
+
+void strongChecksum(const char* data, size_t len, uint8_t out[DELTA_STRONG]) {
+    Sha256 sha;
+    sha.update(data, len);
+    uint8_t digest[32];
+    sha.digest(digest);
+    memcpy(out, digest, DELTA_STRONG);
+}
+
+// 从 fd 的 offset 处读满 len 字节，文件提前结束时 errno 为 EIO
+static bool preadAll(int fd, char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool pwriteAll(int fd, const char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool fileSignatures(int fd, uint64_t size, size_t blockSize, std::string& out) {
+    uint64_t end = size / blockSize * blockSize;
+    std::vector<char> chunk(std::max<size_t>(1, SIGNATURE_READ / blockSize) * blockSize);
+    out.reserve(out.size() + size / blockSize * DELTA_SIGNATURE);
+    for (uint64_t offset = 0; offset < end;) {
+        size_t len = std::min<uint64_t>(chunk.size(), end - offset);
+        if (!preadAll(fd, chunk.data(), len, offset)) return false;
+        for (size_t pos = 0; pos < len; pos += blockSize) {
+            RollingChecksum weak;
+            weak.reset(chunk.data() + pos, blockSize);
+            char entry[DELTA_SIGNATURE];
+            putBE32(entry, weak.value());
+            strongChecksum(chunk.data() + pos, blockSize, (uint8_t*)entry + 4);
+            out.append(entry, sizeof(entry));
+        }
+        offset += len;
+    }
+    return true;
+}
+
+/**
+ * @brief 差异编码
+ *
+ * 窗口从新版本开头逐字节滑动：弱校验和通过标记表和排好序的签名表命中后才计算窗口的强校验和，
+ * 强校验和也相同时认为是旧版本的这一块，窗口跳过整块；多个旧块内容相同时优先选紧接着上一个
+ * 匹配块的那块，使未修改的区域合并成一个 "index count" 操作。
+ * 两次匹配之间的数据作为原样数据发送，攒够 DELTA_LITERAL_MAX 就先发出去，不必等到下一次匹配。
+ */
+bool encodeDelta(const char* data, size_t len, const std::string& signatures, size_t blockSize,
+                 const std::function<bool(const char*, size_t)>& emit, uint64_t& reused) {
+    reused = 0;
+    size_t blocks = signatures.size() / DELTA_SIGNATURE;
+    std::vector<std::pair<uint32_t, uint32_t>> table;  // (弱校验和, 块号)，按弱校验和排序
+    std::vector<bool> tags(1 << 16);
+    table.reserve(blocks);
+    for (size_t i = 0; i < blocks; ++i) {
+        uint32_t weak = getBE32(signatures.data() + i * DELTA_SIGNATURE);
+        table.emplace_back(weak, (uint32_t)i);
+        tags[weakTag(weak)] = true;
+    }
+    std::sort(table.begin(), table.end());
+
+    std::string out;
+    uint32_t runStart = 0, runCount = 0;  // 尚未输出的连续旧块
+    auto header = [&out](uint32_t first, uint32_t second) {
+        char h[DELTA_OP_HEADER];
+        putBE32(h, first);
+        putBE32(h + 4, second);
+        out.append(h, sizeof(h));
+    };
+    auto flush = [&]() {
+        if (runCount > 0) header(runStart, runCount);
+        runCount = 0;
+        bool ok = out.empty() || emit(out.data(), out.size());
+        out.clear();
+        return ok;
+    };
+    auto literal = [&](const char* p, size_t n) {
+        if (n > 0 && runCount > 0) {
+            header(runStart, runCount);
+            runCount = 0;
+        }
+        while (n > 0) {
+            size_t k = std::min(n, DELTA_LITERAL_MAX);
+            header(DELTA_LITERAL, k);
+            out.append(p, k);
+            p += k;
+            n -= k;
+            if (out.size() >= DELTA_BATCH && !flush()) return false;
+        }
+        return true;
+    };
+
+    size_t pos = 0, literalStart = 0;
+    RollingChecksum weak;
+    bool rolling = false;
+    while (blocks > 0 && len - pos >= blockSize) {
+        if (!rolling) {
+            weak.reset(data + pos, blockSize);
+            rolling = true;
+        }
+        uint32_t value = weak.value();
+        int64_t match = -1;
+        if (tags[weakTag(value)]) {
+            auto range = std::equal_range(table.begin(), table.end(), std::make_pair(value, 0u),
+                                          [](const std::pair<uint32_t, uint32_t>& x, const std::pair<uint32_t, uint32_t>& y) {
+                                              return x.first < y.first;
+                                          });
+            if (range.first != range.second) {
+                uint8_t strong[DELTA_STRONG];
+                strongChecksum(data + pos, blockSize, strong);
+                for (auto it = range.first; it != range.second; ++it) {
+                    const char* sig = signatures.data() + (size_t)it->second * DELTA_SIGNATURE + 4;
+                    if (memcmp(sig, strong, DELTA_STRONG) != 0) continue;
+                    match = it->second;
+                    if (runCount > 0 && it->second == runStart + runCount) break;
+                }
+            }
+        }
+        if (match >= 0) {
+            if (!literal(data + literalStart, pos - literalStart)) return false;
+            if (runCount > 0 && (uint32_t)match == runStart + runCount && runCount < UINT32_MAX) {
+                ++runCount;
+            } else {
+                if (runCount > 0) header(runStart, runCount);
+                runStart = (uint32_t)match;
+                runCount = 1;
+            }
+            pos += blockSize;
+            literalStart = pos;
+            reused += blockSize;
+            rolling = false;
+            continue;
+        }
+        if (pos + blockSize < len) weak.roll(data[pos], data[pos + blockSize]);
+        ++pos;
+        if (pos - literalStart >= DELTA_LITERAL_MAX) {
+            if (!literal(data + literalStart, DELTA_LITERAL_MAX)) return false;
+            literalStart += DELTA_LITERAL_MAX;
+        }
+    }
+    return literal(data + literalStart, len - literalStart) && flush();
+}
+
+DeltaApplier::~DeltaApplier() {
+    closeFiles();
+}
+
+void DeltaApplier::closeFiles() {
+    if (baseFd >= 0) close(baseFd);
+    if (outFd >= 0) close(outFd);
+    baseFd = outFd = -1;
+}
+
+bool DeltaApplier::open(const std::string& basePath, const std::string& path, uint64_t size, size_t block) {
+    closeFiles();
+    baseFd = ::open(basePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (baseFd < 0) return false;
+    struct stat st{};
+    if (fstat(baseFd, &st) < 0) {
+        closeFiles();
+        return false;
+    }
+    if (deltaBlockSize(st.st_size) != block) {
+        closeFiles();
+        errno = ESTALE;
+        return false;
+    }
+    outFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outFd < 0) {
+        closeFiles();
+        return false;
+    }
+    // 新版本的大小事先已知，一次预分配；文件系统不支持时随写入增长
+    fallocate(outFd, 0, 0, size);
+    outPath = path;
+    baseBlocks = st.st_size / block;
+    newSize = size;
+    blockSize = block;
+    buf.resize(DELTA_BATCH);
+    bufLen = headerLen = 0;
+    literalLeft = received = 0;
+    applyLeft = outPos = reusedBytes = 0;
+    return true;
+}
+
+size_t DeltaApplier::want() const {
+    if (complete()) return 0;
+    uint64_t need = literalLeft > 0 ? literalLeft : DELTA_OP_HEADER - headerLen;
+    return std::min<uint64_t>(need, buf.size() - bufLen);
+}
+
+char* DeltaApplier::space() {
+    return buf.data() + bufLen;
+}
+
+// 操作头在收齐 8 字节时检查，之后的写入不再需要检查范围
+bool DeltaApplier::commit(size_t n) {
+    bufLen += n;
+    if (literalLeft > 0) {
+        literalLeft -= n;
+        return true;
+    }
+    headerLen += n;
+    if (headerLen < DELTA_OP_HEADER) return true;
+    headerLen = 0;
+    const char* h = buf.data() + bufLen - DELTA_OP_HEADER;
+    uint32_t first = getBE32(h), count = getBE32(h + 4);
+    if (count == 0) return false;
+    if (first == DELTA_LITERAL) {
+        if (count > DELTA_LITERAL_MAX || count > newSize - received) return false;
+        literalLeft = count;
+        received += count;
+        return true;
+    }
+    if (first >= baseBlocks || count > baseBlocks - first || (uint64_t)count * blockSize > newSize - received) return false;
+    received += (uint64_t)count * blockSize;
+    return true;
+}
+
+bool DeltaApplier::apply() {
+    size_t pos = 0;
+    while (pos < bufLen) {
+        if (applyLeft > 0) {
+            size_t n = std::min<uint64_t>(applyLeft, bufLen - pos);
+            if (!pwriteAll(outFd, buf.data() + pos, n, outPos)) return false;
+            pos += n;
+            outPos += n;
+            applyLeft -= n;
+            continue;
+        }
+        if (bufLen - pos < DELTA_OP_HEADER) break;  // 尚未收齐的操作头
+        uint32_t first = getBE32(buf.data() + pos), count = getBE32(buf.data() + pos + 4);
+        pos += DELTA_OP_HEADER;
+        if (first == DELTA_LITERAL) {
+            applyLeft = count;
+        } else if (!copyBlocks(first, count)) {
+            return false;
+        }
+    }
+    memmove(buf.data(), buf.data() + pos, bufLen - pos);
+    bufLen -= pos;
+    return true;
+}
+
+// 先用 copy_file_range 在内核中复制（同一文件系统内可能直接共享数据块），不支持时退回 pread/pwrite
+bool DeltaApplier::copyBlocks(uint64_t index, uint64_t count) {
+    loff_t in = index * blockSize;
+    loff_t out = outPos;
+    uint64_t left = count * blockSize;
+    while (left > 0) {
+        ssize_t n = copy_file_range(baseFd, &in, outFd, &out, left, 0);
+        if (n > 0) {
+            left -= n;
+            continue;
+        }
+        if (n == 0) {
+            errno = EIO;  // 旧版本被截短
+            return false;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) return false;
+        scratch.resize(SIGNATURE_READ);
+        while (left > 0) {
+            size_t len = std::min<uint64_t>(left, scratch.size());
+            if (!preadAll(baseFd, scratch.data(), len, in) || !pwriteAll(outFd, scratch.data(), len, out)) return false;
+            in += len;
+            out += len;
+            left -= len;
+        }
+    }
+    outPos += count * blockSize;
+    reusedBytes += count * blockSize;
+    return true;
+}
+
+bool DeltaApplier::finish() {
+    bool ok = close(outFd) == 0;
+    int saved = errno;
+    outFd = -1;
+    closeFiles();
+    errno = saved;
+    return ok;
+}
+
+void DeltaApplier::discard() {
+    closeFiles();
+    if (!outPath.empty()) unlink(outPath.c_str());
+    outPath.clear();
+}
@@ -0,0 +1,129 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+/**
+ * @brief 增量上传：rsync 式的块签名、差异编码和重建，服务端和客户端共用
+ *
+ * 1. 客户端发送 "SIGNATURE name\n"，服务端把当前版本按 deltaBlockSize 切成整块，回复
+ *    "OK <文件大小> <块大小> <块数>\n"，随后是每块 DELTA_SIGNATURE 字节的签名：
+ *    4 字节弱校验和（可滚动计算，大端）+ SHA-256 的前 DELTA_STRONG 字节。末尾不足一块的部分没有签名。
+ * 2. 客户端在新版本上逐字节滑动窗口，弱校验和命中后再比较强校验和，找出与旧版本相同的块，
+ *    发送 "DELTA name <新文件大小> <块大小> <新文件的 CRC32C>\n"，随后是操作序列，
+ *    每个操作是 8 字节头（两个大端 32 位整数）：
+ *      DELTA_LITERAL count + count 字节数据：新版本中的一段原样数据（不超过 DELTA_LITERAL_MAX）
+ *      index count：旧版本从第 index 块开始的连续 count 块
+ *    所有操作产生的字节数正好等于新文件大小时结束，服务端回复 "OK <新文件大小>\n"。
+ * 3. 服务端把新版本重建在暂存区的临时文件中（旧版本的块由内核直接复制），核对整个文件的 CRC32C
+ *    后存入内容目录并原子地替换 filedir/<name>（见 blobstore.h），读者看到的要么是旧版本要么是新版本。
+ */
+
+constexpr uint32_t DELTA_LITERAL = 0xFFFFFFFF;        // 操作头的第一个字段：原样数据
+constexpr size_t DELTA_LITERAL_MAX = 64 * 1024;       // 一个原样数据操作的最大长度
+constexpr size_t DELTA_OP_HEADER = 8;
+constexpr size_t DELTA_STRONG = 16;                   // 签名中强校验和的字节数
+constexpr size_t DELTA_SIGNATURE = 4 + DELTA_STRONG;  // 每块签名的字节数
+
+// 旧版本的块大小：约为文件大小的平方根，按 1KB 取整，限制在 [2KB, 128KB]
+size_t deltaBlockSize(uint64_t fileSize);
+
+/**
+ * @brief rsync 的弱校验和，窗口向后移动一个字节时 O(1) 更新
+ *
+ * a 为窗口内字节之和，b 为各字节乘以其到窗口末尾的距离之和，均取低 16 位。
+ */
+class RollingChecksum {
+public:
+    void reset(const char* data, size_t len);
+    // 窗口移出 out、移入 in
+    void roll(unsigned char out, unsigned char in) {
+        a += in - out;
+        b += a - len * out;
+    }
+    uint32_t value() const { return (a & 0xFFFF) | (b << 16); }
+
+private:
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t len = 0;
+};
+
+// 一块数据的强校验和：SHA-256 的前 DELTA_STRONG 字节
+void strongChecksum(const char* data, size_t len, uint8_t out[DELTA_STRONG]);
+
+// 服务端：计算 fd 前 size 字节中每个整块的签名追加到 out，读取失败返回 false
+bool fileSignatures(int fd, uint64_t size, size_t blockSize, std::string& out);
+
+/**
+ * @brief 客户端：按旧版本的签名把新版本 data 编码为操作序列
+ *
+ * 编码好的数据每攒够一批交给 emit 发送，emit 返回 false 时停止编码并返回 false。
+ * reused 返回与旧版本相同、不需要发送的字节数。
+ */
+bool encodeDelta(const char* data, size_t len, const std::string& signatures, size_t blockSize,
+                 const std::function<bool(const char*, size_t)>& emit, uint64_t& reused);
+
+/**
+ * @brief 服务端：接收操作序列并重建新版本
+ *
+ * 在事件循环线程中按 want/space/commit 接收操作序列，commit 时检查操作头，不合法的
+ * 操作（越过旧版本末尾、产生的数据超过新文件大小）立即返回 false；收到的数据攒在缓冲区中，
+ * 攒满一批（full）或全部收到（complete）后由磁盘线程调用 apply 写入临时文件，
+ * 旧版本的块用 copy_file_range 在内核中复制，文件系统支持时直接共享数据块。
+ * open/apply/finish/discard 读写磁盘，在磁盘线程中调用，此时事件循环线程不访问本对象。
+ */
+class DeltaApplier {
+public:
+    DeltaApplier() = default;
+    ~DeltaApplier();
+
+    DeltaApplier(const DeltaApplier&) = delete;
+    DeltaApplier& operator=(const DeltaApplier&) = delete;
+
+    // 打开旧版本 basePath 并创建临时文件 outPath；旧版本的块大小不是 blockSize 时（文件已经变了）
+    // 返回 false，errno 为 ESTALE
+    bool open(const std::string& basePath, const std::string& outPath, uint64_t newSize, size_t blockSize);
+
+    size_t want() const;    // 不越过操作序列末尾、不超出缓冲区时下一次最多接收的字节数
+    char* space();          // 接收位置
+    bool commit(size_t n);  // 收到 n 字节（不超过 want），操作不合法时返回 false
+    bool full() const { return bufLen == buf.size(); }
+    bool complete() const { return received == newSize && literalLeft == 0 && headerLen == 0; }
+    bool pending() const { return bufLen > headerLen; }  // 有尚未写入的操作
+
+    bool apply();    // 写入已收到的操作，失败返回 false（errno）
+    bool finish();   // 全部写入后关闭文件，失败返回 false（errno）
+    void discard();  // 关闭并删除临时文件
+
+    uint64_t reused() const { return reusedBytes; }  // 从旧版本复制的字节数
+
+private:
+    bool copyBlocks(uint64_t index, uint64_t count);
+    void closeFiles();
+
+    int baseFd = -1;
+    int outFd = -1;
+    std::string outPath;
+    uint64_t baseBlocks = 0;
+    uint64_t newSize = 0;
+    size_t blockSize = 0;
+
+    std::vector<char> buf;  // 已收到、尚未写入的操作序列
+    size_t bufLen = 0;
+    // 接收侧（事件循环线程）：当前操作头已收到的字节数、原样数据还差的字节数、操作已覆盖的新文件字节数
+    size_t headerLen = 0;
+    uint64_t literalLeft = 0;
+    uint64_t received = 0;
+    // 写入侧（磁盘线程）：当前原样数据还差的字节数、下一个写入的新文件偏移
+    uint64_t applyLeft = 0;
+    uint64_t outPos = 0;
+    uint64_t reusedBytes = 0;
+    std::vector<char> scratch;  // 不支持 copy_file_range 时复制旧版本块的缓冲区
+};
+
+#endif // DELTA_H
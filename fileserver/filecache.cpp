@@ -0,0 +1,107 @@
+#include "filecache.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <unistd.h>
+
+constexpr size_t GENERATION_SLOTS = 256;  // 失效计数的分组数
+
+// 一个事件循环的缓存：LRU 链表（头部为最近下载的文件）和文件名索引，只由该事件循环的线程访问
+struct LoopCache {
+    std::list<std::pair<std::string, CachedFilePtr>> lru;
+    std::unordered_map<std::string, std::list<std::pair<std::string, CachedFilePtr>>::iterator> index;
+    size_t bytes = 0;
+    uint64_t seen = 0;  // 上次清理时的 invalidations
+};
+
+static thread_local LoopCache loopCache;
+static std::atomic<uint64_t> generations[GENERATION_SLOTS];
+static std::atomic<uint64_t> invalidations{0};  // 失效的总次数，事件循环据此发现需要清理
+static size_t loopCapacity = 0;
+
+static std::atomic<uint64_t>& generationFor(const std::string& basename) {
+    return generations[std::hash<std::string>()(basename) % GENERATION_SLOTS];
+}
+
+static void eraseEntry(LoopCache& cache, std::list<std::pair<std::string, CachedFilePtr>>::iterator it) {
+    cache.bytes -= it->second->data.size();
+    cache.index.erase(it->first);
+    cache.lru.erase(it);
+}
+
+// 有文件被替换后丢弃本事件循环中所有已失效的条目，不让旧内容一直占着容量
+static void dropStale(LoopCache& cache) {
+    uint64_t now = invalidations.load(std::memory_order_acquire);
+    if (cache.seen == now) return;
+    cache.seen = now;
+    for (auto it = cache.lru.begin(); it != cache.lru.end();) {
+        auto next = std::next(it);
+        if (it->second->generation != fileCacheGeneration(it->first)) eraseEntry(cache, it);
+        it = next;
+    }
+}
+
+void initFileCache(size_t capacity, int loops) {
+    loopCapacity = capacity / std::max(loops, 1);
+}
+
+bool cacheableSize(uint64_t size) {
+    return size <= std::min(CACHE_MAX_FILE, loopCapacity);
+}
+
+CachedFilePtr lookupCachedFile(const std::string& basename) {
+    if (loopCapacity == 0) return nullptr;
+    LoopCache& cache = loopCache;
+    dropStale(cache);
+    auto it = cache.index.find(basename);
+    if (it == cache.index.end()) return nullptr;
+    if (it->second->second->generation != fileCacheGeneration(basename)) {
+        eraseEntry(cache, it->second);  // 文件已被替换
+        return nullptr;
+    }
+    cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+    return it->second->second;
+}
+
+uint64_t fileCacheGeneration(const std::string& basename) {
+    return generationFor(basename).load(std::memory_order_acquire);
+}
+
+CachedFilePtr loadCachedFile(int fd, uint64_t size, uint64_t generation) {
+    if (!cacheableSize(size)) return nullptr;
+
+    // 读取不完整（文件被截断）时放弃缓存
+    auto entry = std::make_shared<CachedFile>();
+    entry->header = "OK " + std::to_string(size) + "\n";
+    entry->data.resize(size);
+    entry->generation = generation;
+    for (size_t done = 0; done < size;) {
+        ssize_t n = pread(fd, &entry->data[done], size - done, done);
+        if (n <= 0) return nullptr;
+        done += n;
+    }
+    return entry;
+}
+
+void keepCachedFile(const std::string& basename, CachedFilePtr entry) {
+    if (entry->generation != fileCacheGeneration(basename)) return;
+    LoopCache& cache = loopCache;
+    auto it = cache.index.find(basename);
+    if (it != cache.index.end()) eraseEntry(cache, it->second);
+    cache.bytes += entry->data.size();
+    cache.lru.emplace_front(basename, std::move(entry));
+    cache.index[basename] = cache.lru.begin();
+    while (cache.bytes > loopCapacity) eraseEntry(cache, std::prev(cache.lru.end()));
+}
+
+void sweepFileCache() {
+    dropStale(loopCache);
+}
+
+void invalidateCachedFile(const std::string& basename) {
+    generationFor(basename).fetch_add(1, std::memory_order_acq_rel);
+    invalidations.fetch_add(1, std::memory_order_release);
+}
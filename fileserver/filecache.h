@@ -0,0 +1,62 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief 热点小文件的内存缓存（每个事件循环一份）
+ *
+ * 不超过 CACHE_MAX_FILE 的文件在第一次下载时整个读入内存，之后的下载直接从内存发送，
+ * 不再打开文件、也不访问文件系统。每个事件循环线程有自己的 LRU 链表和文件名索引，
+ * 容量为总容量按事件循环个数均分，超出容量时淘汰最久没有被下载的文件。查找和加入只在
+ * 事件循环自己的线程中进行，下载的热路径上不加锁，事件循环之间也不共享任何锁；代价是
+ * 同一个热点文件在每个事件循环中各读入一次、各占一份内存。
+ * 上传（包括分块上传和秒传）替换 filedir/ 中的文件时调用 invalidateCachedFile，它只递增
+ * 按文件名哈希分组的原子失效计数；每个条目记录读入文件之前的计数，计数已变的条目已经失效，
+ * 同组的其他文件也会因此重新读入一次。各事件循环在下一次查找或定期的 sweepFileCache 中
+ * 发现有过失效，丢弃自己缓存中失效的条目。绕过服务端直接修改 filedir/ 的文件不会被察觉。
+ */
+
+constexpr size_t CACHE_MAX_FILE = 1024 * 1024;  // 可以缓存的最大文件
+
+struct CachedFile {
+    std::string header;       // 预先生成的完整下载响应头 "OK <size>\n"
+    std::string data;         // 文件内容
+    uint64_t generation = 0;  // 读入之前的失效计数（loadCachedFile 设置）
+};
+
+using CachedFilePtr = std::shared_ptr<const CachedFile>;
+
+// 设置缓存总容量（字节，0 表示不缓存）和事件循环个数；在启动事件循环之前调用
+void initFileCache(size_t capacity, int loops);
+
+// 缓存已启用且 size 不超过可缓存的大小
+bool cacheableSize(uint64_t size);
+
+// 在当前事件循环的缓存中查找，命中时返回文件内容并把它移到 LRU 链表头部，未命中或已失效返回空指针
+CachedFilePtr lookupCachedFile(const std::string& basename);
+
+// 读取文件之前取得的失效计数，用于发现读取期间文件是否被替换（任何线程都可以调用）
+uint64_t fileCacheGeneration(const std::string& basename);
+
+/**
+ * @brief 从已打开的文件读入整个内容（在磁盘线程中调用）
+ *
+ * 缓存未启用、文件过大或读取失败时返回空指针，调用方按普通方式发送文件。
+ * 读到的内容由事件循环线程用 keepCachedFile 加入自己的缓存。
+ */
+CachedFilePtr loadCachedFile(int fd, uint64_t size, uint64_t generation);
+
+// 把 loadCachedFile 读到的内容加入当前事件循环的缓存；读取期间文件已被替换时不加入，只供本次下载使用
+void keepCachedFile(const std::string& basename, CachedFilePtr entry);
+
+// 丢弃当前事件循环缓存中已失效的条目（事件循环定期调用）
+void sweepFileCache();
+
+// filedir/<basename> 已被替换，使各个事件循环缓存中的旧内容失效（任何线程都可以调用）
+void invalidateCachedFile(const std::string& basename);
+
+#endif // FILECACHE_H
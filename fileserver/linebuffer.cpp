@@ -0,0 +1,59 @@
+#include "linebuffer.h"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+
+LineBuffer::LineBuffer(size_t chunkSize) : chunkSize(chunkSize) {}
+
+// 保证尾部至少有 len 字节空闲空间：先把未取出的数据移到开头，仍不够再扩容
+void LineBuffer::reserve(size_t len) {
+    if (buf.size() - tail >= len) return;
+    if (head > 0) {
+        std::memmove(buf.data(), buf.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+    if (buf.size() - tail < len) buf.resize(tail + len);
+}
+
+ssize_t LineBuffer::fill(int fd) {
+    reserve(chunkSize);
+    ssize_t n;
+    do {
+        n = recv(fd, buf.data() + tail, buf.size() - tail, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) tail += n;
+    return n;
+}
+
+void LineBuffer::append(const char* data, size_t len) {
+    reserve(len);
+    std::memcpy(buf.data() + tail, data, len);
+    tail += len;
+}
+
+bool LineBuffer::getLine(std::string& line) {
+    const char* start = buf.data() + head;
+    const char* nl = static_cast<const char*>(std::memchr(start, '\n', tail - head));
+    if (!nl) return false;
+    line.assign(start, nl - start);
+    head += nl - start + 1;
+    if (head == tail) head = tail = 0;
+    return true;
+}
+
+bool LineBuffer::readLine(int fd, std::string& line) {
+    while (!getLine(line)) {
+        if (fill(fd) <= 0) return false;
+    }
+    return true;
+}
+
+size_t LineBuffer::take(char* dst, size_t len) {
+    size_t n = std::min(len, tail - head);
+    std::memcpy(dst, buf.data() + head, n);
+    head += n;
+    if (head == tail) head = tail = 0;
+    return n;
+}
@@ -0,0 +1,44 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * @brief 每个连接的输入缓冲区
+ *
+ * 一次 recv 读入一大块数据，再用 memchr 在缓冲区中整块查找换行符，
+ * 代替逐字节 recv 解析协议头。协议头之后多读到的字节留在缓冲区中，
+ * 由调用者通过 take 交给文件数据的处理流程。
+ */
+class LineBuffer {
+public:
+    explicit LineBuffer(size_t chunkSize = 16 * 1024);
+
+    // 从 fd 读取一次（最多 chunkSize 字节）追加到缓冲区，返回值同 recv
+    ssize_t fill(int fd);
+    // 追加已经从别处收到的数据（例如 io_uring 的完成事件）
+    void append(const char* data, size_t len);
+
+    // 从缓冲区取出一行（不含 \n），没有完整的一行时返回 false
+    bool getLine(std::string& line);
+    // 阻塞读取一行，缓冲区中没有完整的一行时调用 fill；连接关闭或出错返回 false
+    bool readLine(int fd, std::string& line);
+
+    // 取出最多 len 字节的剩余数据，返回实际取出的字节数
+    size_t take(char* dst, size_t len);
+
+    size_t size() const { return tail - head; }  // 尚未取出的字节数
+    bool empty() const { return head == tail; }
+
+private:
+    void reserve(size_t len);
+
+    std::vector<char> buf;
+    size_t head = 0;  // 第一个未取出的字节
+    size_t tail = 0;  // 有效数据的末尾
+    size_t chunkSize;
+};
+
+#endif // LINEBUFFER_H
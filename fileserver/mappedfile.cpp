@@ -0,0 +1,102 @@
+#include "mappedfile.h"
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/mman.h>
+
+constexpr size_t MAX_MAPPINGS = 256;      // 每个事件循环的注册表保留的映射个数
+constexpr size_t GENERATION_SLOTS = 256;  // 失效计数的分组数
+
+// 一个事件循环的注册表，只由该事件循环的线程访问
+struct LoopRegistry {
+    std::list<std::pair<std::string, MappedFilePtr>> lru;  // 头部为最近下载的文件
+    std::unordered_map<std::string, std::list<std::pair<std::string, MappedFilePtr>>::iterator> index;
+    uint64_t seen = 0;  // 上次清理时的 invalidations
+};
+
+static thread_local LoopRegistry loopRegistry;
+static std::atomic<uint64_t> generations[GENERATION_SLOTS];
+static std::atomic<uint64_t> invalidations{0};  // 失效的总次数，事件循环据此发现需要清理
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<char*>(data), size);
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t length) const {
+    // madvise 要求起始地址按页对齐
+    static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / pageSize * pageSize;
+    madvise(const_cast<char*>(data) + start, offset + length - start, MADV_WILLNEED);
+}
+
+static std::atomic<uint64_t>& generationFor(const std::string& basename) {
+    return generations[std::hash<std::string>()(basename) % GENERATION_SLOTS];
+}
+
+// 有文件被替换后从本事件循环的注册表中移除所有已失效的映射，已删除的文件不会因为映射一直占着磁盘空间
+static void dropStale(LoopRegistry& registry) {
+    uint64_t now = invalidations.load(std::memory_order_acquire);
+    if (registry.seen == now) return;
+    registry.seen = now;
+    for (auto it = registry.lru.begin(); it != registry.lru.end();) {
+        auto next = std::next(it);
+        if (it->second->generation != mappedFileGeneration(it->first)) {
+            registry.index.erase(it->first);
+            registry.lru.erase(it);
+        }
+        it = next;
+    }
+}
+
+MappedFilePtr lookupMappedFile(const std::string& basename) {
+    LoopRegistry& registry = loopRegistry;
+    dropStale(registry);
+    auto it = registry.index.find(basename);
+    if (it == registry.index.end()) return nullptr;
+    if (it->second->second->generation != mappedFileGeneration(basename)) {
+        // 文件已被替换，正在进行的下载仍持有旧映射
+        registry.lru.erase(it->second);
+        registry.index.erase(it);
+        return nullptr;
+    }
+    registry.lru.splice(registry.lru.begin(), registry.lru, it->second);
+    return it->second->second;
+}
+
+uint64_t mappedFileGeneration(const std::string& basename) {
+    return generationFor(basename).load(std::memory_order_acquire);
+}
+
+MappedFilePtr mapFile(int fd, uint64_t size, uint64_t generation) {
+    if (size == 0) return nullptr;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) return nullptr;
+    // 下载按顺序读取：加大预读、已发送的页面可以较早回收
+    madvise(addr, size, MADV_SEQUENTIAL);
+    return std::make_shared<const MappedFile>(static_cast<const char*>(addr), size, generation);
+}
+
+void keepMappedFile(const std::string& basename, MappedFilePtr mapping) {
+    if (mapping->generation != mappedFileGeneration(basename)) return;
+    LoopRegistry& registry = loopRegistry;
+    auto it = registry.index.find(basename);
+    if (it != registry.index.end()) registry.lru.erase(it->second);
+    registry.lru.emplace_front(basename, std::move(mapping));
+    registry.index[basename] = registry.lru.begin();
+    if (registry.lru.size() > MAX_MAPPINGS) {
+        registry.index.erase(registry.lru.back().first);
+        registry.lru.pop_back();
+    }
+}
+
+void sweepMappedFiles() {
+    dropStale(loopRegistry);
+}
+
+void invalidateMappedFile(const std::string& basename) {
+    generationFor(basename).fetch_add(1, std::memory_order_acq_rel);
+    invalidations.fetch_add(1, std::memory_order_release);
+}
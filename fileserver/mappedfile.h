@@ -0,0 +1,56 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+/**
+ * @brief 下载用的共享文件映射（--download=mmap）
+ *
+ * 同一个事件循环上同一个文件的所有并发下载共用一个只读映射，直接从映射的内存 send 给客户端。
+ * 映射按引用计数管理：每个事件循环的注册表保存它最近下载过的 MAX_MAPPINGS 个文件的映射，
+ * 每个正在进行的下载再各持有一个引用，被淘汰或失效的映射在最后一个下载结束后才解除。
+ * 命中注册表的下载不需要 open/fstat/mmap/munmap，热门文件的页面也一直留在内存中。
+ * 注册表只在事件循环自己的线程中访问，查找不加锁；不同事件循环各自映射同一个文件，
+ * 共用的是页缓存。上传替换 filedir/ 中的文件时调用 invalidateMappedFile，它递增按文件名哈希
+ * 分组的原子失效计数，各事件循环在下一次查找或定期的 sweepMappedFiles 中丢弃失效的映射（与 filecache.h 相同）。
+ * 内容文件写入后不再修改（见 blobstore.h），映射中的数据不会被截断。
+ */
+class MappedFile {
+public:
+    MappedFile(const char* data, uint64_t size, uint64_t generation) : data(data), size(size), generation(generation) {}
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // 通知内核预读 [offset, offset + length)，发送时尽量不在事件循环线程中等待缺页
+    void prefetch(uint64_t offset, uint64_t length) const;
+
+    const char* const data;
+    const uint64_t size;
+    const uint64_t generation;  // 打开文件之前的失效计数
+};
+
+using MappedFilePtr = std::shared_ptr<const MappedFile>;
+
+// 在当前事件循环的注册表中查找映射，未命中或已失效返回空指针
+MappedFilePtr lookupMappedFile(const std::string& basename);
+
+// 打开文件之前取得的失效计数，用于发现映射期间文件是否被替换（任何线程都可以调用）
+uint64_t mappedFileGeneration(const std::string& basename);
+
+// 映射已打开的文件（在磁盘线程中调用）；空文件或映射失败时返回空指针
+MappedFilePtr mapFile(int fd, uint64_t size, uint64_t generation);
+
+// 把 mapFile 得到的映射加入当前事件循环的注册表；映射期间文件已被替换时不加入，只供本次下载使用
+void keepMappedFile(const std::string& basename, MappedFilePtr mapping);
+
+// 从当前事件循环的注册表中移除已失效的映射（事件循环定期调用）
+void sweepMappedFiles();
+
+// filedir/<basename> 已被替换，使各个事件循环注册表中的旧映射失效（任何线程都可以调用）
+void invalidateMappedFile(const std::string& basename);
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,499 @@
+#include "pcd.h"
+#include "cmdoption.h"
+#include "compress.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+constexpr int VOXEL_BITS = 21;  // 体素键中每个坐标轴的位数，三个轴共 63 位
+constexpr uint64_t VOXEL_AXIS_MAX = (uint64_t(1) << VOXEL_BITS) - 1;
+
+int PcdHeader::field(const std::string& name) const {
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i].name == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+static bool parseCount(const std::string& s, uint64_t& value) {
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos || s.size() > 18) return false;
+    value = std::stoull(s);
+    return true;
+}
+
+bool parsePcdEncoding(const std::string& name, PcdEncoding& encoding) {
+    for (PcdEncoding e : {PcdEncoding::Ascii, PcdEncoding::Binary, PcdEncoding::BinaryCompressed}) {
+        if (name == pcdEncodingName(e)) {
+            encoding = e;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parsePcdHeader(const char* data, size_t len, PcdHeader& header) {
+    header = PcdHeader();
+    std::vector<std::string> sizes, types, counts;
+    bool hasPoints = false;
+    size_t pos = 0;
+    while (pos < len) {
+        const char* end = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+        if (end == nullptr) return false;  // 头部不完整
+        std::string line(data + pos, end);
+        pos = end - data + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream iss(line);
+        std::string key, token;
+        iss >> key;
+        std::vector<std::string> values;
+        while (iss >> token) values.push_back(token);
+        if (key == "VERSION") {
+            if (!values.empty()) header.version = values[0];
+        } else if (key == "FIELDS" || key == "COLUMNS") {
+            for (const std::string& name : values) {
+                PcdField f;
+                f.name = name;
+                header.fields.push_back(f);
+            }
+        } else if (key == "SIZE") {
+            sizes = values;
+        } else if (key == "TYPE") {
+            types = values;
+        } else if (key == "COUNT") {
+            counts = values;
+        } else if (key == "WIDTH") {
+            if (values.size() != 1 || !parseCount(values[0], header.width)) return false;
+        } else if (key == "HEIGHT") {
+            if (values.size() != 1 || !parseCount(values[0], header.height)) return false;
+        } else if (key == "POINTS") {
+            if (values.size() != 1 || !parseCount(values[0], header.points)) return false;
+            hasPoints = true;
+        } else if (key == "VIEWPOINT") {
+            header.viewpoint.clear();
+            for (const std::string& v : values) header.viewpoint += (header.viewpoint.empty() ? "" : " ") + v;
+        } else if (key == "DATA") {
+            if (values.size() != 1) return false;
+            if (!parsePcdEncoding(values[0], header.encoding)) return false;
+            header.dataOffset = pos;
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (header.dataOffset == 0 || header.fields.empty() || sizes.size() != header.fields.size() ||
+        types.size() != header.fields.size() || (!counts.empty() && counts.size() != header.fields.size())) {
+        return false;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < header.fields.size(); ++i) {
+        PcdField& f = header.fields[i];
+        uint64_t size = 0, count = 1;
+        if (!parseCount(sizes[i], size) || (size != 1 && size != 2 && size != 4 && size != 8)) return false;
+        if (types[i].size() != 1 || std::string("IUF").find(types[i][0]) == std::string::npos) return false;
+        if (types[i][0] == 'F' && size != 4 && size != 8) return false;
+        if (!counts.empty() && (!parseCount(counts[i], count) || count == 0 || count > 65536)) return false;
+        f.size = size;
+        f.type = types[i][0];
+        f.count = count;
+        f.offset = offset;
+        offset += size * count;
+    }
+    header.pointSize = offset;
+    if (!hasPoints) header.points = header.width * header.height;
+    return true;
+}
+
+const char* pcdEncodingName(PcdEncoding encoding) {
+    switch (encoding) {
+    case PcdEncoding::Ascii: return "ascii";
+    case PcdEncoding::BinaryCompressed: return "binary_compressed";
+    default: return "binary";
+    }
+}
+
+std::string formatPcdHeader(const PcdHeader& header) {
+    std::string names, sizes, types, counts;
+    for (const PcdField& f : header.fields) {
+        names += " " + f.name;
+        sizes += " " + std::to_string(f.size);
+        types += std::string(" ") + f.type;
+        counts += " " + std::to_string(f.count);
+    }
+    std::string points = std::to_string(header.points);
+    return "# .PCD v" + header.version + " - Point Cloud Data file format\n"
+           "VERSION " + header.version + "\n"
+           "FIELDS" + names + "\n"
+           "SIZE" + sizes + "\n"
+           "TYPE" + types + "\n"
+           "COUNT" + counts + "\n"
+           "WIDTH " + points + "\n"
+           "HEIGHT 1\n"
+           "VIEWPOINT " + header.viewpoint + "\n"
+           "POINTS " + points + "\n"
+           "DATA " + pcdEncodingName(header.encoding) + "\n";
+}
+
+// 把每个点的一个字段从 src 复制到 dst，两边的记录长度不同；字段长度为常数时编译器把循环展开成定长的读写
+template <size_t N>
+static void copyColumn(const char* src, size_t srcStride, char* dst, size_t dstStride, size_t count) {
+    for (size_t i = 0; i < count; ++i) memcpy(dst + i * dstStride, src + i * srcStride, N);
+}
+
+static void copyColumn(const char* src, size_t srcStride, char* dst, size_t dstStride, size_t count, size_t len) {
+    switch (len) {
+    case 1: copyColumn<1>(src, srcStride, dst, dstStride, count); break;
+    case 2: copyColumn<2>(src, srcStride, dst, dstStride, count); break;
+    case 4: copyColumn<4>(src, srcStride, dst, dstStride, count); break;
+    case 8: copyColumn<8>(src, srcStride, dst, dstStride, count); break;
+    case 12: copyColumn<12>(src, srcStride, dst, dstStride, count); break;
+    case 16: copyColumn<16>(src, srcStride, dst, dstStride, count); break;
+    default:
+        for (size_t i = 0; i < count; ++i) memcpy(dst + i * dstStride, src + i * srcStride, len);
+        break;
+    }
+}
+
+// binary_compressed 的数据：压缩后长度、原始长度（小端 32 位），随后是按字段转置（逐字段存放所有点）后的 LZF 压缩数据
+static bool loadCompressed(const char* data, size_t len, PcdCloud& cloud, std::string& error) {
+    const PcdHeader& header = cloud.header;
+    uint32_t storedLen = 0, rawLen = 0;
+    if (len - header.dataOffset < 8) {
+        error = "PCD 压缩数据不完整";
+        return false;
+    }
+    memcpy(&storedLen, data + header.dataOffset, 4);
+    memcpy(&rawLen, data + header.dataOffset + 4, 4);
+    if (storedLen > len - header.dataOffset - 8) {
+        error = "PCD 压缩数据不完整";
+        return false;
+    }
+    if (header.points > UINT32_MAX / header.pointSize || rawLen != header.points * header.pointSize) {
+        error = "PCD 压缩数据长度与点数不符";
+        return false;
+    }
+    std::string transposed(rawLen, '\0');
+    if (rawLen > 0 && lzfDecompress(data + header.dataOffset + 8, storedLen, &transposed[0], rawLen) != rawLen) {
+        error = "PCD 压缩数据损坏";
+        return false;
+    }
+    // 逐字段转回打包的点记录
+    cloud.count = header.points;
+    cloud.storage.resize(rawLen);
+    for (const PcdField& f : header.fields) {
+        size_t width = f.size * f.count;
+        copyColumn(transposed.data() + cloud.count * f.offset, width, &cloud.storage[f.offset], header.pointSize,
+                   cloud.count, width);
+    }
+    cloud.records = cloud.storage.data();
+    return true;
+}
+
+bool loadPcd(const char* data, size_t len, PcdCloud& cloud, std::string& error) {
+    if (!parsePcdHeader(data, len, cloud.header)) {
+        error = "PCD 头部格式错误";
+        return false;
+    }
+    if (cloud.header.encoding == PcdEncoding::BinaryCompressed && cloud.header.pointSize > 0) {
+        return loadCompressed(data, len, cloud, error);
+    }
+    if (cloud.header.encoding != PcdEncoding::Binary) {
+        error = "只支持 DATA binary 和 binary_compressed 格式的点云";
+        return false;
+    }
+    // 被截短的文件只取完整的点
+    size_t available = (len - cloud.header.dataOffset) / cloud.header.pointSize;
+    cloud.count = std::min<uint64_t>(cloud.header.points, available);
+    cloud.records = data + cloud.header.dataOffset;
+    cloud.storage.clear();
+    return true;
+}
+
+// 原文件的头部文本，只把最后的 DATA 行换成 encoding
+static std::string replaceData(const char* data, const PcdHeader& header, PcdEncoding encoding) {
+    size_t lineStart = header.dataOffset - 1;
+    while (lineStart > 0 && data[lineStart - 1] != '\n') --lineStart;
+    return std::string(data, lineStart) + "DATA " + pcdEncodingName(encoding) + "\n";
+}
+
+bool compressPcd(const char* data, size_t len, std::string& out) {
+    PcdHeader header;
+    if (!parsePcdHeader(data, len, header) || header.encoding != PcdEncoding::Binary || header.pointSize == 0 ||
+        header.points == 0 || header.points > UINT32_MAX / header.pointSize ||
+        len - header.dataOffset != header.points * header.pointSize) {
+        return false;
+    }
+    // 按字段转置：同一字段的值排在一起，相邻点的坐标、强度等相近，LZF 更容易找到重复
+    size_t rawLen = len - header.dataOffset;
+    const char* records = data + header.dataOffset;
+    std::string transposed(rawLen, '\0');
+    for (const PcdField& f : header.fields) {
+        size_t width = f.size * f.count;
+        copyColumn(records + f.offset, header.pointSize, &transposed[header.points * f.offset], width, header.points,
+                   width);
+    }
+    std::string head = replaceData(data, header, PcdEncoding::BinaryCompressed);
+    // 压缩后不比原文件小时放弃
+    if (head.size() + 8 >= len) return false;
+    out.assign(len, '\0');
+    size_t storedLen = lzfCompress(transposed.data(), rawLen, &out[head.size() + 8], len - head.size() - 8);
+    if (storedLen == 0) return false;
+    memcpy(&out[0], head.data(), head.size());
+    uint32_t lens[2] = {static_cast<uint32_t>(storedLen), static_cast<uint32_t>(rawLen)};
+    memcpy(&out[head.size()], lens, 8);
+    out.resize(head.size() + 8 + storedLen);
+    return true;
+}
+
+std::string savePcd(const PcdCloud& cloud) {
+    PcdHeader header = cloud.header;
+    header.points = cloud.count;
+    header.encoding = PcdEncoding::Binary;
+    std::string out = formatPcdHeader(header);
+    out.append(cloud.records, cloud.count * header.pointSize);
+    return out;
+}
+
+// 按字段类型从打包记录中逐点取出第一个分量，每种类型一个紧凑的循环
+template <typename T>
+static void gather(const char* src, size_t stride, size_t count, float* out) {
+    for (size_t i = 0; i < count; ++i) {
+        T v;
+        memcpy(&v, src + i * stride, sizeof(T));
+        out[i] = static_cast<float>(v);
+    }
+}
+
+void readColumn(const PcdCloud& cloud, const PcdField& field, float* out) {
+    const char* src = cloud.records + field.offset;
+    size_t stride = cloud.header.pointSize;
+    size_t n = cloud.count;
+    switch (field.type) {
+    case 'F':
+        if (field.size == 4) gather<float>(src, stride, n, out);
+        else gather<double>(src, stride, n, out);
+        break;
+    case 'I':
+        if (field.size == 1) gather<int8_t>(src, stride, n, out);
+        else if (field.size == 2) gather<int16_t>(src, stride, n, out);
+        else if (field.size == 4) gather<int32_t>(src, stride, n, out);
+        else gather<int64_t>(src, stride, n, out);
+        break;
+    default:
+        if (field.size == 1) gather<uint8_t>(src, stride, n, out);
+        else if (field.size == 2) gather<uint16_t>(src, stride, n, out);
+        else if (field.size == 4) gather<uint32_t>(src, stride, n, out);
+        else gather<uint64_t>(src, stride, n, out);
+        break;
+    }
+}
+
+// 把浮点值按字段类型写回记录
+static void writeFloat(char* record, const PcdField& field, double value) {
+    if (field.size == 4) {
+        float v = static_cast<float>(value);
+        memcpy(record + field.offset, &v, sizeof(v));
+    } else {
+        memcpy(record + field.offset, &value, sizeof(value));
+    }
+}
+
+bool voxelDownsample(PcdCloud& cloud, float leaf, std::string& error) {
+    const PcdHeader& header = cloud.header;
+    int ix = header.field("x"), iy = header.field("y"), iz = header.field("z");
+    if (ix < 0 || iy < 0 || iz < 0 || header.fields[ix].type != 'F' || header.fields[iy].type != 'F' ||
+        header.fields[iz].type != 'F') {
+        error = "点云缺少浮点坐标字段 x y z";
+        return false;
+    }
+    size_t n = cloud.count;
+    std::vector<float> xs(n), ys(n), zs(n);
+    readColumn(cloud, header.fields[ix], xs.data());
+    readColumn(cloud, header.fields[iy], ys.data());
+    readColumn(cloud, header.fields[iz], zs.data());
+
+    // 有效点的坐标范围：无效点换成不影响结果的值，最值循环里没有分支
+    std::vector<uint8_t> valid(n);
+    for (size_t i = 0; i < n; ++i) {
+        valid[i] = std::isfinite(xs[i]) & std::isfinite(ys[i]) & std::isfinite(zs[i]);
+    }
+    float lo0 = INFINITY, lo1 = INFINITY, lo2 = INFINITY;
+    float hi0 = -INFINITY, hi1 = -INFINITY, hi2 = -INFINITY;
+    for (size_t i = 0; i < n; ++i) {
+        float x = valid[i] ? xs[i] : lo0, y = valid[i] ? ys[i] : lo1, z = valid[i] ? zs[i] : lo2;
+        lo0 = std::min(lo0, x); lo1 = std::min(lo1, y); lo2 = std::min(lo2, z);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        float x = valid[i] ? xs[i] : hi0, y = valid[i] ? ys[i] : hi1, z = valid[i] ? zs[i] : hi2;
+        hi0 = std::max(hi0, x); hi1 = std::max(hi1, y); hi2 = std::max(hi2, z);
+    }
+    const float lo[3] = {lo0, lo1, lo2};
+    const float hi[3] = {hi0, hi1, hi2};
+    for (int a = 0; a < 3 && lo[0] <= hi[0]; ++a) {
+        if ((static_cast<double>(hi[a]) - lo[a]) / leaf > static_cast<double>(VOXEL_AXIS_MAX)) {
+            error = "体素边长相对点云范围过小";
+            return false;
+        }
+    }
+
+    // 每个有效点的体素键（三个轴的体素下标拼成一个整数），按 (键, 下标) 排序后同一体素的点相邻
+    const float inv = 1.0f / leaf;
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    keys.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (!valid[i]) continue;
+        uint64_t kx = static_cast<uint64_t>((xs[i] - lo[0]) * inv);
+        uint64_t ky = static_cast<uint64_t>((ys[i] - lo[1]) * inv);
+        uint64_t kz = static_cast<uint64_t>((zs[i] - lo[2]) * inv);
+        kx = std::min(kx, VOXEL_AXIS_MAX);
+        ky = std::min(ky, VOXEL_AXIS_MAX);
+        kz = std::min(kz, VOXEL_AXIS_MAX);
+        keys.emplace_back((kx << (2 * VOXEL_BITS)) | (ky << VOXEL_BITS) | kz, static_cast<uint32_t>(i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // 每个体素：第一个点的下标和质心，按第一个点的下标输出以保持原来的扫描顺序
+    struct Voxel {
+        uint32_t first;
+        double x, y, z;
+    };
+    std::vector<Voxel> voxels;
+    for (size_t b = 0; b < keys.size();) {
+        size_t e = b;
+        double sx = 0, sy = 0, sz = 0;
+        for (; e < keys.size() && keys[e].first == keys[b].first; ++e) {
+            uint32_t i = keys[e].second;
+            sx += xs[i];
+            sy += ys[i];
+            sz += zs[i];
+        }
+        double c = static_cast<double>(e - b);
+        voxels.push_back({keys[b].second, sx / c, sy / c, sz / c});
+        b = e;
+    }
+    std::sort(voxels.begin(), voxels.end(), [](const Voxel& a, const Voxel& b) { return a.first < b.first; });
+
+    size_t pointSize = header.pointSize;
+    std::string storage(voxels.size() * pointSize, '\0');
+    for (size_t v = 0; v < voxels.size(); ++v) {
+        char* record = &storage[v * pointSize];
+        memcpy(record, cloud.records + static_cast<size_t>(voxels[v].first) * pointSize, pointSize);
+        writeFloat(record, header.fields[ix], voxels[v].x);
+        writeFloat(record, header.fields[iy], voxels[v].y);
+        writeFloat(record, header.fields[iz], voxels[v].z);
+    }
+    cloud.storage = std::move(storage);
+    cloud.records = cloud.storage.data();
+    cloud.count = voxels.size();
+    return true;
+}
+
+bool projectFields(PcdCloud& cloud, const std::vector<std::string>& names, std::string& error) {
+    const PcdHeader& header = cloud.header;
+    std::vector<PcdField> fields;
+    size_t offset = 0;
+    for (const std::string& name : names) {
+        int index = header.field(name);
+        if (index < 0) {
+            error = "点云没有字段 " + name;
+            return false;
+        }
+        for (const PcdField& f : fields) {
+            if (f.name == name) {
+                error = "字段重复: " + name;
+                return false;
+            }
+        }
+        PcdField f = header.fields[index];
+        f.offset = offset;
+        offset += f.size * f.count;
+        fields.push_back(f);
+    }
+
+    // 相邻且顺序不变的字段合并成一段一起复制
+    struct Span {
+        size_t src, dst, len;
+    };
+    std::vector<Span> spans;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        size_t src = header.fields[header.field(fields[i].name)].offset;
+        size_t len = fields[i].size * fields[i].count;
+        if (!spans.empty() && spans.back().src + spans.back().len == src) {
+            spans.back().len += len;
+        } else {
+            spans.push_back({src, fields[i].offset, len});
+        }
+    }
+
+    // 逐列复制：每一段对所有点做一次定长的跨步复制
+    std::string storage(cloud.count * offset, '\0');
+    for (const Span& span : spans) {
+        copyColumn(cloud.records + span.src, header.pointSize, &storage[span.dst], offset, cloud.count, span.len);
+    }
+    cloud.header.fields = std::move(fields);
+    cloud.header.pointSize = offset;
+    cloud.storage = std::move(storage);
+    cloud.records = cloud.storage.data();
+    return true;
+}
+
+bool PcdTransform::take(std::string& line) {
+    *this = PcdTransform();
+    std::string value;
+    if (takeOptionValue(line, "voxel", value)) {
+        char* end = nullptr;
+        voxel = std::strtof(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !std::isfinite(voxel) || voxel <= 0) {
+            voxel = 0;
+            return false;
+        }
+    }
+    if (takeOptionValue(line, "data", value)) {
+        if (value != "binary") return false;
+        binary = true;
+    }
+    if (takeOptionValue(line, "fields", value)) {
+        size_t begin = 0;
+        while (begin <= value.size()) {
+            size_t comma = std::min(value.find(',', begin), value.size());
+            fields.push_back(value.substr(begin, comma - begin));
+            if (fields.back().empty()) {
+                fields.clear();
+                return false;
+            }
+            begin = comma + 1;
+        }
+    }
+    return true;
+}
+
+bool applyTransform(PcdCloud& cloud, const PcdTransform& transform, std::string& error) {
+    if (cloud.count > UINT32_MAX) {
+        error = "点数过多";
+        return false;
+    }
+    if (transform.voxel > 0 && !voxelDownsample(cloud, transform.voxel, error)) return false;
+    if (!transform.fields.empty() && !projectFields(cloud, transform.fields, error)) return false;
+    return true;
+}
+
+bool transformPcd(const char* data, size_t len, const PcdTransform& transform, std::string& out,
+                  size_t& pointsIn, size_t& pointsOut, std::string& error) {
+    PcdCloud cloud;
+    if (!loadPcd(data, len, cloud, error)) return false;
+    pointsIn = pointsOut = cloud.count;
+    if (transform.voxel == 0 && transform.fields.empty() && cloud.count == cloud.header.points) {
+        // 只要求 DATA binary：保留原来的头部（WIDTH/HEIGHT 等），binary_compressed 存储的文件原样还原
+        out = replaceData(data, cloud.header, PcdEncoding::Binary);
+        out.append(cloud.records, cloud.count * cloud.header.pointSize);
+        return true;
+    }
+    if (!applyTransform(cloud, transform, error)) return false;
+    pointsOut = cloud.count;
+    out = savePcd(cloud);
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef PCD_H
+#define PCD_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief PCD 点云文件（Point Cloud Library 的 .pcd 格式）的解析与服务端处理
+ *
+ * 文件由文本头部（FIELDS/SIZE/TYPE/COUNT/WIDTH/HEIGHT/VIEWPOINT/POINTS/DATA）和点数据组成，
+ * DATA binary 的点数据是逐点打包的记录，每个点 pointSize 字节，各字段按 FIELDS 的顺序紧挨着存放。
+ * DATA binary_compressed 的点数据先按字段转置（逐字段存放所有点的值）再整体 LZF 压缩，读入时解压并转回打包的记录。
+ * 服务端按下载命令中的选项处理点云（PcdTransform），处理结果仍是合法的 DATA binary 文件。
+ * 坐标等需要计算的字段先从打包记录中按列取出（结构数组），计算循环只访问连续的 float 数组，
+ * 编译器可以向量化；其余字段只在输出时整条记录复制。
+ */
+
+constexpr size_t PCD_MAX_SIZE = 256 * 1024 * 1024;  // 服务端处理的点云文件的最大大小
+
+enum class PcdEncoding { Ascii, Binary, BinaryCompressed };
+
+struct PcdField {
+    std::string name;
+    size_t size = 4;    // 每个分量的字节数
+    char type = 'F';    // I 有符号整数、U 无符号整数、F 浮点
+    size_t count = 1;   // 分量个数
+    size_t offset = 0;  // 在点记录中的偏移
+};
+
+struct PcdHeader {
+    std::string version = "0.7";
+    std::vector<PcdField> fields;
+    uint64_t width = 0;
+    uint64_t height = 1;
+    uint64_t points = 0;
+    std::string viewpoint = "0 0 0 1 0 0 0";
+    PcdEncoding encoding = PcdEncoding::Binary;
+    size_t dataOffset = 0;  // 头部的长度，点数据从这里开始
+    size_t pointSize = 0;   // 每个点的记录长度
+
+    int field(const std::string& name) const;  // 字段的下标，没有时返回 -1
+};
+
+// 解析 data 开头的头部（到 DATA 行为止），头部不完整或不合法时返回 false
+bool parsePcdHeader(const char* data, size_t len, PcdHeader& header);
+// DATA 行中的编码名：ascii / binary / binary_compressed
+const char* pcdEncodingName(PcdEncoding encoding);
+bool parsePcdEncoding(const std::string& name, PcdEncoding& encoding);
+// 生成头部文本（以 DATA 行结束），WIDTH/POINTS 为 header.points，HEIGHT 为 1
+std::string formatPcdHeader(const PcdHeader& header);
+
+/**
+ * @brief 内存中的点云：头部 + 打包的点记录
+ *
+ * records 指向调用者提供的文件内容（只读）或 storage，处理步骤把结果放进 storage。
+ */
+struct PcdCloud {
+    PcdHeader header;
+    const char* records = nullptr;
+    size_t count = 0;
+    std::string storage;
+};
+
+// 解析整个文件的内容；被截短的 binary 文件只取完整的点。binary 文件的 records 指向 data 内部，
+// data 需要比 cloud 活得久；binary_compressed 文件解压到 storage
+bool loadPcd(const char* data, size_t len, PcdCloud& cloud, std::string& error);
+// 生成 DATA binary 格式的完整文件
+std::string savePcd(const PcdCloud& cloud);
+// 把完整的 DATA binary 文件转成 binary_compressed（头部只换 DATA 行），不是这种文件或压缩后没有变小时返回 false
+bool compressPcd(const char* data, size_t len, std::string& out);
+
+// 取出一个数值字段（第一个分量）的整列并转换为 float
+void readColumn(const PcdCloud& cloud, const PcdField& field, float* out);
+
+/**
+ * @brief 体素网格降采样
+ *
+ * 把空间划分成边长为 leaf 的立方体，每个有点的立方体输出一个点：其中第一个点的记录，
+ * 坐标换成立方体内所有点的质心。坐标不是有限值的点被丢弃。
+ */
+bool voxelDownsample(PcdCloud& cloud, float leaf, std::string& error);
+
+/**
+ * @brief 字段投影：只保留 names 中的字段，按 names 的顺序重新打包成更短的记录
+ *
+ * 逐列复制而不是逐点挑字段：原记录中相邻且顺序不变的字段合并成一段，每段对所有点做一次
+ * 定长的跨步复制，循环里没有按字段的分支。
+ */
+bool projectFields(PcdCloud& cloud, const std::vector<std::string>& names, std::string& error);
+
+// 下载命令中的点云处理选项："voxel=<边长>"、"fields=<字段>,<字段>,..."、"data=binary"，先降采样再投影
+struct PcdTransform {
+    float voxel = 0;                  // 体素边长，0 表示不降采样
+    std::vector<std::string> fields;  // 保留的字段，空表示全部保留
+    bool binary = false;              // 以 DATA binary 发送（binary_compressed 存储的文件解压后发送）
+
+    bool active() const { return voxel > 0 || !fields.empty() || binary; }
+    // 解析命令行中的选项并去掉它们（没有的选项取默认值），选项的值不合法时返回 false
+    bool take(std::string& line);
+};
+
+// 按 transform 处理内存中的点云
+bool applyTransform(PcdCloud& cloud, const PcdTransform& transform, std::string& error);
+// 按 transform 处理整个文件的内容，结果为完整的 PCD 文件；pointsIn/pointsOut 为处理前后的点数
+bool transformPcd(const char* data, size_t len, const PcdTransform& transform, std::string& out,
+                  size_t& pointsIn, size_t& pointsOut, std::string& error);
+
+#endif // PCD_H
@@ -0,0 +1,297 @@
+#include "pcdcatalog.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const std::string CATALOG_PATH = "filedir/.pcdcatalog";
+
+static std::mutex catalogMutex;
+static std::map<std::string, PcdMeta> catalog;  // 文件名 -> 元数据，按文件名排序
+static int catalogFd = -1;                      // 以追加方式打开的目录文件
+
+bool isPcdName(const std::string& basename) {
+    return basename.size() > 4 && strcasecmp(basename.c_str() + basename.size() - 4, ".pcd") == 0;
+}
+
+bool PcdMeta::hasField(const std::string& field) const {
+    size_t pos = 0;
+    while (pos < layout.size()) {
+        size_t colon = layout.find(':', pos);
+        if (colon == std::string::npos) break;
+        if (layout.compare(pos, colon - pos, field) == 0) return true;
+        pos = layout.find(',', colon);
+        if (pos == std::string::npos) break;
+        ++pos;
+    }
+    return false;
+}
+
+void PcdSniffer::start(const std::string& basename, uint64_t offset) {
+    started = collecting = offset == 0 && isPcdName(basename);
+    buf.clear();
+}
+
+size_t PcdSniffer::want() const {
+    return collecting ? PCD_SNIFF_MAX - buf.size() : 0;
+}
+
+void PcdSniffer::feed(uint64_t offset, const char* data, size_t len) {
+    if (!wants(offset)) return;
+    buf.append(data, std::min(len, want()));
+    // 头部完整后再收下第一个点（取帧时间戳）就够了
+    PcdHeader header;
+    if (parsePcdHeader(buf.data(), buf.size(), header)) {
+        size_t need = header.dataOffset + (header.encoding == PcdEncoding::Binary ? header.pointSize : 0);
+        if (buf.size() >= need) collecting = false;
+    }
+    if (buf.size() >= PCD_SNIFF_MAX) collecting = false;
+}
+
+const std::string* PcdSniffer::prefix(uint64_t fileSize) const {
+    if (!started || (collecting && buf.size() < fileSize)) return nullptr;
+    return &buf;
+}
+
+bool PcdQuery::parse(std::istream& in) {
+    std::string token;
+    if (in >> token) pattern = token;
+    while (in >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos || eq + 1 == token.size()) return false;
+        std::string key = token.substr(0, eq), value = token.substr(eq + 1);
+        char* end = nullptr;
+        if (key == "field") {
+            fields.push_back(value);
+        } else if (key == "minpoints" || key == "maxpoints") {
+            uint64_t n = std::strtoull(value.c_str(), &end, 10);
+            if (*end != '\0' || value[0] == '-') return false;
+            (key == "minpoints" ? minPoints : maxPoints) = n;
+        } else if (key == "since" || key == "until") {
+            double t = std::strtod(value.c_str(), &end);
+            if (*end != '\0' || std::isnan(t)) return false;
+            (key == "since" ? since : until) = t;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 点记录中一个数值字段（第一个分量）的值
+static double fieldValue(const char* record, const PcdField& field) {
+    const char* p = record + field.offset;
+    union {
+        int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+        uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+        float f32; double f64;
+    } v;
+    memcpy(&v, p, field.size);
+    switch (field.type) {
+    case 'F': return field.size == 4 ? v.f32 : v.f64;
+    case 'I': return field.size == 1 ? v.i8 : field.size == 2 ? v.i16 : field.size == 4 ? v.i32 : (double)v.i64;
+    default: return field.size == 1 ? v.u8 : field.size == 2 ? v.u16 : field.size == 4 ? v.u32 : (double)v.u64;
+    }
+}
+
+// binary_compressed 文件要解压整个文件才能取出第一个点的字段值
+static bool firstCompressedValue(const std::string& basename, const struct stat& st, const PcdField& field, double& value) {
+    if ((uint64_t)st.st_size > PCD_MAX_SIZE) return false;
+    std::ifstream in("filedir/" + basename, std::ios::binary);
+    std::string content(st.st_size, '\0');
+    if (!in.read(&content[0], content.size())) return false;
+    PcdCloud cloud;
+    std::string error;
+    if (!loadPcd(content.data(), content.size(), cloud, error) || cloud.count == 0) return false;
+    value = fieldValue(cloud.records, field);
+    return true;
+}
+
+// 从文件开头的数据得到元数据，不是合法的点云时返回 false
+static bool describe(const std::string& basename, const std::string& head, const struct stat& st, PcdMeta& meta) {
+    PcdHeader header;
+    if (!parsePcdHeader(head.data(), head.size(), header)) return false;
+    meta.name = basename;
+    meta.size = st.st_size;
+    meta.mtimeSec = st.st_mtim.tv_sec;
+    meta.mtimeNsec = st.st_mtim.tv_nsec;
+    meta.width = header.width;
+    meta.height = header.height;
+    meta.encoding = header.encoding;
+    meta.points = header.points;
+    if (header.encoding == PcdEncoding::Binary && header.pointSize > 0) {
+        meta.points = std::min<uint64_t>(header.points, (meta.size - std::min<uint64_t>(meta.size, header.dataOffset)) / header.pointSize);
+    }
+    meta.layout.clear();
+    int stampField = -1;
+    for (size_t i = 0; i < header.fields.size(); ++i) {
+        const PcdField& f = header.fields[i];
+        if (!meta.layout.empty()) meta.layout += ",";
+        meta.layout += f.name + ":" + f.type + std::to_string(f.size);
+        if (f.count > 1) meta.layout += "*" + std::to_string(f.count);
+        std::string lower = f.name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if (stampField < 0 && lower.find("timestamp") != std::string::npos) stampField = i;
+    }
+    meta.stamp = meta.mtimeSec + meta.mtimeNsec / 1e9;
+    if (stampField >= 0 && header.encoding == PcdEncoding::Binary && meta.points > 0 &&
+        head.size() >= header.dataOffset + header.pointSize) {
+        double stamp = fieldValue(head.data() + header.dataOffset, header.fields[stampField]);
+        if (std::isfinite(stamp)) meta.stamp = stamp;
+    }
+    double stamp = 0;
+    if (stampField >= 0 && header.encoding == PcdEncoding::BinaryCompressed &&
+        firstCompressedValue(basename, st, header.fields[stampField], stamp) && std::isfinite(stamp)) {
+        meta.stamp = stamp;
+    }
+    return true;
+}
+
+static bool readHead(const std::string& path, std::string& head, struct stat& st) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok) {
+        head.resize(std::min<uint64_t>(st.st_size, PCD_SNIFF_MAX));
+        ssize_t n = pread(fd, &head[0], head.size(), 0);
+        ok = n >= 0;
+        head.resize(ok ? n : 0);
+    }
+    close(fd);
+    return ok;
+}
+
+static std::string catalogLine(const PcdMeta& m) {
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "%.6f", m.stamp);
+    return "+ " + m.name + " " + std::to_string(m.size) + " " + std::to_string(m.mtimeSec) + " " +
+           std::to_string(m.mtimeNsec) + " " + std::to_string(m.points) + " " + std::to_string(m.width) + " " +
+           std::to_string(m.height) + " " + pcdEncodingName(m.encoding) + " " + stamp + " " + m.layout + "\n";
+}
+
+static bool parseCatalogLine(const std::string& line, PcdMeta& meta, bool& removed) {
+    std::istringstream iss(line);
+    std::string op, encoding;
+    if (!(iss >> op >> meta.name)) return false;
+    removed = op == "-";
+    if (removed) return true;
+    return op == "+" && (iss >> meta.size >> meta.mtimeSec >> meta.mtimeNsec >> meta.points >> meta.width >> meta.height >>
+                         encoding >> meta.stamp >> meta.layout) &&
+           parsePcdEncoding(encoding, meta.encoding);
+}
+
+static void appendLine(const std::string& line) {
+    if (catalogFd < 0) return;
+    if (write(catalogFd, line.data(), line.size()) != (ssize_t)line.size()) {
+        std::cerr << "写入点云目录失败: " << strerror(errno) << std::endl;
+    }
+}
+
+bool loadPcdCatalog() {
+    std::map<std::string, PcdMeta> entries;
+    {
+        std::ifstream in(CATALOG_PATH);
+        std::string line;
+        while (std::getline(in, line)) {
+            PcdMeta meta;
+            bool removed = false;
+            if (!parseCatalogLine(line, meta, removed)) continue;
+            if (removed) {
+                entries.erase(meta.name);
+            } else {
+                entries[meta.name] = meta;
+            }
+        }
+    }
+    // 只保留与文件现状一致的记录
+    for (auto it = entries.begin(); it != entries.end();) {
+        struct stat st{};
+        bool fresh = stat(("filedir/" + it->first).c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+                     (uint64_t)st.st_size == it->second.size && st.st_mtim.tv_sec == it->second.mtimeSec &&
+                     st.st_mtim.tv_nsec == it->second.mtimeNsec;
+        it = fresh ? std::next(it) : entries.erase(it);
+    }
+    // 补上还没有记录的点云文件
+    if (DIR* dir = opendir("filedir")) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name[0] == '.' || !isPcdName(name) || entries.count(name)) continue;
+            std::string head;
+            struct stat st{};
+            PcdMeta meta;
+            if (readHead("filedir/" + name, head, st) && describe(name, head, st, meta)) entries[name] = meta;
+        }
+        closedir(dir);
+    }
+
+    // 重写为每个文件一行，之后的更新追加在末尾
+    std::string tmp = CATALOG_PATH + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (const auto& kv : entries) out << catalogLine(kv.second);
+        if (!out.flush()) return false;
+    }
+    if (std::rename(tmp.c_str(), CATALOG_PATH.c_str()) != 0) return false;
+    catalogFd = open(CATALOG_PATH.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (catalogFd < 0) return false;
+    std::lock_guard<std::mutex> lock(catalogMutex);
+    catalog = std::move(entries);
+    std::cout << "点云目录: " << catalog.size() << " 个文件" << std::endl;
+    return true;
+}
+
+void recordPcdFile(const std::string& basename, const std::string* prefix) {
+    if (!isPcdName(basename)) return;
+    std::string path = "filedir/" + basename;
+    std::string head;
+    struct stat st{};
+    PcdMeta meta;
+    bool valid;
+    if (prefix) {
+        valid = stat(path.c_str(), &st) == 0 && describe(basename, *prefix, st, meta);
+    } else {
+        valid = readHead(path, head, st) && describe(basename, head, st, meta);
+    }
+    std::lock_guard<std::mutex> lock(catalogMutex);
+    if (valid) {
+        catalog[basename] = meta;
+        appendLine(catalogLine(meta));
+    } else if (catalog.erase(basename) > 0) {
+        appendLine("- " + basename + "\n");
+    }
+}
+
+std::vector<PcdMeta> findPcdFiles(const PcdQuery& query) {
+    std::vector<PcdMeta> found;
+    std::lock_guard<std::mutex> lock(catalogMutex);
+    for (const auto& kv : catalog) {
+        const PcdMeta& m = kv.second;
+        if (m.points < query.minPoints || m.points > query.maxPoints || m.stamp < query.since ||
+            m.stamp > query.until || fnmatch(query.pattern.c_str(), m.name.c_str(), 0) != 0) {
+            continue;
+        }
+        bool all = true;
+        for (const std::string& f : query.fields) all = all && m.hasField(f);
+        if (all) found.push_back(m);
+    }
+    return found;
+}
+
+std::string formatPcdMeta(const PcdMeta& m) {
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "%.6f", m.stamp);
+    return m.name + " " + std::to_string(m.size) + " " + std::to_string(m.points) + " " + std::to_string(m.width) + " " +
+           std::to_string(m.height) + " " + pcdEncodingName(m.encoding) + " " + stamp + " " + m.layout + "\n";
+}
@@ -0,0 +1,93 @@
+#ifndef PCDCATALOG_H
+#define PCDCATALOG_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "pcd.h"
+
+/**
+ * @brief 点云文件的元数据目录
+ *
+ * 上传 .pcd 文件时，连接在数据经过时截取文件开头的头部和第一个点（PcdSniffer），
+ * 文件存入 filedir/ 后由 recordPcdFile 解析出点数、字段、编码和帧时间戳，记入内存中的目录，
+ * 同时追加一行到 filedir/.pcdcatalog。没有截取到开头的上传（分块上传、续传、增量上传、秒传）
+ * 在存入后读一次文件开头。FIND 查询只扫描内存中的目录，不访问任何文件。
+ *
+ * 帧时间戳取第一个点的时间戳字段（字段名含 timestamp，不区分大小写，按秒计），
+ * 没有这个字段时为文件的修改时间（即上传时间）；binary_compressed 文件要解压整个文件才能取得。
+ * 服务端启动时 loadPcdCatalog 重放目录文件，丢弃大小或修改时间已经对不上的记录，
+ * 补上还没有记录的 .pcd 文件，然后把目录文件重写为每个文件一行。
+ */
+
+// 一个点云文件的元数据
+struct PcdMeta {
+    std::string name;
+    uint64_t size = 0;
+    int64_t mtimeSec = 0;
+    int64_t mtimeNsec = 0;
+    uint64_t points = 0;  // 文件中完整的点数（被截短的 binary 文件按实际长度计算）
+    uint64_t width = 0;
+    uint64_t height = 0;
+    PcdEncoding encoding = PcdEncoding::Binary;
+    double stamp = 0;     // 帧时间戳（秒）
+    std::string layout;   // 字段布局，如 "x:F4,y:F4,z:F4,Intensity:U1"，分量多于一个时为 "normal:F4*3"
+
+    bool hasField(const std::string& field) const;
+};
+
+/**
+ * @brief 上传时截取 .pcd 文件开头的数据
+ *
+ * 只在从偏移 0 开始接收的 .pcd 上传中工作，收集到完整的头部和第一个点，
+ * 或者收集了 PCD_SNIFF_MAX 字节还不是合法的头部时停止。
+ */
+class PcdSniffer {
+public:
+    void start(const std::string& basename, uint64_t offset);
+    // 从偏移 offset 开始的数据是否还需要，以及最多需要多少字节
+    bool wants(uint64_t offset) const { return collecting && offset == buf.size(); }
+    size_t want() const;
+    void feed(uint64_t offset, const char* data, size_t len);
+    // 文件（大小为 fileSize）开头的数据：收集完成或整个文件都收到时返回，否则返回 nullptr
+    const std::string* prefix(uint64_t fileSize) const;
+
+private:
+    bool started = false;
+    bool collecting = false;
+    std::string buf;
+};
+
+constexpr size_t PCD_SNIFF_MAX = 64 * 1024;
+
+// FIND 的查询条件："FIND <文件名模式> [minpoints=N] [maxpoints=N] [field=字段]... [since=秒] [until=秒]"
+struct PcdQuery {
+    std::string pattern = "*";  // shell 通配符
+    uint64_t minPoints = 0;
+    uint64_t maxPoints = UINT64_MAX;
+    std::vector<std::string> fields;  // 必须包含的字段
+    double since = -INFINITY;         // 帧时间戳的范围（含边界）
+    double until = INFINITY;
+
+    bool parse(std::istream& in);  // 解析命令行中 FIND 之后的部分，格式错误返回 false
+};
+
+// 文件名是否以 .pcd 结尾（不区分大小写），只有这些文件会被记入目录
+bool isPcdName(const std::string& basename);
+
+// 服务端启动时加载并整理目录文件
+bool loadPcdCatalog();
+
+// filedir/<basename> 刚被替换：按 prefix（为空时读文件开头）更新目录，不是合法点云时移除记录（磁盘线程中调用）
+void recordPcdFile(const std::string& basename, const std::string* prefix);
+
+// 查询目录，按文件名排序返回匹配的记录
+std::vector<PcdMeta> findPcdFiles(const PcdQuery& query);
+
+// FIND 响应中的一行："name size points width height encoding stamp layout\n"
+std::string formatPcdMeta(const PcdMeta& meta);
+
+#endif // PCDCATALOG_H
@@ -0,0 +1,348 @@
+#include "pcdindex.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const std::string INDEX_DIR = "filedir/.pcdindex/";
+constexpr size_t HEADER_READ = 64 * 1024;     // 读取点云头部时最多读入的字节数
+constexpr size_t READ_GAP = 64 * 1024;        // 命中的点记录间隔不超过这个值时合并成一次读取
+constexpr size_t READ_MAX = 4 * 1024 * 1024;  // 一次读取的最大字节数
+constexpr uint32_t MAX_GRID = 4096;           // 网格每个方向的最大格数
+static const char INDEX_MAGIC[8] = {'P', 'C', 'D', 'I', 'D', 'X', '1', '\0'};
+
+// 索引文件开头的固定部分，之后依次是 cells + 1 个格子起点、x/y/z 三列坐标和序号列
+struct IndexHeader {
+    char magic[8];
+    uint64_t fileSize;  // 建立索引时文件的大小、修改时间和 inode
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t inode;
+    uint64_t dataOffset;
+    uint64_t pointSize;
+    uint64_t points;    // 文件中完整的点数
+    uint64_t entries;   // 索引中的点数（坐标为有限值的点）
+    float origin[2];    // 网格左下角的 x/y
+    float cell;         // 格子边长
+    uint32_t dims[2];   // x/y 方向的格数
+    uint32_t reserved;
+};
+
+struct GridIndex {
+    IndexHeader header{};
+    std::vector<uint32_t> cellStart;  // 第 c 格的点在各列中的范围为 [cellStart[c], cellStart[c + 1])
+    std::vector<float> xs, ys, zs;
+    std::vector<uint32_t> ids;        // 点在文件中的序号
+
+    size_t cells() const { return size_t(header.dims[0]) * header.dims[1]; }
+};
+
+bool PcdBox::parse(std::istream& in) {
+    for (int i = 0; i < 6; ++i) {
+        std::string token;
+        if (!(in >> token)) return false;
+        char* end = nullptr;
+        float v = std::strtof(token.c_str(), &end);
+        if (*end != '\0' || !std::isfinite(v)) return false;
+        (i < 3 ? lo[i] : hi[i - 3]) = v;
+    }
+    std::string extra;
+    if (in >> extra) return false;
+    return lo[0] <= hi[0] && lo[1] <= hi[1] && lo[2] <= hi[2];
+}
+
+bool createPcdIndexDir() {
+    return mkdir(INDEX_DIR.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static bool readAt(int fd, void* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, static_cast<char*>(buf) + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, static_cast<const char*>(buf) + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// 索引是否是为当前这个文件建立的
+static bool matches(const IndexHeader& h, const struct stat& st, const PcdHeader& pcd) {
+    return memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && h.fileSize == (uint64_t)st.st_size &&
+           h.mtimeSec == st.st_mtim.tv_sec && h.mtimeNsec == st.st_mtim.tv_nsec && h.inode == st.st_ino &&
+           h.dataOffset == pcd.dataOffset && h.pointSize == pcd.pointSize;
+}
+
+static bool loadIndex(const std::string& path, const struct stat& st, const PcdHeader& pcd, GridIndex& index) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    IndexHeader& h = index.header;
+    struct stat ist{};
+    bool ok = fstat(fd, &ist) == 0 && readAt(fd, &h, sizeof(h), 0) && matches(h, st, pcd) && h.entries <= h.points &&
+              h.dims[0] >= 1 && h.dims[1] >= 1 && h.dims[0] <= MAX_GRID && h.dims[1] <= MAX_GRID &&
+              (uint64_t)ist.st_size == sizeof(h) + (index.cells() + 1) * 4 + h.entries * 16;
+    if (ok) {
+        size_t n = h.entries;
+        index.cellStart.resize(index.cells() + 1);
+        index.xs.resize(n);
+        index.ys.resize(n);
+        index.zs.resize(n);
+        index.ids.resize(n);
+        uint64_t off = sizeof(h);
+        ok = readAt(fd, index.cellStart.data(), index.cellStart.size() * 4, off);
+        off += index.cellStart.size() * 4;
+        ok = ok && readAt(fd, index.xs.data(), n * 4, off) && readAt(fd, index.ys.data(), n * 4, off + n * 4) &&
+             readAt(fd, index.zs.data(), n * 4, off + n * 8) && readAt(fd, index.ids.data(), n * 4, off + n * 12);
+        ok = ok && index.cellStart.front() == 0 && index.cellStart.back() == n &&
+             std::is_sorted(index.cellStart.begin(), index.cellStart.end());
+    }
+    close(fd);
+    return ok;
+}
+
+// 先写临时文件再改名，并发的查询不会读到写了一半的索引
+static bool saveIndex(const std::string& path, const GridIndex& index) {
+    std::string tmp = INDEX_DIR + ".tmpXXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) return false;
+    fchmod(fd, 0644);
+    size_t n = index.header.entries;
+    bool ok = writeAll(fd, &index.header, sizeof(index.header)) &&
+              writeAll(fd, index.cellStart.data(), index.cellStart.size() * 4) && writeAll(fd, index.xs.data(), n * 4) &&
+              writeAll(fd, index.ys.data(), n * 4) && writeAll(fd, index.zs.data(), n * 4) &&
+              writeAll(fd, index.ids.data(), n * 4);
+    ok = close(fd) == 0 && ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+}
+
+// 第 axis 个方向上坐标 v 所在的格子，网格之外的坐标归到边上的格子
+static uint32_t cellOf(const IndexHeader& h, int axis, float v) {
+    double t = std::floor((static_cast<double>(v) - h.origin[axis]) / h.cell);
+    return static_cast<uint32_t>(std::min<double>(std::max(t, 0.0), h.dims[axis] - 1));
+}
+
+// 读入整个文件，取出坐标后按格子做一次计数排序
+static bool buildIndex(int fd, const struct stat& st, GridIndex& index, std::string& error) {
+    if ((uint64_t)st.st_size > PCD_MAX_SIZE) {
+        error = "点云文件过大";
+        return false;
+    }
+    std::string content(st.st_size, '\0');
+    if (!readAt(fd, &content[0], content.size(), 0)) {
+        error = "读取文件失败";
+        return false;
+    }
+    PcdCloud cloud;
+    if (!loadPcd(content.data(), content.size(), cloud, error)) return false;
+    const PcdHeader& pcd = cloud.header;
+    int ix = pcd.field("x"), iy = pcd.field("y"), iz = pcd.field("z");
+    if (ix < 0 || iy < 0 || iz < 0) {
+        error = "点云缺少坐标字段 x y z";
+        return false;
+    }
+    if (cloud.count > UINT32_MAX) {
+        error = "点数过多";
+        return false;
+    }
+    size_t n = cloud.count;
+    std::vector<float> xs(n), ys(n), zs(n);
+    readColumn(cloud, pcd.fields[ix], xs.data());
+    readColumn(cloud, pcd.fields[iy], ys.data());
+    readColumn(cloud, pcd.fields[iz], zs.data());
+
+    std::vector<uint8_t> valid(n);
+    for (size_t i = 0; i < n; ++i) {
+        valid[i] = std::isfinite(xs[i]) && std::isfinite(ys[i]) && std::isfinite(zs[i]);
+    }
+    float lo[2] = {INFINITY, INFINITY};
+    float hi[2] = {-INFINITY, -INFINITY};
+    size_t entries = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!valid[i]) continue;
+        lo[0] = std::min(lo[0], xs[i]); hi[0] = std::max(hi[0], xs[i]);
+        lo[1] = std::min(lo[1], ys[i]); hi[1] = std::max(hi[1], ys[i]);
+        ++entries;
+    }
+
+    // 格子边长让平均每格约 PCD_INDEX_CELL_POINTS 个点；某个方向没有跨度时按另一个方向划分
+    IndexHeader& h = index.header;
+    memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.fileSize = st.st_size;
+    h.mtimeSec = st.st_mtim.tv_sec;
+    h.mtimeNsec = st.st_mtim.tv_nsec;
+    h.inode = st.st_ino;
+    h.dataOffset = pcd.dataOffset;
+    h.pointSize = pcd.pointSize;
+    h.points = n;
+    h.entries = entries;
+    h.origin[0] = entries > 0 ? lo[0] : 0;
+    h.origin[1] = entries > 0 ? lo[1] : 0;
+    double ex = entries > 0 ? static_cast<double>(hi[0]) - lo[0] : 0;
+    double ey = entries > 0 ? static_cast<double>(hi[1]) - lo[1] : 0;
+    double target = std::max<double>(1, entries / PCD_INDEX_CELL_POINTS);
+    double cell = ex > 0 && ey > 0 ? std::sqrt(ex * ey / target) : std::max(ex, ey) / target;
+    h.cell = cell > 0 && std::isfinite(cell) ? static_cast<float>(cell) : 1.0f;
+    h.dims[0] = static_cast<uint32_t>(std::min<double>(std::floor(ex / h.cell) + 1, MAX_GRID));
+    h.dims[1] = static_cast<uint32_t>(std::min<double>(std::floor(ey / h.cell) + 1, MAX_GRID));
+
+    // 计数排序：同一格子里的点保持文件中的顺序
+    std::vector<uint32_t> cellIds(n);
+    index.cellStart.assign(index.cells() + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        if (!valid[i]) continue;
+        cellIds[i] = cellOf(h, 1, ys[i]) * h.dims[0] + cellOf(h, 0, xs[i]);
+        ++index.cellStart[cellIds[i] + 1];
+    }
+    for (size_t c = 0; c < index.cells(); ++c) index.cellStart[c + 1] += index.cellStart[c];
+    std::vector<uint32_t> next(index.cellStart.begin(), index.cellStart.end() - 1);
+    index.xs.resize(entries);
+    index.ys.resize(entries);
+    index.zs.resize(entries);
+    index.ids.resize(entries);
+    for (size_t i = 0; i < n; ++i) {
+        if (!valid[i]) continue;
+        uint32_t slot = next[cellIds[i]]++;
+        index.xs[slot] = xs[i];
+        index.ys[slot] = ys[i];
+        index.zs[slot] = zs[i];
+        index.ids[slot] = static_cast<uint32_t>(i);
+    }
+    return true;
+}
+
+// 按文件中的顺序只读出命中的点记录，相距不远的记录合并成一次读取
+static bool readHits(int fd, const std::vector<uint32_t>& hits, PcdCloud& cloud, std::string& error) {
+    size_t pointSize = cloud.header.pointSize;
+    cloud.storage.resize(hits.size() * pointSize);
+    std::vector<char> buf;
+    for (size_t k = 0; k < hits.size();) {
+        size_t j = k;
+        while (j + 1 < hits.size() && (hits[j + 1] - hits[j]) * pointSize <= READ_GAP &&
+               (size_t(hits[j + 1]) - hits[k] + 1) * pointSize <= READ_MAX) {
+            ++j;
+        }
+        size_t len = (size_t(hits[j]) - hits[k] + 1) * pointSize;
+        buf.resize(len);
+        if (!readAt(fd, buf.data(), len, cloud.header.dataOffset + size_t(hits[k]) * pointSize)) {
+            error = "读取文件失败";
+            return false;
+        }
+        for (size_t t = k; t <= j; ++t) {
+            memcpy(&cloud.storage[t * pointSize], buf.data() + size_t(hits[t] - hits[k]) * pointSize, pointSize);
+        }
+        k = j + 1;
+    }
+    return true;
+}
+
+static bool copyHits(int fd, const struct stat& st, const std::vector<uint32_t>& hits, PcdCloud& cloud,
+                     std::string& error) {
+    if ((uint64_t)st.st_size > PCD_MAX_SIZE) {
+        error = "点云文件过大";
+        return false;
+    }
+    std::string content(st.st_size, '\0');
+    if (!readAt(fd, &content[0], content.size(), 0)) {
+        error = "读取文件失败";
+        return false;
+    }
+    PcdCloud whole;
+    if (!loadPcd(content.data(), content.size(), whole, error)) return false;
+    size_t pointSize = cloud.header.pointSize;
+    cloud.storage.resize(hits.size() * pointSize);
+    for (size_t t = 0; t < hits.size(); ++t) {
+        memcpy(&cloud.storage[t * pointSize], whole.records + size_t(hits[t]) * pointSize, pointSize);
+    }
+    return true;
+}
+
+bool queryPcdBox(const std::string& basename, const PcdBox& box, const PcdTransform& transform, std::string& out,
+                 size_t& pointsIn, size_t& pointsOut, bool& built, std::string& error) {
+    built = false;
+    int fd = open(("filedir/" + basename).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        error = "文件不存在";
+        return false;
+    }
+    std::string head(std::min<uint64_t>(st.st_size, HEADER_READ), '\0');
+    PcdCloud cloud;
+    if (!readAt(fd, &head[0], head.size(), 0) || !parsePcdHeader(head.data(), head.size(), cloud.header)) {
+        close(fd);
+        error = "PCD 头部格式错误";
+        return false;
+    }
+    if (cloud.header.encoding != PcdEncoding::Binary && cloud.header.encoding != PcdEncoding::BinaryCompressed) {
+        close(fd);
+        error = "只支持 DATA binary 和 binary_compressed 格式的点云";
+        return false;
+    }
+
+    GridIndex index;
+    std::string path = INDEX_DIR + basename;
+    if (!loadIndex(path, st, cloud.header, index)) {
+        index = GridIndex();
+        if (!buildIndex(fd, st, index, error)) {
+            close(fd);
+            return false;
+        }
+        built = true;
+        if (!saveIndex(path, index)) std::cerr << "保存点云索引失败: " << basename << ": " << strerror(errno) << std::endl;
+    }
+    pointsIn = index.header.points;
+
+    // 扫描与长方体相交的格子：同一行相邻的格子在各列中是连续的一段，逐点比较不分支
+    const IndexHeader& h = index.header;
+    std::vector<uint32_t> hits;
+    if (h.entries > 0) {
+        uint32_t cx0 = cellOf(h, 0, box.lo[0]), cx1 = cellOf(h, 0, box.hi[0]);
+        uint32_t cy0 = cellOf(h, 1, box.lo[1]), cy1 = cellOf(h, 1, box.hi[1]);
+        for (uint32_t cy = cy0; cy <= cy1; ++cy) {
+            uint32_t b = index.cellStart[cy * h.dims[0] + cx0];
+            uint32_t e = index.cellStart[cy * h.dims[0] + cx1 + 1];
+            size_t n = hits.size();
+            hits.resize(n + (e - b));
+            for (uint32_t i = b; i < e; ++i) {
+                bool inside = (index.xs[i] >= box.lo[0]) & (index.xs[i] <= box.hi[0]) &
+                              (index.ys[i] >= box.lo[1]) & (index.ys[i] <= box.hi[1]) &
+                              (index.zs[i] >= box.lo[2]) & (index.zs[i] <= box.hi[2]);
+                hits[n] = index.ids[i];
+                n += inside;
+            }
+            hits.resize(n);
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+
+    // binary_compressed 文件无法只读出命中的记录，解压整个文件后挑出
+    bool read = cloud.header.encoding == PcdEncoding::Binary ? readHits(fd, hits, cloud, error)
+                                                             : copyHits(fd, st, hits, cloud, error);
+    close(fd);
+    if (!read) return false;
+    cloud.records = cloud.storage.data();
+    cloud.count = hits.size();
+    if (!applyTransform(cloud, transform, error)) return false;
+    pointsOut = cloud.count;
+    out = savePcd(cloud);
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef PCDINDEX_H
+#define PCDINDEX_H
+
+#include <string>
+#include <istream>
+#include <cstddef>
+#include "pcd.h"
+
+/**
+ * @brief 点云文件的空间索引和按范围查询
+ *
+ * 客户端发送 "BOX name minx miny minz maxx maxy maxz\n"（可以再带 voxel=/fields=/crc32c 选项），
+ * 服务端只返回坐标落在这个轴对齐长方体内（含边界）的点，结果是一个合法的 PCD 文件，响应与下载相同。
+ *
+ * 索引是按 x/y 划分的二维均匀网格（激光雷达帧在 z 方向很扁，二维网格的格子更均匀），
+ * 平均每格约 PCD_INDEX_CELL_POINTS 个点。索引按格子顺序保存每个点的坐标（结构数组）
+ * 和它在文件中的序号，查询时只扫描与长方体相交的格子，z 和格子边界上的点逐个比较，
+ * 然后按序号只读出命中的点记录，不需要读入整个文件（binary_compressed 文件只能解压整个文件后挑出）。
+ * 索引在第一次查询时建立，保存在 filedir/.pcdindex/<文件名>，记录文件的大小、修改时间和
+ * inode；文件被替换或修改后这些值对不上，下一次查询时重建。
+ * 以下函数会读写磁盘，在磁盘线程中调用。
+ */
+
+constexpr size_t PCD_INDEX_CELL_POINTS = 16;
+
+// 查询的长方体
+struct PcdBox {
+    float lo[3] = {0, 0, 0};
+    float hi[3] = {0, 0, 0};
+
+    bool parse(std::istream& in);  // 解析命令行中文件名之后的六个数，格式错误或 min > max 返回 false
+};
+
+// 创建索引目录（服务端启动时调用）
+bool createPcdIndexDir();
+
+/**
+ * @brief 查询 filedir/<basename> 中落在 box 内的点，按 transform 处理后生成完整的 PCD 文件
+ *
+ * pointsIn 为文件中的点数，pointsOut 为输出的点数，built 表示本次查询新建了索引。
+ */
+bool queryPcdBox(const std::string& basename, const PcdBox& box, const PcdTransform& transform, std::string& out,
+                 size_t& pointsIn, size_t& pointsOut, bool& built, std::string& error);
+
+#endif // PCDINDEX_H
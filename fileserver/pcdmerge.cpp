@@ -0,0 +1,206 @@
+#include "pcdmerge.h"
+#include "pcdcatalog.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+bool PcdMergeRequest::parse(std::istream& in) {
+    if (!(in >> pattern)) return false;
+    std::string token;
+    while (in >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos || eq + 1 == token.size()) return false;
+        std::string key = token.substr(0, eq), value = token.substr(eq + 1);
+        if (key != "first" && key != "last") return false;
+        char* end = nullptr;
+        uint64_t n = std::strtoull(value.c_str(), &end, 10);
+        if (*end != '\0' || value[0] == '-') return false;
+        (key == "first" ? first : last) = n;
+        ranged = true;
+    }
+    return first <= last;
+}
+
+// 帧号：扩展名之前最后一段数字，没有时返回 false
+static bool frameNumber(const std::string& name, uint64_t& number) {
+    size_t end = name.find_last_of('.');
+    if (end == std::string::npos) end = name.size();
+    size_t digitsEnd = end;
+    while (digitsEnd > 0 && !isdigit(static_cast<unsigned char>(name[digitsEnd - 1]))) --digitsEnd;
+    size_t begin = digitsEnd;
+    while (begin > 0 && isdigit(static_cast<unsigned char>(name[begin - 1]))) --begin;
+    if (begin == digitsEnd) return false;
+    number = std::strtoull(name.substr(begin, digitsEnd - begin).c_str(), nullptr, 10);
+    return true;
+}
+
+// 两个头部的点记录布局完全相同
+static bool sameLayout(const PcdHeader& a, const PcdHeader& b) {
+    if (a.pointSize != b.pointSize || a.fields.size() != b.fields.size()) return false;
+    for (size_t i = 0; i < a.fields.size(); ++i) {
+        const PcdField& f = a.fields[i];
+        const PcdField& g = b.fields[i];
+        if (f.name != g.name || f.size != g.size || f.type != g.type || f.count != g.count) return false;
+    }
+    return true;
+}
+
+static bool readAt(int fd, char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// 读出一帧的头部，检查它能否并入合并结果（第一帧决定合并后的字段）
+static bool planFrame(PcdMergePlan& plan, PcdMergeFrame& frame, std::string& error) {
+    int fd = open(("filedir/" + frame.name).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        error = "帧 " + frame.name + " 不存在";
+        return false;
+    }
+    std::string head(std::min<uint64_t>(st.st_size, PCD_SNIFF_MAX), '\0');
+    bool read = readAt(fd, &head[0], head.size(), 0);
+    close(fd);
+    PcdHeader header;
+    if (!read || !parsePcdHeader(head.data(), head.size(), header)) {
+        error = "帧 " + frame.name + " 头部格式错误";
+        return false;
+    }
+    if (header.encoding != PcdEncoding::Binary && header.encoding != PcdEncoding::BinaryCompressed) {
+        error = "帧 " + frame.name + " 不是 binary 或 binary_compressed 格式";
+        return false;
+    }
+    if (plan.frames.empty()) {
+        plan.header.version = header.version;
+        plan.header.viewpoint = header.viewpoint;
+        plan.header.fields = header.fields;
+        plan.header.pointSize = header.pointSize;
+    }
+    for (const PcdField& f : plan.header.fields) {
+        int i = header.field(f.name);
+        if (i < 0) {
+            error = "帧 " + frame.name + " 缺少字段 " + f.name;
+            return false;
+        }
+        const PcdField& g = header.fields[i];
+        if (g.size != f.size || g.type != f.type || g.count != f.count) {
+            error = "帧 " + frame.name + " 的字段 " + f.name + " 类型不一致";
+            return false;
+        }
+    }
+    frame.size = st.st_size;
+    frame.mtimeSec = st.st_mtim.tv_sec;
+    frame.mtimeNsec = st.st_mtim.tv_nsec;
+    frame.inode = st.st_ino;
+    frame.dataOffset = header.dataOffset;
+    frame.direct = header.encoding == PcdEncoding::Binary && sameLayout(header, plan.header);
+    if (header.encoding == PcdEncoding::Binary) {
+        // 被截短的帧只取完整的点
+        frame.points = std::min<uint64_t>(header.points, (frame.size - std::min<uint64_t>(frame.size, header.dataOffset)) / header.pointSize);
+    } else {
+        frame.points = header.points;
+    }
+    if (!frame.direct && frame.size > PCD_MAX_SIZE) {
+        error = "帧 " + frame.name + " 过大";
+        return false;
+    }
+    return true;
+}
+
+bool planPcdMerge(const PcdMergeRequest& request, PcdMergePlan& plan, std::string& error) {
+    PcdQuery query;
+    query.pattern = request.pattern;
+    struct Candidate {
+        bool numbered;
+        uint64_t number;
+        std::string name;
+    };
+    std::vector<Candidate> candidates;
+    for (const PcdMeta& meta : findPcdFiles(query)) {
+        Candidate c{false, 0, meta.name};
+        c.numbered = frameNumber(meta.name, c.number);
+        if (request.ranged && (!c.numbered || c.number < request.first || c.number > request.last)) continue;
+        candidates.push_back(c);
+    }
+    if (candidates.empty()) {
+        error = "没有匹配的点云帧";
+        return false;
+    }
+    // 有帧号的按帧号排在前面，其余按文件名
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.numbered != b.numbered) return a.numbered;
+        if (a.number != b.number) return a.number < b.number;
+        return a.name < b.name;
+    });
+
+    plan = PcdMergePlan();
+    for (const Candidate& c : candidates) {
+        PcdMergeFrame frame;
+        frame.name = c.name;
+        if (!planFrame(plan, frame, error)) return false;
+        plan.header.points += frame.points;
+        plan.frames.push_back(frame);
+    }
+    plan.header.encoding = PcdEncoding::Binary;
+    plan.head = formatPcdHeader(plan.header);
+    plan.size = plan.head.size() + plan.header.points * plan.header.pointSize;
+    return true;
+}
+
+int openMergeFrame(const PcdMergeFrame& frame) {
+    int fd = open(("filedir/" + frame.name).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size != frame.size || st.st_mtim.tv_sec != frame.mtimeSec ||
+        st.st_mtim.tv_nsec != frame.mtimeNsec || st.st_ino != frame.inode) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool loadMergeFrame(const PcdMergePlan& plan, const PcdMergeFrame& frame, int fd, std::string& records,
+                    std::string& error) {
+    std::string content(frame.size, '\0');
+    if (!readAt(fd, &content[0], content.size(), 0)) {
+        error = "读取文件失败";
+        return false;
+    }
+    PcdCloud cloud;
+    if (!loadPcd(content.data(), content.size(), cloud, error)) return false;
+    if (cloud.count != frame.points) {
+        error = "点数与头部不符";
+        return false;
+    }
+    if (!sameLayout(cloud.header, plan.header)) {
+        std::vector<std::string> names;
+        for (const PcdField& f : plan.header.fields) names.push_back(f.name);
+        if (!projectFields(cloud, names, error)) return false;
+    }
+    records.assign(cloud.records, cloud.count * plan.header.pointSize);
+    return true;
+}
+
+void adviseMergeFrame(const PcdMergePlan& plan, const PcdMergeFrame& frame) {
+    int fd = open(("filedir/" + frame.name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    // 预读由内核异步完成，关闭文件后读入的页仍留在页缓存中
+    if (frame.direct) {
+        posix_fadvise(fd, frame.dataOffset, plan.bytes(frame), POSIX_FADV_WILLNEED);
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+}
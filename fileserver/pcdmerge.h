@@ -0,0 +1,73 @@
+#ifndef PCDMERGE_H
+#define PCDMERGE_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstdint>
+#include <cstddef>
+#include "pcd.h"
+
+/**
+ * @brief 点云帧序列的合并下载
+ *
+ * 客户端发送 "MERGE <文件名模式> [first=N] [last=N]\n"，服务端从点云目录（见 pcdcatalog.h）中
+ * 找出匹配的帧，按帧号（文件名中扩展名之前最后一段数字，如 ..._001_17.pcd 为 17）排序，
+ * first/last 限定帧号范围（含边界），响应为 "OK <size>\n" + 一个合并后的 DATA binary 文件，
+ * 字段为第一帧的字段，点按帧的顺序排列。
+ *
+ * 开始发送前在线程池中读出所有帧的头部（planPcdMerge），算出合并后的大小并检查字段：
+ * 每一帧都要有第一帧的全部字段且类型相同，否则返回错误。字段布局与合并结果相同的
+ * DATA binary 帧直接从文件发送点数据（sendfile 零拷贝）；binary_compressed 帧和字段顺序不同
+ * 或多出字段的帧在线程池中解压、重新打包后从内存发送。发送一帧时通知内核预读之后的
+ * PCD_MERGE_READAHEAD 帧的点数据，磁盘读取与发送重叠进行。
+ * 计划记录了每一帧的大小、修改时间和 inode，发送途中帧被替换时只能关闭连接。
+ */
+
+constexpr size_t PCD_MERGE_READAHEAD = 8;
+
+// MERGE 的参数
+struct PcdMergeRequest {
+    std::string pattern;  // shell 通配符
+    uint64_t first = 0;   // 帧号范围（含边界）
+    uint64_t last = UINT64_MAX;
+    bool ranged = false;  // 给出了 first 或 last，此时文件名中没有帧号的文件不参与合并
+
+    bool parse(std::istream& in);  // 解析命令行中 MERGE 之后的部分，格式错误返回 false
+};
+
+// 合并中的一帧
+struct PcdMergeFrame {
+    std::string name;
+    uint64_t size = 0;
+    int64_t mtimeSec = 0;
+    int64_t mtimeNsec = 0;
+    uint64_t inode = 0;
+    uint64_t dataOffset = 0;  // 点数据在文件中的偏移
+    uint64_t points = 0;      // 这一帧贡献的点数
+    bool direct = false;      // 点数据可以直接从文件发送
+};
+
+struct PcdMergePlan {
+    PcdHeader header;  // 合并后的头部
+    std::string head;  // 合并后的头部文本
+    std::vector<PcdMergeFrame> frames;
+    uint64_t size = 0;  // 合并后的文件大小
+
+    uint64_t bytes(const PcdMergeFrame& frame) const { return frame.points * header.pointSize; }
+};
+
+// 选出帧并读出头部，生成合并计划；没有匹配的帧或帧之间字段不兼容时返回 false（磁盘线程中调用）
+bool planPcdMerge(const PcdMergeRequest& request, PcdMergePlan& plan, std::string& error);
+
+// 打开一帧并确认它与计划时是同一个文件，失败返回 -1（磁盘线程中调用）
+int openMergeFrame(const PcdMergeFrame& frame);
+
+// 读出不能直接发送的一帧，转换成合并后的记录格式（磁盘线程中调用）
+bool loadMergeFrame(const PcdMergePlan& plan, const PcdMergeFrame& frame, int fd, std::string& records,
+                    std::string& error);
+
+// 通知内核预读一帧要用到的数据：直接发送的帧只预读点数据，其余的帧预读整个文件（磁盘线程中调用）
+void adviseMergeFrame(const PcdMergePlan& plan, const PcdMergeFrame& frame);
+
+#endif // PCDMERGE_H
@@ -0,0 +1,292 @@
+#include "pcdstats.h"
+#include "pcdcatalog.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const std::string STATS_DIR = "filedir/.pcdstats/";
+constexpr size_t STAT_BLOCK = 1024;  // 每批取成数组统计的点数
+static const char STATS_MAGIC[8] = {'P', 'C', 'D', 'S', 'T', 'A', 'T', '1'};
+
+// 统计文件：建立时文件的大小、修改时间和 inode，之后是 PcdStats
+struct StatsHeader {
+    char magic[8];
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t inode;
+};
+
+// 不区分大小写地查找字段
+static int findField(const PcdHeader& header, const char* name) {
+    for (size_t i = 0; i < header.fields.size(); ++i) {
+        if (strcasecmp(header.fields[i].name.c_str(), name) == 0) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void PcdStatsBuilder::start(const std::string& basename, uint64_t offset) {
+    streaming = offset == 0 && isPcdName(basename);
+    inRecords = false;
+    received = 0;
+    head.clear();
+    carry.clear();
+}
+
+void PcdStatsBuilder::begin(const PcdHeader& header) {
+    stats = PcdStats();
+    block = PcdCloud();
+    block.header = header;
+    fx = header.field("x");
+    fy = header.field("y");
+    fz = header.field("z");
+    fi = findField(header, "intensity");
+    fd = findField(header, "distance");
+    stats.hasIntensity = fi >= 0;
+    stats.hasDistance = fd >= 0 || (fx >= 0 && fy >= 0 && fz >= 0);
+    stats.lo[0] = stats.lo[1] = stats.lo[2] = INFINITY;
+    stats.hi[0] = stats.hi[1] = stats.hi[2] = -INFINITY;
+}
+
+// 值所在的直方图格子：负值归第一格，超出范围和无穷大归最后一格
+static inline size_t binOf(float v, float width) {
+    float t = v / width;
+    if (!(t >= 0)) return 0;
+    return t >= PCD_HISTOGRAM_BINS - 1 ? PCD_HISTOGRAM_BINS - 1 : static_cast<size_t>(t);
+}
+
+// 四份子直方图交替累加，相邻的点落在同一格时不会互相等待同一个计数器
+static void histogram(const float* values, const uint8_t* mask, size_t n, float width, uint64_t* out) {
+    uint32_t sub[4][PCD_HISTOGRAM_BINS] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sub[0][binOf(values[i], width)] += mask[i];
+        sub[1][binOf(values[i + 1], width)] += mask[i + 1];
+        sub[2][binOf(values[i + 2], width)] += mask[i + 2];
+        sub[3][binOf(values[i + 3], width)] += mask[i + 3];
+    }
+    for (; i < n; ++i) sub[0][binOf(values[i], width)] += mask[i];
+    for (size_t b = 0; b < PCD_HISTOGRAM_BINS; ++b) out[b] += sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+}
+
+void PcdStatsBuilder::accumulate(const char* records, size_t count) {
+    const PcdHeader& header = block.header;
+    float xs[STAT_BLOCK], ys[STAT_BLOCK], zs[STAT_BLOCK], vs[STAT_BLOCK];
+    uint8_t valid[STAT_BLOCK];
+    for (size_t done = 0; done < count; done += STAT_BLOCK) {
+        size_t n = std::min(STAT_BLOCK, count - done);
+        block.records = records + done * header.pointSize;
+        block.count = n;
+        stats.points += n;
+        bool hasXyz = fx >= 0 && fy >= 0 && fz >= 0;
+        if (hasXyz) {
+            readColumn(block, header.fields[fx], xs);
+            readColumn(block, header.fields[fy], ys);
+            readColumn(block, header.fields[fz], zs);
+            // 最值：无效点换成不影响结果的值，循环里没有分支
+            float lo0 = stats.lo[0], lo1 = stats.lo[1], lo2 = stats.lo[2];
+            float hi0 = stats.hi[0], hi1 = stats.hi[1], hi2 = stats.hi[2];
+            uint64_t good = 0;
+            for (size_t i = 0; i < n; ++i) {
+                valid[i] = std::isfinite(xs[i]) & std::isfinite(ys[i]) & std::isfinite(zs[i]);
+                good += valid[i];
+            }
+            for (size_t i = 0; i < n; ++i) {
+                float x = valid[i] ? xs[i] : lo0, y = valid[i] ? ys[i] : lo1, z = valid[i] ? zs[i] : lo2;
+                lo0 = std::min(lo0, x); lo1 = std::min(lo1, y); lo2 = std::min(lo2, z);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                float x = valid[i] ? xs[i] : hi0, y = valid[i] ? ys[i] : hi1, z = valid[i] ? zs[i] : hi2;
+                hi0 = std::max(hi0, x); hi1 = std::max(hi1, y); hi2 = std::max(hi2, z);
+            }
+            stats.lo[0] = lo0; stats.lo[1] = lo1; stats.lo[2] = lo2;
+            stats.hi[0] = hi0; stats.hi[1] = hi1; stats.hi[2] = hi2;
+            stats.valid += good;
+        }
+        if (fi >= 0) {
+            readColumn(block, header.fields[fi], vs);
+            uint8_t finite[STAT_BLOCK];
+            for (size_t i = 0; i < n; ++i) finite[i] = std::isfinite(vs[i]);
+            histogram(vs, finite, n, 1.0f, stats.intensity);
+        }
+        if (fd >= 0) {
+            readColumn(block, header.fields[fd], vs);
+            uint8_t finite[STAT_BLOCK];
+            for (size_t i = 0; i < n; ++i) finite[i] = std::isfinite(vs[i]);
+            histogram(vs, finite, n, PCD_DISTANCE_BIN, stats.distance);
+        } else if (hasXyz) {
+            for (size_t i = 0; i < n; ++i) vs[i] = std::sqrt(xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i]);
+            histogram(vs, valid, n, PCD_DISTANCE_BIN, stats.distance);
+        }
+    }
+}
+
+void PcdStatsBuilder::feed(uint64_t offset, const char* data, size_t len) {
+    if (!streaming) return;
+    if (offset != received) {
+        streaming = false;  // 数据不连续（不应发生），放弃上传时统计
+        return;
+    }
+    received += len;
+    if (!inRecords) {
+        size_t take = std::min(len, PCD_SNIFF_MAX - head.size());
+        head.append(data, take);
+        PcdHeader header;
+        if (!parsePcdHeader(head.data(), head.size(), header)) {
+            if (head.size() >= PCD_SNIFF_MAX) streaming = false;
+            return;
+        }
+        if (header.encoding != PcdEncoding::Binary || header.pointSize == 0) {
+            streaming = false;
+            return;
+        }
+        begin(header);
+        inRecords = true;
+        remaining = header.points;
+        // 这一块中头部之后的部分已经是点数据
+        size_t used = header.dataOffset - (head.size() - take);
+        data += used;
+        len -= used;
+        head.clear();
+    }
+
+    size_t pointSize = block.header.pointSize;
+    if (!carry.empty() && remaining > 0) {
+        size_t take = std::min(len, pointSize - carry.size());
+        carry.append(data, take);
+        data += take;
+        len -= take;
+        if (carry.size() < pointSize) return;
+        accumulate(carry.data(), 1);
+        carry.clear();
+        --remaining;
+    }
+    size_t whole = std::min<uint64_t>(len / pointSize, remaining);
+    accumulate(data, whole);
+    remaining -= whole;
+    if (remaining > 0) carry.assign(data + whole * pointSize, len - whole * pointSize);
+}
+
+bool PcdStatsBuilder::finish(uint64_t fileSize, PcdStats& result) {
+    if (!streaming || !inRecords || received != fileSize) return false;
+    result = stats;
+    return true;
+}
+
+bool createPcdStatsDir() {
+    return mkdir(STATS_DIR.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static bool readAll(int fd, void* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, static_cast<char*>(buf) + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// 先写临时文件再改名
+static void writeStats(const std::string& basename, const struct stat& st, const PcdStats& stats) {
+    StatsHeader h{};
+    memcpy(h.magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+    h.fileSize = st.st_size;
+    h.mtimeSec = st.st_mtim.tv_sec;
+    h.mtimeNsec = st.st_mtim.tv_nsec;
+    h.inode = st.st_ino;
+    std::string tmp = STATS_DIR + ".tmpXXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) return;
+    fchmod(fd, 0644);
+    bool ok = write(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) && write(fd, &stats, sizeof(stats)) == (ssize_t)sizeof(stats);
+    ok = close(fd) == 0 && ok && std::rename(tmp.c_str(), (STATS_DIR + basename).c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+}
+
+void savePcdStats(const std::string& basename, const PcdStats& stats) {
+    struct stat st{};
+    if (stat(("filedir/" + basename).c_str(), &st) == 0) writeStats(basename, st, stats);
+}
+
+bool loadPcdStats(const std::string& basename, PcdStats& stats, std::string& error) {
+    int fd = open(("filedir/" + basename).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        error = "文件不存在";
+        return false;
+    }
+
+    int sfd = open((STATS_DIR + basename).c_str(), O_RDONLY | O_CLOEXEC);
+    if (sfd >= 0) {
+        StatsHeader h{};
+        bool ok = readAll(sfd, &h, sizeof(h), 0) && memcmp(h.magic, STATS_MAGIC, sizeof(STATS_MAGIC)) == 0 &&
+                  h.fileSize == (uint64_t)st.st_size && h.mtimeSec == st.st_mtim.tv_sec &&
+                  h.mtimeNsec == st.st_mtim.tv_nsec && h.inode == st.st_ino && readAll(sfd, &stats, sizeof(stats), sizeof(h));
+        close(sfd);
+        if (ok) {
+            close(fd);
+            return true;
+        }
+    }
+
+    if ((uint64_t)st.st_size > PCD_MAX_SIZE) {
+        close(fd);
+        error = "点云文件过大";
+        return false;
+    }
+    std::string content(st.st_size, '\0');
+    bool read = readAll(fd, &content[0], content.size(), 0);
+    close(fd);
+    if (!read) {
+        error = "读取文件失败";
+        return false;
+    }
+    PcdCloud cloud;
+    if (!loadPcd(content.data(), content.size(), cloud, error)) return false;
+    PcdStatsBuilder builder;
+    builder.begin(cloud.header);
+    builder.accumulate(cloud.records, cloud.count);
+    stats = builder.result();
+    writeStats(basename, st, stats);
+    return true;
+}
+
+void updatePcdStats(const std::string& basename) {
+    if (!isPcdName(basename)) return;
+    PcdStats stats;
+    std::string error;
+    loadPcdStats(basename, stats, error);
+}
+
+// 直方图一行：省略末尾为 0 的格子
+static std::string histogramLine(const char* name, bool present, const uint64_t* bins) {
+    std::string line = name;
+    if (present) {
+        size_t n = PCD_HISTOGRAM_BINS;
+        while (n > 0 && bins[n - 1] == 0) --n;
+        for (size_t i = 0; i < n; ++i) line += " " + std::to_string(bins[i]);
+    }
+    return line + "\n";
+}
+
+std::string formatPcdStats(const PcdStats& stats) {
+    char box[256];
+    if (stats.valid > 0) {
+        snprintf(box, sizeof(box), "%.9g %.9g %.9g %.9g %.9g %.9g", stats.lo[0], stats.lo[1], stats.lo[2],
+                 stats.hi[0], stats.hi[1], stats.hi[2]);
+    } else {
+        snprintf(box, sizeof(box), "0 0 0 0 0 0");
+    }
+    return "OK " + std::to_string(stats.points) + " " + std::to_string(stats.valid) + " " + box + "\n" +
+           histogramLine("INTENSITY", stats.hasIntensity, stats.intensity) +
+           histogramLine("DISTANCE", stats.hasDistance, stats.distance);
+}
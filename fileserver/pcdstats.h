@@ -0,0 +1,89 @@
+#ifndef PCDSTATS_H
+#define PCDSTATS_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "pcd.h"
+
+/**
+ * @brief 点云帧的统计：包围盒、点数、强度和距离直方图
+ *
+ * 客户端发送 "STAT name\n"，服务端回复
+ *   "OK <点数> <有效点数> <minx> <miny> <minz> <maxx> <maxy> <maxz>\n"
+ *   "INTENSITY <c0> <c1> ...\n"
+ *   "DISTANCE <c0> <c1> ...\n"
+ * 有效点是坐标都为有限值的点，包围盒只统计有效点。强度直方图统计 intensity 字段（不区分大小写），
+ * 每格宽 1，第 i 格为 [i, i + 1)；距离直方图统计 distance 字段，没有这个字段时为到原点的距离，
+ * 每格宽 PCD_DISTANCE_BIN 米。两种直方图都有 PCD_HISTOGRAM_BINS 格，超出范围的值记在最后一格，
+ * 负值记在第一格，末尾为 0 的格子省略；点云没有对应字段时该行只有行首的名字。
+ *
+ * 从头开始的上传（包括 splice 模式：点云文件的数据先窥视一份再 splice）把收到的每一块数据
+ * 依次交给 PcdStatsBuilder，一遍算完，文件存入后保存在 filedir/.pcdstats/<文件名>。
+ * 数据不是按顺序从头收到的上传（分块、续传、增量、秒传）以及不是 DATA binary 的点云，
+ * 在文件存入、回复客户端之后由线程池读一次文件计算并保存（updatePcdStats），不占用连接。
+ * 保存的统计记录了文件的大小、修改时间和 inode，文件被替换后重新计算。
+ */
+
+constexpr size_t PCD_HISTOGRAM_BINS = 256;
+constexpr float PCD_DISTANCE_BIN = 1.0f;
+
+struct PcdStats {
+    uint64_t points = 0;  // 完整的点数
+    uint64_t valid = 0;   // 坐标都为有限值的点数
+    float lo[3] = {0, 0, 0};
+    float hi[3] = {0, 0, 0};
+    bool hasIntensity = false;
+    bool hasDistance = false;
+    uint64_t intensity[PCD_HISTOGRAM_BINS] = {};
+    uint64_t distance[PCD_HISTOGRAM_BINS] = {};
+};
+
+/**
+ * @brief 逐块累加统计
+ *
+ * 上传时 start 之后按文件偏移顺序 feed 收到的数据：先攒齐头部，之后的点记录直接在收到的缓冲区上
+ * 统计，跨两块数据的一个点先拼起来。数据不连续、头部不合法或不是 DATA binary 时放弃。
+ * 统计的内核按块把坐标等字段取成 float 数组，求最值和直方图的循环只访问连续数组。
+ */
+class PcdStatsBuilder {
+public:
+    void start(const std::string& basename, uint64_t offset);  // 只统计从偏移 0 开始上传的 .pcd 文件
+    bool active() const { return streaming; }  // 还在接收数据并统计
+    void feed(uint64_t offset, const char* data, size_t len);
+    // 整个文件（大小为 fileSize）都已经 feed 并且统计成功时返回 true
+    bool finish(uint64_t fileSize, PcdStats& stats);
+
+    // 直接统计内存中的点记录
+    void begin(const PcdHeader& header);
+    void accumulate(const char* records, size_t count);
+    const PcdStats& result() const { return stats; }
+
+private:
+    bool streaming = false;
+    bool inRecords = false;
+    uint64_t received = 0;
+    std::string head;    // 攒头部
+    std::string carry;   // 跨块的不完整点记录
+    uint64_t remaining = 0;  // 头部声明的点数中还没有收到的
+    PcdCloud block;      // 当前统计的一批点（指向收到的数据）
+    int fx = -1, fy = -1, fz = -1, fi = -1, fd = -1;
+    PcdStats stats;
+};
+
+// 创建统计目录（服务端启动时调用）
+bool createPcdStatsDir();
+
+// 保存上传时算好的统计（磁盘线程中调用）
+void savePcdStats(const std::string& basename, const PcdStats& stats);
+
+// 文件存入后补算上传时没有算出的统计：保存的统计与文件不一致时读文件计算并保存（线程池中调用）
+void updatePcdStats(const std::string& basename);
+
+// 取得 filedir/<basename> 的统计：有保存且与文件一致时直接读取，否则读文件计算并保存（磁盘线程中调用）
+bool loadPcdStats(const std::string& basename, PcdStats& stats, std::string& error);
+
+// STAT 的响应
+std::string formatPcdStats(const PcdStats& stats);
+
+#endif // PCDSTATS_H
@@ -0,0 +1,211 @@
+#include "reactor.h"
+#include <atomic>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+constexpr int MAX_EVENTS = 1000;
+constexpr int SWEEP_INTERVAL_MS = 1000;  // 空闲连接检查间隔
+
+Reactor::Reactor(int listenFd, ThreadPool& diskPool, ThreadPool& writePool, const ServerConfig& config)
+    : listenFd(listenFd), pool(diskPool), writers(writePool), config(config) {
+    epollFd = epoll_create1(0);
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || eventFd < 0) {
+        std::cerr << "创建 epoll/eventfd 失败: " << strerror(errno) << std::endl;
+        std::exit(1);
+    }
+
+    // 监听 socket 和磁盘完成通知都使用水平触发
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = eventFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev);
+}
+
+Reactor::~Reactor() {
+    close(eventFd);
+    close(epollFd);
+}
+
+/**
+ * @brief 事件循环
+ *
+ * 客户端 socket 使用水平触发：连接每次只传输有限的字节数就让出，
+ * 剩余数据会在下一轮 epoll_wait 再次就绪，从而让所有连接轮流推进。
+ * 启用空闲超时时 epoll_wait 最多等待 SWEEP_INTERVAL_MS，每隔这么久检查一次空闲连接。
+ */
+void Reactor::run() {
+    epoll_event events[MAX_EVENTS];
+    int timeout = config.idleTimeout > 0 ? SWEEP_INTERVAL_MS : -1;
+    lastSweep = std::chrono::steady_clock::now();
+    while (true) {
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait 失败: " << strerror(errno) << std::endl;
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                acceptConnections();
+            } else if (fd == eventFd) {
+                drainDiskCompletions();
+            } else {
+                auto it = conns.find(fd);
+                if (it == conns.end()) continue;
+                it->second.conn->handleEvent(events[i].events);
+                update(fd);
+            }
+        }
+        if (timeout > 0) sweepIdle();
+    }
+}
+
+// 每隔 SWEEP_INTERVAL_MS 检查一次所有连接，关闭超过 idleTimeout 没有活动的连接
+void Reactor::sweepIdle() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastSweep < std::chrono::milliseconds(SWEEP_INTERVAL_MS)) return;
+    lastSweep = now;
+    // 顺便丢弃本事件循环的下载缓存和文件映射中已失效的条目
+    sweepFileCache();
+    sweepMappedFiles();
+
+    // 先收集 fd，update 可能在遍历过程中删除连接
+    std::vector<int> fds;
+    fds.reserve(conns.size());
+    for (auto& kv : conns) fds.push_back(kv.first);
+    for (int fd : fds) {
+        auto it = conns.find(fd);
+        if (it == conns.end()) continue;
+        it->second.conn->checkIdle(now);
+        update(fd);
+    }
+}
+
+// 接受所有排队的新连接（监听 socket 为非阻塞），客户端 socket 同样设为非阻塞
+void Reactor::acceptConnections() {
+    while (true) {
+        sockaddr_in clientAddr{};
+        socklen_t clientLen = sizeof(clientAddr);
+        int clientSock = accept4(listenFd, (sockaddr*)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSock < 0) {
+            if (errno == EINTR) continue;
+            return;  // EAGAIN：没有更多连接
+        }
+        conns[clientSock] = Entry{std::make_unique<Connection>(clientSock, *this, config), 0};
+        update(clientSock);
+    }
+}
+
+void Reactor::submitDisk(Connection& conn, std::function<void()> work) {
+    submitTo(pool, conn.fd(), false, std::move(work));
+}
+
+void Reactor::submitWrite(Connection& conn, std::function<void()> work) {
+    submitTo(writers, conn.fd(), true, std::move(work));
+}
+
+// 在 target 中执行 work，完成后放入完成队列并唤醒事件循环
+void Reactor::submitTo(ThreadPool& target, int fd, bool background, std::function<void()> work) {
+    target.enqueue([this, fd, background, work = std::move(work)]() {
+        work();
+        postDone(Done{fd, background});
+    });
+}
+
+void Reactor::submitBatch(Connection& conn, std::vector<std::function<void()>> work, std::function<void()> join) {
+    if (work.empty()) {
+        submitTo(pool, conn.fd(), false, join ? std::move(join) : [] {});
+        return;
+    }
+    // 计数归零的那个线程执行 join，之前所有任务的写入对它都可见
+    auto left = std::make_shared<std::atomic<size_t>>(work.size());
+    auto last = std::make_shared<std::function<void()>>(std::move(join));
+    int fd = conn.fd();
+    for (auto& task : work) {
+        pool.enqueue([this, fd, left, last, task = std::move(task)]() {
+            task();
+            if (left->fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (*last) (*last)();
+            postDone(Done{fd, false});
+        });
+    }
+}
+
+void Reactor::submitBackground(std::function<void()> work) {
+    pool.enqueue(std::move(work));
+}
+
+// 放入完成队列并唤醒事件循环
+void Reactor::postDone(Done done) {
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        doneFds.push_back(done);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(eventFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// 取出所有已完成的磁盘任务，在事件循环线程中继续推进对应的连接
+void Reactor::drainDiskCompletions() {
+    uint64_t count;
+    ssize_t ignored = read(eventFd, &count, sizeof(count));
+    (void)ignored;
+
+    std::vector<Done> ready;
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        ready.swap(doneFds);
+    }
+    for (const Done& done : ready) {
+        auto it = conns.find(done.fd);
+        if (it == conns.end()) continue;
+        if (done.background) {
+            it->second.conn->onWriteDone();
+        } else {
+            it->second.conn->onDiskDone();
+        }
+        update(done.fd);
+    }
+}
+
+/**
+ * @brief 同步连接的 epoll 注册状态
+ *
+ * 连接已结束则回收；等待磁盘任务时从 epoll 中移除，避免对端挂断时
+ * 水平触发的 EPOLLHUP 反复唤醒；其余情况按需要监听的事件注册或修改。
+ * 有磁盘任务或后台写盘在执行的连接不会被回收，因此完成队列中的 fd 始终有效。
+ */
+void Reactor::update(int fd) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) return;
+    Entry& entry = it->second;
+    if (entry.conn->closed()) {
+        if (entry.events != 0) epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        conns.erase(it);  // 析构时关闭 socket
+        return;
+    }
+    uint32_t want = entry.conn->interest();
+    if (want == entry.events) return;
+    epoll_event ev{};
+    ev.events = want;
+    ev.data.fd = fd;
+    if (want == 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    } else if (entry.events == 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    } else {
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+    }
+    entry.events = want;
+}
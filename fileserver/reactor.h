@@ -0,0 +1,67 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <chrono>
+#include "connection.h"
+#include "threadpool.h"
+
+/**
+ * @brief 基于 epoll 的事件循环
+ *
+ * 一个线程持有监听 socket、epoll 实例和所有连接，按 EPOLLIN/EPOLLOUT 就绪事件
+ * 驱动每个 Connection 的状态机。线程池只用于磁盘操作：任务完成后把连接的 fd
+ * 放入完成队列并写 eventfd 唤醒事件循环，由事件循环线程继续推进该连接。
+ * 上传数据块的写盘交给单独的写盘线程池在后台进行，期间连接继续接收，
+ * 不会被同一个线程池中的打开文件、计算摘要等任务挡住。
+ */
+class Reactor : public ConnectionHost {
+public:
+    Reactor(int listenFd, ThreadPool& diskPool, ThreadPool& writePool, const ServerConfig& config);
+    ~Reactor();
+
+    void run();  // 进入事件循环，不返回
+
+    // ConnectionHost：磁盘任务和并行任务交给磁盘线程池，上传数据块交给写盘线程池
+    void submitDisk(Connection& conn, std::function<void()> work) override;
+    void submitWrite(Connection& conn, std::function<void()> work) override;
+    void submitBatch(Connection& conn, std::vector<std::function<void()>> work, std::function<void()> join) override;
+    void submitBackground(std::function<void()> work) override;
+
+private:
+    struct Entry {
+        std::unique_ptr<Connection> conn;
+        uint32_t events;  // 当前在 epoll 中注册的事件，0 表示未注册
+    };
+
+    struct Done {
+        int fd;
+        bool background;  // 后台写盘任务（onWriteDone），否则为 onDiskDone
+    };
+
+    void acceptConnections();
+    void submitTo(ThreadPool& target, int fd, bool background, std::function<void()> work);
+    void postDone(Done done);
+    void drainDiskCompletions();
+    void sweepIdle();     // 关闭空闲超时的连接
+    void update(int fd);  // 根据连接的新状态更新 epoll 注册或回收连接
+
+    int listenFd;
+    int epollFd;
+    int eventFd;
+    ThreadPool& pool;
+    ThreadPool& writers;
+    const ServerConfig& config;
+    std::unordered_map<int, Entry> conns;
+    std::chrono::steady_clock::time_point lastSweep;
+
+    std::mutex doneMutex;     // 保护 doneFds
+    std::vector<Done> doneFds;  // 磁盘任务已完成的连接
+};
+
+#endif // REACTOR_H
@@ -1,21 +1,29 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <csignal>
 #include <sys/socket.h>
-#include <sys/epoll.h>
 #include <netinet/in.h>
-#include <cstring>
-#include <vector>
-#include <filesystem>
-#include <arpa/inet.h>  //用于将 IP 地址从二进制格式（in_addr 或 in6_addr）转换为文本字符串格式
 #include "threadpool.h"
+#include "reactor.h"
+#include "staging.h"
+#include "blobstore.h"
+#include "filecache.h"
+#include "pcdindex.h"
+#include "pcdcatalog.h"
+#include "pcdstats.h"
+#ifdef USE_IO_URING
+#include "uring_server.h"
+#endif
 
 constexpr int PORT = 8888;
-constexpr int MAX_EVENTS = 1000;
-constexpr int BUFFER_SIZE = 1024;
 
 void setNonBlocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -23,216 +31,28 @@ void setNonBlocking(int fd) {
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-// 处理上传和下载请求
-void handleClient(int clientFd) {
-
-    //获取客户端的IP地址和端口号
-    sockaddr_in peerAddr{};
-    socklen_t peerLen = sizeof(peerAddr);
-    char ipStr[INET_ADDRSTRLEN] = {0};
-    int port = 0;
-
-    if (getpeername(clientFd, (sockaddr*)&peerAddr, &peerLen) == 0) {
-        inet_ntop(AF_INET, &peerAddr.sin_addr, ipStr, sizeof(ipStr));
-        port = ntohs(peerAddr.sin_port);
-        // std::cout << "客户端连接: " << ipStr << ":" << port << std::endl;
-    }
-
-
-    char buffer[BUFFER_SIZE];
-    std::string commandLine;
-
-    // 接收命令（UPLOAD filename\n 或 DOWNLOAD filename\n）
-    while (true) {
-        // 接收单个字符
-        ssize_t n = recv(clientFd, buffer, 1, 0);
-        if (n <= 0) {
-            // 如果接收失败或连接关闭，关闭客户端连接并返回
-            close(clientFd);
-            return;
-        }
-        // 如果接收到换行符，跳出循环
-        if (buffer[0] == '\n') break;
-        // 拼接接收到的命令
-        commandLine += buffer[0];
-    }
-
-    // 将接收到的命令和文件名解析出来
-    std::istringstream iss(commandLine);
-    std::string command, filename;
-    iss >> command;
-    if (command == "EXIT"){
-        std::cout << "断开连接: " << ipStr << ":" << port << std::endl;
-    }else if (command == "UPLOAD") {// 如果是上传命令
-        iss >> filename;
-        // 获取文件名（不包含路径）
-        std::string basename = filename.substr(filename.find_last_of("/\\") + 1);
-        // 构造文件的完整路径
-        std::string fullpath = "filedir/" + basename;
-        
-        std::cout << "客户端 " << ipStr << ":" << port << " 请求上传文件" << std::endl;
-        
-        // 接收文件大小信息
-        std::string sizeLine;
-        char ch;
-        while (true) {
-            ssize_t n = recv(clientFd, &ch, 1, 0);
-            if (n < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // 如果暂时没有数据，等待一下再试
-                    usleep(1000);  // 休眠1毫秒
-                    continue;
-                }
-                // 真正的错误，输出错误信息
-                std::cerr << "接收错误: " << strerror(errno) << std::endl;
-                close(clientFd);
-                return;
-            } else if (n == 0) {
-                // 连接已关闭
-                std::cerr << "客户端关闭了连接" << std::endl;
-                close(clientFd);
-                return;
-            }
-            
-            if (ch == '\n') break;
-            sizeLine += ch;
-        }
-        
-        // 确保收到了文件大小信息
-        if (sizeLine.empty()) {
-            std::cerr << "未收到文件大小信息" << std::endl;
-            close(clientFd);
-            return;
-        }
-        
-        size_t filesize;
-        try {
-            filesize = std::stoull(sizeLine);
-        } catch (const std::exception& e) {
-            std::cerr << "文件大小格式错误: " << sizeLine << std::endl;
-            close(clientFd);
-            return;
-        }
-        
-        if (filesize == 0) {
-            std::cerr << "文件大小为0，拒绝接收" << std::endl;
-            close(clientFd);
-            return;
-        }
-        
-        std::cout << "准备接收文件: " << basename << " (预期大小: " << filesize << " 字节) 来自 " << ipStr << ":" << port << std::endl;
-        
-        // 打开文件准备写入
-        std::ofstream outfile(fullpath, std::ios::binary);
-        if (!outfile.is_open()) {
-            std::cerr << "无法创建文件: " << fullpath << std::endl;
-            close(clientFd);
-            return;
-        }
-        
-        // 接收文件数据并写入文件
-        size_t received = 0;
-        while (received < filesize) {
-            ssize_t bytes = recv(clientFd, buffer, std::min<size_t>(BUFFER_SIZE, filesize - received), 0);
-            if (bytes < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // 如果暂时没有数据，等待一下再试
-                    usleep(1000);  // 休眠1毫秒
-                    continue;
-                }
-                // 真正的错误发生
-                std::cerr << "接收文件数据失败: " << strerror(errno) << std::endl;
-                outfile.close();
-                std::remove(fullpath.c_str());  // 删除不完整的文件
-                close(clientFd);
-                return;
-            } else if (bytes == 0) {
-                // 连接已关闭
-                std::cerr << "客户端断开连接，接收文件不完整" << std::endl;
-                outfile.close();
-                std::remove(fullpath.c_str());  // 删除不完整的文件
-                close(clientFd);
-                return;
-            }
-            outfile.write(buffer, bytes);
-            received += bytes;
-            
-            // 输出上传进度
-            if (received % (1024 * 1024) == 0) {  // 每传输1MB输出一次进度
-                std::cout << "已接收: " << received << "/" << filesize << " 字节 (" 
-                         << (received * 100 / filesize) << "%)" << std::endl;
-            }
-        }
-        
-        outfile.close();
-        std::cout << "上传完成: " << basename << " (大小: " << received << " 字节) 来自 " << ipStr << ":" << port << std::endl;
-
-    } else if (command == "DOWNLOAD") {
-        iss >> filename;
-        // 获取文件名（不包含路径）
-        std::string basename = filename.substr(filename.find_last_of("/\\") + 1);
-        
-        std::cout << "客户端 " << ipStr << ":" << port << " 请求下载文件" << std::endl;
-        // 构造文件的完整路径
-        std::string fullpath = "filedir/" + basename;
-        // 打开文件准备读取
-        std::ifstream infile(fullpath, std::ios::binary);
-        if (!infile.is_open()) {
-            // 如果文件打开失败，发送错误信息并关闭连接
-            std::string msg = "ERROR 文件不存在\n";
-            send(clientFd, msg.c_str(), msg.size(), 0);
-            close(clientFd);
-            return;
-        }
-
-        // 获取文件大小
-        infile.seekg(0, std::ios::end);
-        size_t filesize = infile.tellg();
-        infile.seekg(0);
-        
-        std::cout << "准备发送文件: " << basename << " (总大小: " << filesize << " 字节) 发送至 " << ipStr << ":" << port << std::endl;
-        
-        // 构造文件头信息
-        std::string header = "OK " + std::to_string(filesize) + "\n";
-        send(clientFd, header.c_str(), header.size(), 0);
-
-        // 发送文件数据
-        size_t sent = 0;
-        while (infile.read(buffer, BUFFER_SIZE) || infile.gcount() > 0) {
-            ssize_t bytes = send(clientFd, buffer, infile.gcount(), 0);
-            if (bytes < 0) {
-                std::cerr << "发送文件数据失败: " << strerror(errno) << std::endl;
-                infile.close();
-                close(clientFd);
-                return;
-            }
-            sent += bytes;
-            
-            // 每发送1MB显示一次进度
-            if (sent % (1024 * 1024) == 0) {
-                std::cout << "已发送: " << sent << "/" << filesize << " 字节 (" 
-                         << (sent * 100 / filesize) << "%)" << std::endl;
-            }
-        }
-        
-        infile.close();
-        std::cout << "下载完成: " << basename << " (总大小: " << filesize << " 字节) 发送至 " << ipStr << ":" << port << std::endl;
-    }
-    // 关闭客户端连接
-    close(clientFd);
-}
-
-int main() {
+/**
+ * @brief 创建非阻塞的监听套接字
+ *
+ * @param reusePort 多个事件循环时为 true，允许每个事件循环绑定同一端口
+ * @return 监听套接字，失败返回 -1
+ */
+int createListener(bool reusePort) {
     // 创建套接字
     int serverSock = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSock < 0) {
         std::cerr << "Socket 创建失败\n";
-        return 1;
+        return -1;
     }
 
     // 设置套接字选项，允许地址重用
     int opt = 1;
     setsockopt(serverSock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reusePort && setsockopt(serverSock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        std::cerr << "设置 SO_REUSEPORT 失败\n";
+        close(serverSock);
+        return -1;
+    }
     // 设置套接字为非阻塞模式
     setNonBlocking(serverSock);
 
@@ -245,71 +65,174 @@ int main() {
     // 绑定套接字到指定地址和端口
     if (bind(serverSock, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
         std::cerr << "绑定失败\n";
-        return 1;
+        close(serverSock);
+        return -1;
     }
 
     // 使套接字进入监听状态
     if (listen(serverSock, SOMAXCONN) < 0) {
         std::cerr << "监听失败\n";
-        return 1;
+        close(serverSock);
+        return -1;
+    }
+    return serverSock;
+}
+
+/**
+ * @brief 运行一个事件循环
+ *
+ * 每个事件循环独占自己的监听套接字、epoll 实例（或 io_uring）、连接表和磁盘线程池，
+ * 连接从 accept 到关闭都留在这个线程上，事件循环之间没有任何共享的锁。
+ * 多个事件循环时把线程绑定到 index 对应的 CPU 核，磁盘线程继承该绑定。
+ */
+void runReactor(int index, int listenFd, const ServerConfig& config, size_t diskThreads, bool pinCore) {
+    if (pinCore) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
     }
 
-    // 创建 epoll 实例
-    int epollFd = epoll_create1(0);
-    if (epollFd < 0) {
-        std::cerr << "创建 epoll 失败\n";
-        return 1;
+#ifdef USE_IO_URING
+    if (config.backend == Backend::Uring) {
+        // 网络和磁盘读写全部交给 io_uring，线程池只用于计算摘要等需要读完整个文件的操作
+        UringServer server(listenFd, config, diskThreads);
+        if (!server.init()) return;
+        server.run();
+        return;
     }
+#endif
+
+    // 线程池只负责磁盘操作，网络 I/O 全部由事件循环线程非阻塞地完成；
+    // 上传数据块由单独的写盘线程写入，与网络接收重叠进行
+    ThreadPool pool(diskThreads);
+    ThreadPool writers(diskThreads);
+    Reactor reactor(listenFd, pool, writers, config);
+    reactor.run();
+}
 
-    // 向 epoll 添加监听服务器套接字的事件
-    epoll_event ev{};
-    ev.data.fd = serverSock;
-    ev.events = EPOLLIN;
-    epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSock, &ev);
+int main(int argc, char* argv[]) {
+    // 解析命令行参数：--backend=epoll|uring --reactors=N --idle-timeout=SEC --cache-size=MB --download=sendfile|stream|mmap --upload=splice|stream|direct --pcd-store=binary|compressed
+    ServerConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--download=sendfile") {
+            config.downloadMode = DownloadMode::Sendfile;
+        } else if (arg == "--download=stream") {
+            config.downloadMode = DownloadMode::Stream;
+        } else if (arg == "--download=mmap") {
+            config.downloadMode = DownloadMode::Mmap;
+        } else if (arg == "--upload=splice") {
+            config.uploadMode = UploadMode::Splice;
+        } else if (arg == "--upload=stream") {
+            config.uploadMode = UploadMode::Stream;
+        } else if (arg == "--upload=direct") {
+            config.uploadMode = UploadMode::Direct;
+        } else if (arg == "--pcd-store=binary") {
+            config.pcdCompress = false;
+        } else if (arg == "--pcd-store=compressed") {
+            config.pcdCompress = true;
+        } else if (arg.rfind("--reactors=", 0) == 0) {
+            // 事件循环个数，0 表示每个 CPU 核一个
+            try {
+                config.reactors = std::stoi(arg.substr(11));
+            } catch (const std::exception& e) {
+                config.reactors = -1;
+            }
+            if (config.reactors < 0) {
+                std::cerr << "事件循环个数格式错误: " << arg << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("--idle-timeout=", 0) == 0) {
+            // 连接空闲超时（秒），0 表示不超时
+            try {
+                config.idleTimeout = std::stoi(arg.substr(15));
+            } catch (const std::exception& e) {
+                config.idleTimeout = -1;
+            }
+            if (config.idleTimeout < 0) {
+                std::cerr << "空闲超时格式错误: " << arg << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            // 热点小文件缓存容量（MB），0 表示不缓存
+            try {
+                config.cacheMB = std::stoi(arg.substr(13));
+            } catch (const std::exception& e) {
+                config.cacheMB = -1;
+            }
+            if (config.cacheMB < 0) {
+                std::cerr << "缓存容量格式错误: " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--backend=epoll") {
+            config.backend = Backend::Epoll;
+        } else if (arg == "--backend=uring") {
+#ifdef USE_IO_URING
+            config.backend = Backend::Uring;
+#else
+            std::cerr << "此版本未启用 io_uring，请使用 make server_uring 编译\n";
+            return 1;
+#endif
+        } else {
+            std::cerr << "用法: " << argv[0] << " [--backend=epoll|uring] [--reactors=N] [--idle-timeout=SEC] [--cache-size=MB] [--download=sendfile|stream|mmap] [--upload=splice|stream|direct] [--pcd-store=binary|compressed]\n";
+            return 1;
+        }
+    }
+    // 客户端中途断开时 send/sendfile 会触发 SIGPIPE，忽略它以免进程退出
+    signal(SIGPIPE, SIG_IGN);
 
-    // 初始化事件数组和线程池
-    epoll_event events[MAX_EVENTS];
-    ThreadPool pool(std::thread::hardware_concurrency());
+    // 上传先写入暂存目录，接收完整后再移入 filedir/
+    if (!createStagingDir()) {
+        std::cerr << "创建暂存目录 filedir/.partial 失败，请确认 filedir 目录存在\n";
+        return 1;
+    }
+    if (!createBlobStore()) {
+        std::cerr << "创建内容目录 filedir/.blobs 失败\n";
+        return 1;
+    }
+    if (!createPcdIndexDir()) {
+        std::cerr << "创建点云索引目录 filedir/.pcdindex 失败\n";
+        return 1;
+    }
+    if (!createPcdStatsDir()) {
+        std::cerr << "创建点云统计目录 filedir/.pcdstats 失败\n";
+        return 1;
+    }
+    if (!loadPcdCatalog()) {
+        std::cerr << "加载点云目录 filedir/.pcdcatalog 失败\n";
+        return 1;
+    }
 
-    // 输出服务器启动信息
-    std::cout << "服务端启动，端口 " << PORT << "...\n";
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    int reactors = config.reactors > 0 ? config.reactors : cores;
+    initFileCache(size_t(config.cacheMB) * 1024 * 1024, reactors);
 
-    // 事件循环
-    while (true) {
-        // 等待事件发生
-        int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);  //epoll_wait 会阻塞直到有事件发生。
-        for (int i = 0; i < n; ++i) {
-            // 如果是服务器套接字事件
-            if (events[i].data.fd == serverSock) {                // 有新连接
-                sockaddr_in clientAddr{};
-                socklen_t clientLen = sizeof(clientAddr);
-                int clientSock = accept(serverSock, (sockaddr*)&clientAddr, &clientLen);  //有客户端连接进来，使用 accept() 拿到新 socket。
-                //下面四行是用来打印客户端的 IP 和端口，方便调试。
-                char ipStr[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, sizeof(ipStr));
-                int clientPort = ntohs(clientAddr.sin_port);
-                // std::cout << "新连接来自: " << ipStr << ":" << clientPort << std::endl;
+    // 每个事件循环各自创建监听套接字，由内核按 SO_REUSEPORT 把新连接分散到各个监听套接字
+    std::vector<int> listeners;
+    for (int i = 0; i < reactors; ++i) {
+        int fd = createListener(reactors > 1);
+        if (fd < 0) return 1;
+        listeners.push_back(fd);
+    }
 
-                if (clientSock >= 0) {
-                    setNonBlocking(clientSock);  //设置客户端 socket 为非阻塞，因为 epoll 边缘触发要求非阻塞行为。否则可能导致死锁或事件错过。
-                    epoll_event clientEvent{};  //构造一个 epoll_event 结构体。
-                    clientEvent.data.fd = clientSock;
-                    clientEvent.events = EPOLLIN | EPOLLET;  // EPOLLIN: 表示“可读”事件。EPOLLET: 表示边缘触发（只通知一次，除非有新事件到达）。
-                    epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSock, &clientEvent);  //把新客户端 fd 加入 epoll 监听列表。
-                }
-            } else {//如果是其他客户端发送数据了（非监听 socket
-                // 将客户端任务交给线程池处理（epoll 边缘触发仅通知一次）
-                int clientFd = events[i].data.fd;
-                epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);  // 因为是边缘触发（ET），如果不删除，该 fd 后续不会再触发事件了。因此删掉再处理
-                pool.enqueue([clientFd]() {  //使用线程池处理客户端任务。 避免阻塞主线程（主线程要负责 epoll_wait）。
-                    // handleClient(clientFd) 是处理上传/下载逻辑的函数。
-                    handleClient(clientFd);
-                });
-            }
+    // 输出服务器启动信息
+    std::cout << "服务端启动" << (config.backend == Backend::Uring ? "（io_uring）" : "")
+              << "，端口 " << PORT << "，事件循环 " << reactors << " 个...\n";
+
+    if (reactors == 1) {
+        runReactor(0, listeners[0], config, cores, false);
+    } else {
+        // 磁盘线程平均分给各个事件循环，每个事件循环只和自己的磁盘线程共享锁
+        size_t diskThreads = std::max(1u, cores / reactors);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < reactors; ++i) {
+            threads.emplace_back(runReactor, i, listeners[i], std::cref(config), diskThreads, true);
         }
+        for (auto& t : threads) t.join();
     }
 
     // 关闭服务器套接字
-    close(serverSock);
+    for (int fd : listeners) close(fd);
     return 0;
 }
@@ -0,0 +1,135 @@
+#include "sha256.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256() {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    std::memcpy(state, init, sizeof(state));
+}
+
+void Sha256::transform(const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+               (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    totalLen += len;
+    if (bufferLen > 0) {
+        size_t n = std::min(len, 64 - bufferLen);
+        std::memcpy(buffer + bufferLen, p, n);
+        bufferLen += n;
+        p += n;
+        len -= n;
+        if (bufferLen < 64) return;
+        transform(buffer);
+        bufferLen = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) transform(p);
+    std::memcpy(buffer, p, len);
+    bufferLen = len;
+}
+
+void Sha256::digest(uint8_t out[32]) {
+    // 填充：0x80，若干 0，最后 8 字节为消息的比特长度（大端）
+    uint64_t bits = totalLen * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padLen = (bufferLen < 56 ? 56 : 120) - bufferLen;
+    for (int i = 0; i < 8; ++i) pad[padLen + i] = uint8_t(bits >> (56 - 8 * i));
+    update(pad, padLen + 8);
+    for (int i = 0; i < 32; ++i) out[i] = uint8_t(state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+std::string Sha256::hexDigest() {
+    static const char* digits = "0123456789abcdef";
+    uint8_t bytes[32];
+    digest(bytes);
+    std::string hex;
+    hex.reserve(64);
+    for (uint8_t v : bytes) {
+        hex.push_back(digits[v >> 4]);
+        hex.push_back(digits[v & 0xF]);
+    }
+    return hex;
+}
+
+bool sha256File(const std::string& path, std::string& hex, uint32_t* crc) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    Sha256 sha;
+    std::vector<char> buf(256 * 1024);
+    ssize_t n;
+    if (crc) *crc = 0;
+    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+        sha.update(buf.data(), n);
+        if (crc) *crc = crc32c(*crc, buf.data(), n);
+    }
+    close(fd);
+    if (n < 0) return false;
+    hex = sha.hexDigest();
+    return true;
+}
+
+bool sha256Proof(const std::string& path, const std::string& nonce, uint64_t offset, uint64_t length, std::string& hex) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    Sha256 sha;
+    sha.update(nonce.data(), nonce.size());
+    std::vector<char> buf(std::min<uint64_t>(length, 256 * 1024));
+    while (length > 0) {
+        ssize_t n = pread(fd, buf.data(), std::min<uint64_t>(length, buf.size()), offset);
+        if (n <= 0) break;
+        sha.update(buf.data(), n);
+        offset += n;
+        length -= n;
+    }
+    close(fd);
+    if (length > 0) return false;  // 文件比挑战的范围短
+    hex = sha.hexDigest();
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief SHA-256 摘要（FIPS 180-4），不依赖外部库，服务端和客户端共用
+ *
+ * 用于内容寻址存储：相同内容的文件得到相同的摘要，服务端只保存一份。
+ */
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const void* data, size_t len);
+    std::string hexDigest();  // 结束计算，返回 64 个字符的十六进制摘要
+    void digest(uint8_t out[32]);  // 结束计算，返回 32 字节的摘要
+
+private:
+    void transform(const uint8_t* block);
+
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t bufferLen = 0;
+    uint64_t totalLen = 0;
+};
+
+// 计算文件内容的摘要，读取失败返回 false；crc 不为空时在同一遍读取中计算 CRC32C（见 crc32c.h）
+bool sha256File(const std::string& path, std::string& hex, uint32_t* crc = nullptr);
+
+// 秒传的所有权证明：SHA-256(nonce + 文件中 [offset, offset + length) 的数据)，读取失败返回 false（见 blobstore.h）
+bool sha256Proof(const std::string& path, const std::string& nonce, uint64_t offset, uint64_t length, std::string& hex);
+
+#endif // SHA256_H
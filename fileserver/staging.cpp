@@ -0,0 +1,200 @@
+#include "staging.h"
+#include "blobstore.h"
+#include "sha256.h"
+#include "pcd.h"
+#include "pcdcatalog.h"
+#include "pcdstats.h"
+#include <fstream>
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const std::string STAGING_DIR = "filedir/.partial/";
+// 进度记录和增量上传的临时文件各自放在子目录中，与暂存文件同名也不会冲突
+static const std::string RECORD_DIR = STAGING_DIR + ".records/";
+static const std::string DELTA_DIR = STAGING_DIR + ".delta/";
+
+static std::string recordPath(const std::string& basename) {
+    return RECORD_DIR + basename;
+}
+
+bool createStagingDir() {
+    for (const std::string& dir : {STAGING_DIR, RECORD_DIR, DELTA_DIR}) {
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+std::string stagingPath(const std::string& basename) {
+    return STAGING_DIR + basename;
+}
+
+std::string deltaPath(const std::string& basename) {
+    return DELTA_DIR + basename;
+}
+
+std::string stagingTempPath(const std::string& name) {
+    return STAGING_DIR + "." + name;
+}
+
+/**
+ * @brief 查询服务端已持有的字节数
+ *
+ * 取进度记录和暂存文件实际长度中较小的一个：服务端异常退出时记录可能没有更新，
+ * 此时退回到较早的位置重新接收，不会在文件中留下空洞。
+ */
+uint64_t stagedBytes(const std::string& basename, uint64_t fileSize) {
+    std::ifstream record(recordPath(basename));
+    uint64_t recordSize = 0, received = 0;
+    if (!(record >> recordSize >> received) || recordSize != fileSize) return 0;
+
+    struct stat st{};
+    if (stat(stagingPath(basename).c_str(), &st) < 0 || !S_ISREG(st.st_mode)) return 0;
+    return std::min<uint64_t>({received, (uint64_t)st.st_size, fileSize});
+}
+
+// 先写临时文件再改名，进度记录不会出现写了一半的内容；临时文件名以 . 开头，不会与任何记录同名
+bool writeStagingRecord(const std::string& basename, uint64_t fileSize, uint64_t received) {
+    std::string tmp = RECORD_DIR + ".tmpXXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) return false;
+    std::string line = std::to_string(fileSize) + " " + std::to_string(received) + "\n";
+    bool ok = write(fd, line.data(), line.size()) == (ssize_t)line.size();
+    ok = close(fd) == 0 && ok && std::rename(tmp.c_str(), recordPath(basename).c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+}
+
+bool promoteStaged(const std::string& basename, const uint32_t* expectedCrc) {
+    if (!storeBlob(stagingPath(basename), basename, expectedCrc)) {
+        if (errno == EBADMSG) {
+            // 内容已经损坏，无法判断是哪一部分，整个文件需要重新上传
+            std::remove(stagingPath(basename).c_str());
+            std::remove(recordPath(basename).c_str());
+            errno = EBADMSG;
+        }
+        return false;
+    }
+    std::remove(recordPath(basename).c_str());
+    return true;
+}
+
+bool compressStoredPcd(const std::string& basename) {
+    int fd = open(("filedir/" + basename).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    std::string content;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size <= PCD_MAX_SIZE;
+    if (ok) {
+        content.resize(st.st_size);
+        size_t done = 0;
+        while (ok && done < content.size()) {
+            ssize_t n = pread(fd, &content[done], content.size() - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) done += n;
+        }
+    }
+    close(fd);
+    std::string compressed;
+    if (!ok || !compressPcd(content.data(), content.size(), compressed)) return false;
+
+    // 压缩结果写成暂存目录中的临时文件，再像上传完成一样存入内容目录并替换 filedir/ 中的链接；
+    // 读取之后文件已被新的上传替换时放弃，不覆盖新版本
+    std::string tmp = STAGING_DIR + ".pcdXXXXXX";
+    int out = mkstemp(&tmp[0]);
+    if (out < 0) return false;
+    fchmod(out, 0644);
+    ok = write(out, compressed.data(), compressed.size()) == (ssize_t)compressed.size();
+    ok = close(out) == 0 && ok && storeBlob(tmp, basename, nullptr, &st.st_ino);
+    if (!ok) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    // 未压缩的内容没有别的文件名引用时从内容目录删除，HASH 不会再找到这份已经不在 filedir/ 中的内容
+    Sha256 raw;
+    raw.update(content.data(), content.size());
+    releaseBlob(raw.hexDigest());
+    std::cout << "点云已转存为 binary_compressed: " << basename << " (" << content.size() << " -> "
+              << compressed.size() << " 字节)" << std::endl;
+    return true;
+}
+
+void finishStoredPcd(const std::string& basename, bool transcode, const PcdStats* streamed) {
+    bool replaced = transcode && compressStoredPcd(basename);
+    if (replaced) recordPcdFile(basename, nullptr);  // 文件头已经改为 binary_compressed
+    // 转存不改变点，上传时算出的统计按新文件重新保存
+    if (streamed && replaced) savePcdStats(basename, *streamed);
+    else if (!streamed) updatePcdStats(basename);
+}
+
+// 一个文件的分块上传进度：已写完的区间（起点 -> 终点，互不重叠）
+struct ChunkProgress {
+    uint64_t fileSize = 0;
+    uint64_t received = 0;
+    std::map<uint64_t, uint64_t> done;
+};
+
+static std::mutex chunkMutex;
+static std::unordered_map<std::string, ChunkProgress> chunkUploads;
+
+// 预分配磁盘空间，文件系统不支持 fallocate 时退回 ftruncate（稀疏文件）
+static bool preallocate(int fd, uint64_t size) {
+    if (fallocate(fd, 0, 0, size) == 0) return true;
+    return ftruncate(fd, size) == 0;
+}
+
+bool prepareChunkTarget(const std::string& basename, uint64_t fileSize) {
+    std::lock_guard<std::mutex> lock(chunkMutex);
+    auto it = chunkUploads.find(basename);
+    std::string path = stagingPath(basename);
+    if (it != chunkUploads.end() && it->second.fileSize == fileSize && access(path.c_str(), W_OK) == 0) {
+        return true;
+    }
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = preallocate(fd, fileSize);
+    close(fd);
+    if (!ok) return false;
+    std::remove(recordPath(basename).c_str());  // 顺序上传的进度记录对分块上传无效
+    ChunkProgress progress;
+    progress.fileSize = fileSize;
+    chunkUploads[basename] = std::move(progress);
+    return true;
+}
+
+ChunkStatus completeChunk(const std::string& basename, uint64_t fileSize, uint64_t offset, uint64_t length,
+                          const uint32_t* expectedCrc) {
+    std::lock_guard<std::mutex> lock(chunkMutex);
+    auto it = chunkUploads.find(basename);
+    if (it == chunkUploads.end() || it->second.fileSize != fileSize) return ChunkStatus::Failed;
+    ChunkProgress& progress = it->second;
+
+    // 与相邻或重叠的区间合并（客户端重传的分块可能与已完成的区间重叠）
+    uint64_t start = offset, end = offset + length;
+    auto next = progress.done.upper_bound(start);
+    if (next != progress.done.begin()) {
+        auto prev = std::prev(next);
+        if (prev->second >= start) next = prev;
+    }
+    while (next != progress.done.end() && next->first <= end) {
+        start = std::min(start, next->first);
+        end = std::max(end, next->second);
+        progress.received -= next->second - next->first;
+        next = progress.done.erase(next);
+    }
+    progress.done[start] = end;
+    progress.received += end - start;
+
+    if (progress.received < progress.fileSize) return ChunkStatus::Partial;
+    chunkUploads.erase(it);
+    if (promoteStaged(basename, expectedCrc)) return ChunkStatus::Complete;
+    return errno == EBADMSG ? ChunkStatus::Corrupt : ChunkStatus::Failed;
+}
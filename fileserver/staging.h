@@ -0,0 +1,69 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <string>
+#include <cstdint>
+
+struct PcdStats;
+
+/**
+ * @brief 上传暂存区
+ *
+ * 上传的数据先写入 filedir/.partial/<文件名>，接收完整后再存入 filedir/，
+ * 因此 filedir/ 中只会出现完整的文件。连接中断时暂存文件保留下来，
+ * filedir/.partial/.records/<文件名> 记录文件总大小和已确认写入的字节数，
+ * 客户端重新连接后用 QUERY 查询已有的字节数，只发送剩余部分。
+ * 进度记录、增量上传的临时文件和服务端自己的临时文件都不与暂存文件共用名字空间：
+ * 前两者在各自的子目录中，后者以 . 开头，而客户端的文件名不能以 . 开头。
+ * 暂存区和内容目录都位于 filedir/ 内部，保证改名和硬链接不会跨文件系统。
+ */
+
+// 创建暂存目录（服务端启动时调用）
+bool createStagingDir();
+
+// 暂存文件的路径
+std::string stagingPath(const std::string& basename);
+
+// 增量上传重建新版本的临时文件的路径（见 delta.h）
+std::string deltaPath(const std::string& basename);
+
+// 服务端自己的临时文件（例如替换文件名时的临时链接）的路径：暂存区中的 .<name>
+std::string stagingTempPath(const std::string& name);
+
+// 服务端已持有的字节数：没有暂存记录或总大小不一致时返回 0
+uint64_t stagedBytes(const std::string& basename, uint64_t fileSize);
+
+// 写入进度记录：文件总大小和已确认写入的字节数
+bool writeStagingRecord(const std::string& basename, uint64_t fileSize, uint64_t received);
+
+// 上传完成：把暂存文件存入内容目录、链接为 filedir/<basename>（见 blobstore.h），并删除进度记录；
+// expectedCrc 不为空且与整个文件的 CRC32C 不一致时删除暂存文件和进度记录，返回 false（errno 为 EBADMSG）
+bool promoteStaged(const std::string& basename, const uint32_t* expectedCrc);
+
+// 把 filedir/<basename> 中完整的 DATA binary 点云转存为 binary_compressed（见 pcd.h），同样经内容目录存入，
+// 并回收不再被引用的原内容；不是这种文件、压缩后没有变小或文件已被新的上传替换时不做改动并返回 false（磁盘线程中调用）
+bool compressStoredPcd(const std::string& basename);
+
+// 点云文件存入并回复客户端之后在线程池中调用，不占用连接：transcode 时转存为 binary_compressed
+// 并重新记入点云目录，再保存统计；streamed 为上传时一遍算出的统计，为空时读文件计算（见 pcdstats.h）
+void finishStoredPcd(const std::string& basename, bool transcode, const PcdStats* streamed);
+
+/*
+ * 多连接分块上传："CHUNK name\nsize offset length\n" + 分块数据
+ *
+ * 同一个文件的各个分块由不同的连接（可能在不同的事件循环线程上）并行接收，
+ * 每个连接各自打开同一个预分配好大小的暂存文件，把分块写到对应的偏移。
+ * 这里记录每个文件已经写完的区间，写完最后一个分块的连接在锁内把文件移入 filedir/，
+ * 因此文件只会以完整的形式出现。以下函数在磁盘线程中调用，内部加锁。
+ */
+enum class ChunkStatus { Partial, Complete, Failed, Corrupt };
+
+// 确保暂存文件存在并预分配为 fileSize 字节；同名文件的新一轮分块上传（大小不同）会重新创建
+bool prepareChunkTarget(const std::string& basename, uint64_t fileSize);
+
+// 记录 [offset, offset + length) 已写入；全部区间写完时把文件移入 filedir/ 并返回 Complete，
+// 此时整个文件与 expectedCrc（不为空时）不一致则丢弃整个文件并返回 Corrupt
+ChunkStatus completeChunk(const std::string& basename, uint64_t fileSize, uint64_t offset, uint64_t length,
+                          const uint32_t* expectedCrc);
+
+#endif // STAGING_H
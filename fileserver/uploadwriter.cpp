@@ -0,0 +1,185 @@
+#include "uploadwriter.h"
+#include "crc32c.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr size_t POOL_BUFFERS = 64;  // 缓冲池的块数上限（所有连接共用）
+
+static std::mutex poolMutex;
+static std::vector<char*> freeBuffers;
+static size_t allocatedBuffers = 0;
+
+/**
+ * @brief 从缓冲池取一块对齐的缓冲区
+ *
+ * 达到上限时返回空指针，调用方暂停接收；但一个还没有持有任何块的连接总能分配到一块，
+ * 否则它没有正在进行的写入可以唤醒它。
+ */
+static char* acquireBuffer(bool holdsNone) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!freeBuffers.empty()) {
+        char* buf = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buf;
+    }
+    if (allocatedBuffers >= POOL_BUFFERS && !holdsNone) return nullptr;
+    void* mem = nullptr;
+    if (posix_memalign(&mem, UploadWriter::ALIGN, UploadWriter::UPLOAD_BLOCK) != 0) return nullptr;
+    ++allocatedBuffers;
+    return static_cast<char*>(mem);
+}
+
+// 归还缓冲区；超出上限时分配的块直接释放
+static void releaseBuffer(char* buf) {
+    if (!buf) return;
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (allocatedBuffers > POOL_BUFFERS) {
+        --allocatedBuffers;
+        free(buf);
+        return;
+    }
+    freeBuffers.push_back(buf);
+}
+
+UploadWriter::~UploadWriter() {
+    release();
+}
+
+void UploadWriter::start(int fileFd, uint64_t offset, bool checksum) {
+    fd = fileFd;
+    int flags = fcntl(fd, F_GETFL);
+    direct = directOn = flags >= 0 && (flags & O_DIRECT);
+    nextOffset = flushedOffset = offset;
+    writeOk = true;
+    checksumming = checksum;
+    crc = 0;
+}
+
+bool UploadWriter::acceptsData() {
+    if (current.data) return true;
+    if (queue.size() + (busy ? 1 : 0) >= MAX_QUEUED) return false;
+    current.data = acquireBuffer(queue.empty() && !busy);
+    if (!current.data) return false;
+    current.length = 0;
+    current.offset = nextOffset;
+    return true;
+}
+
+char* UploadWriter::space() {
+    return current.data + current.length;
+}
+
+// 文件偏移不对齐时这一块只收到下一个对齐边界为止，之后每块都从对齐的偏移开始
+size_t UploadWriter::room() const {
+    if (!current.data) return 0;
+    return UPLOAD_BLOCK - current.offset % ALIGN - current.length;
+}
+
+// 数据刚收到、还在 CPU 缓存中时顺便计算校验和，不需要再读一遍
+void UploadWriter::commit(size_t n) {
+    if (checksumming) crc = crc32c(crc, current.data + current.length, n);
+    current.length += n;
+}
+
+bool UploadWriter::full() const {
+    return current.data && room() == 0;
+}
+
+void UploadWriter::seal() {
+    if (!current.data || current.length == 0) return;
+    nextOffset = current.offset + current.length;
+    queue.push_back(current);
+    current = Block();
+}
+
+bool UploadWriter::idle() const {
+    return !busy && queue.empty() && (!current.data || current.length == 0);
+}
+
+bool UploadWriter::startWrite() {
+    if (busy || queue.empty()) return false;
+    writing = queue.front();
+    queue.pop_front();
+    busy = true;
+    return true;
+}
+
+void UploadWriter::writeBlock() {
+    writeOk = writeOut(writing);
+    writeErrno = errno;
+}
+
+bool UploadWriter::finishWrite() {
+    busy = false;
+    if (!writeOk) {
+        // 未写完的部分放回队首，上传中断时由 flushAll 再试一次
+        queue.push_front(writing);
+        writing = Block();
+        errno = writeErrno;
+        return false;
+    }
+    flushedOffset = writing.offset + writing.length;
+    releaseBuffer(writing.data);
+    writing = Block();
+    return true;
+}
+
+bool UploadWriter::flushAll() {
+    seal();
+    while (!queue.empty()) {
+        Block& block = queue.front();
+        if (!writeOut(block)) return false;
+        flushedOffset = block.offset + block.length;
+        releaseBuffer(block.data);
+        queue.pop_front();
+    }
+    return true;
+}
+
+bool UploadWriter::setDirect(bool on) {
+    if (directOn == on) return true;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, on ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) < 0) return false;
+    directOn = on;
+    return true;
+}
+
+// 写出一个块；O_DIRECT 只用于偏移和长度都对齐的整块，其余部分经页缓存写入
+bool UploadWriter::writeOut(Block& block) {
+    if (direct && !setDirect(block.offset % ALIGN == 0 && block.length % ALIGN == 0)) return false;
+    size_t done = 0;
+    while (done < block.length) {
+        ssize_t n = pwrite(fd, block.data + done, block.length - done, block.offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            // 已写入的部分仍然有效，剩余数据移到块的开头
+            int saved = errno;
+            block.offset += done;
+            block.length -= done;
+            std::memmove(block.data, block.data + done, block.length);
+            errno = saved;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void UploadWriter::release() {
+    releaseBuffer(current.data);
+    current = Block();
+    for (Block& block : queue) releaseBuffer(block.data);
+    queue.clear();
+    fd = -1;
+}
+
+void preallocateUpload(int fd, uint64_t offset, uint64_t length) {
+    // 文件系统不支持时忽略，写入照常进行
+    if (length > 0) fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length);
+}
@@ -0,0 +1,86 @@
+#ifndef UPLOADWRITER_H
+#define UPLOADWRITER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+
+/**
+ * @brief 上传文件的写入引擎（Stream/Direct 上传模式），网络接收与写盘流水线进行
+ *
+ * 接收到的数据先攒在按 ALIGN 对齐的 UPLOAD_BLOCK 大小的块中，块满后放入本连接的写队列，
+ * 由专用的写盘线程在后台按顺序以对齐的文件偏移整块 pwrite；事件循环同时从缓冲池取一块新缓冲区
+ * 继续接收，网络和磁盘的吞吐因此重叠而不是相加。每个连接最多 MAX_QUEUED 块在排队或写入，
+ * 缓冲池的总块数也有上限，超出时 acceptsData 返回 false，连接暂停从 socket 读取（背压），
+ * 等写盘追上之后再继续。
+ *
+ * Direct 模式下文件以 O_DIRECT 打开，写入绕过页缓存，几个 GB 的上传不会把下载依赖的热数据
+ * 挤出页缓存；O_DIRECT 要求偏移和长度都按块对齐，续传时不对齐的头部和文件末尾不足一块的尾部
+ * 临时关闭 O_DIRECT 写入。
+ *
+ * 同一时间最多一个块在写盘：写盘线程只访问这个块，其余成员只在事件循环线程中访问；
+ * 块按顺序写完，已写入的数据始终是从起始偏移开始的连续区间。
+ */
+class UploadWriter {
+public:
+    static constexpr size_t ALIGN = 4096;
+    static constexpr size_t UPLOAD_BLOCK = 1024 * 1024;
+    static constexpr size_t MAX_QUEUED = 4;  // 每个连接排队和写入中的块数上限
+
+    UploadWriter() = default;
+    ~UploadWriter();
+
+    UploadWriter(const UploadWriter&) = delete;
+    UploadWriter& operator=(const UploadWriter&) = delete;
+
+    // 开始写入 fd 的 offset 处；fd 以 O_DIRECT 打开时按 Direct 模式写入；
+    // checksum 为 true 时对交给写入引擎的数据计算 CRC32C
+    void start(int fd, uint64_t offset, bool checksum);
+
+    // 当前块可以接收数据：必要时从缓冲池取一块；写队列已满或缓冲池耗尽时返回 false
+    bool acceptsData();
+    char* space();        // 接收数据的位置
+    size_t room() const;  // 当前块剩余空间，保证之后的块从对齐的偏移开始
+    void commit(size_t n);
+    bool full() const;
+    void seal();          // 当前块（非空时）放入写队列
+    bool idle() const;    // 所有数据都已写入文件
+
+    bool startWrite();    // 事件循环线程：取出队首的块交给写盘线程，没有可写的块返回 false
+    void writeBlock();    // 写盘线程：写入 startWrite 取出的块
+    bool finishWrite();   // 事件循环线程：写入完成，归还缓冲区；失败时设置 errno 并返回 false
+
+    bool flushAll();      // 磁盘线程（没有块在写入时）：依次写出剩余的所有数据，用于上传中断
+    uint64_t flushed() const { return flushedOffset; }  // 已写入文件的连续数据的末尾偏移
+    uint32_t checksum() const { return crc; }           // 从起始偏移开始交给写入引擎的数据的 CRC32C
+    void release();       // 上传结束，归还所有缓冲区
+
+private:
+    struct Block {
+        char* data = nullptr;
+        size_t length = 0;
+        uint64_t offset = 0;  // 块在文件中的起始偏移
+    };
+
+    bool writeOut(Block& block);
+    bool setDirect(bool on);
+
+    int fd = -1;
+    bool direct = false;
+    bool directOn = false;      // fd 当前是否带有 O_DIRECT
+    Block current;              // 正在接收的块
+    std::deque<Block> queue;    // 等待写盘的块
+    Block writing;              // 写盘线程正在写入的块
+    bool busy = false;          // writing 是否有效
+    bool writeOk = true;
+    int writeErrno = 0;
+    uint64_t nextOffset = 0;    // 下一个块的起始偏移
+    uint64_t flushedOffset = 0;
+    bool checksumming = false;
+    uint32_t crc = 0;
+};
+
+// 按上传的范围预分配磁盘空间（FALLOC_FL_KEEP_SIZE：文件长度仍然只反映已写入的数据，续传依赖它）
+void preallocateUpload(int fd, uint64_t offset, uint64_t length);
+
+#endif // UPLOADWRITER_H
@@ -0,0 +1,125 @@
+#include "uring.h"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sysSetup(unsigned entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int sysRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+IoUring::~IoUring() {
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing) munmap(sqRing, sqRingSize);
+    if (ringFd >= 0) close(ringFd);
+}
+
+/**
+ * @brief 创建 io_uring 实例并映射提交/完成队列
+ *
+ * @param entries 提交队列长度，完成队列由内核设为其两倍
+ */
+bool IoUring::init(unsigned entries) {
+    io_uring_params p{};
+    ringFd = sysSetup(entries, &p);
+    if (ringFd < 0) return false;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return false;
+    }
+    if (singleMmap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            return false;
+        }
+    }
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) return false;
+    sqes = static_cast<io_uring_sqe*>(s);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqEntries = p.sq_entries;
+    sqeTail = sqeSubmitted = *sqTail;
+
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqeTail - head >= sqEntries) {
+        // 提交队列已满，先把已有请求交给内核
+        submitAndWait(0);
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqeTail - head >= sqEntries) return nullptr;
+    }
+    unsigned idx = sqeTail & sqMask;
+    io_uring_sqe* sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[idx] = idx;
+    ++sqeTail;
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitNr) {
+    unsigned toSubmit = sqeTail - sqeSubmitted;
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    sqeSubmitted = sqeTail;
+    if (toSubmit == 0 && waitNr == 0) return 0;
+    int r;
+    do {
+        r = sysEnter(ringFd, toSubmit, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0);
+    } while (r < 0 && errno == EINTR && waitNr == 0);
+    return r;
+}
+
+io_uring_cqe* IoUring::peekCqe() {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) return nullptr;
+    return &cqes[head & cqMask];
+}
+
+void IoUring::cqeSeen() {
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int IoUring::registerBuffers(const iovec* iovs, unsigned count) {
+    return sysRegister(ringFd, IORING_REGISTER_BUFFERS, iovs, count);
+}
+
+int IoUring::registerSparseFiles(unsigned count) {
+    std::vector<int> fds(count, -1);
+    return sysRegister(ringFd, IORING_REGISTER_FILES, fds.data(), count);
+}
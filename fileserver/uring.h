@@ -0,0 +1,60 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <cstdint>
+
+/**
+ * @brief io_uring 的最小封装
+ *
+ * 直接使用 io_uring_setup/io_uring_enter/io_uring_register 系统调用，不依赖 liburing。
+ * 只提供本项目需要的功能：取 SQE、提交并等待、遍历 CQE、注册固定缓冲区和固定文件。
+ * 非线程安全，只能在一个线程中使用。
+ */
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool init(unsigned entries);  // 失败返回 false，errno 保存原因
+
+    // 取一个清零的 SQE，提交队列已满时先提交已有的请求再取
+    io_uring_sqe* getSqe();
+    // 提交所有新的 SQE，并至少等待 waitNr 个完成事件
+    int submitAndWait(unsigned waitNr);
+    // 取下一个完成事件，没有则返回 nullptr；处理完后必须调用 cqeSeen
+    io_uring_cqe* peekCqe();
+    void cqeSeen();
+
+    int registerBuffers(const iovec* iovs, unsigned count);
+    int registerSparseFiles(unsigned count);  // 注册 count 个空槽位，供 OPENAT 直接安装固定文件
+
+private:
+    int ringFd = -1;
+    unsigned sqEntries = 0;
+
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned sqeTail = 0;      // 本地已分配的 SQE 尾部
+    unsigned sqeSubmitted = 0; // 已写入内核尾指针的位置
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+#endif // URING_H
@@ -0,0 +1,1187 @@
+#include "uring_server.h"
+#include "staging.h"
+#include "blobstore.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "pcd.h"
+#include "pcdcatalog.h"
+#include "pcdstats.h"
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+constexpr unsigned RING_ENTRIES = 4096;
+constexpr int MAX_CONNS = 1024;            // 同时在线的连接数，也是固定文件表的大小
+constexpr int NUM_BUFFER_PAIRS = 128;       // 同时进行的传输数，超出的连接排队等待缓冲区
+constexpr size_t URING_CHUNK = 64 * 1024;   // 每块缓冲区的大小
+constexpr size_t MAX_LINE = 4096;
+constexpr size_t MAX_CHALLENGES = 4096;  // 每个连接最多保留的秒传挑战，超过后直接要求上传
+constexpr uint32_t ACCEPT_SLOT = 0xFFFFFFFF;
+constexpr uint32_t TICK_SLOT = 0xFFFFFFFE;  // 空闲检查定时器
+constexpr uint32_t DONE_SLOT = 0xFFFFFFFD;  // 线程池任务完成通知
+
+// user_data 编码：第 16 位起为连接号，8~15 位为缓冲区下标，低 8 位为操作类型
+static uint64_t encode(uint32_t slot, int buf, uint8_t op) {
+    return (uint64_t(slot) << 16) | (uint64_t(buf & 0xFF) << 8) | op;
+}
+
+// 取一个 SQE；提交队列满时 getSqe 会先提交，内核立即取走 SQE，因此循环很快结束
+static io_uring_sqe* nextSqe(IoUring& ring) {
+    io_uring_sqe* sqe;
+    while (!(sqe = ring.getSqe())) ring.submitAndWait(0);
+    return sqe;
+}
+
+UringServer::UringServer(int listenFd, const ServerConfig& config, size_t diskThreads)
+    : listenFd(listenFd), config(config), pool(diskThreads) {}
+
+UringServer::~UringServer() {
+    if (eventFd >= 0) close(eventFd);
+    if (bufferMem) munmap(bufferMem, size_t(NUM_BUFFER_PAIRS) * 2 * URING_CHUNK);
+}
+
+bool UringServer::init() {
+    if (!ring.init(RING_ENTRIES)) {
+        std::cerr << "创建 io_uring 失败: " << strerror(errno) << std::endl;
+        return false;
+    }
+    // io_uring 的 accept 会在套接字上异步等待，监听套接字恢复为阻塞模式
+    int flags = fcntl(listenFd, F_GETFL, 0);
+    if (flags != -1) fcntl(listenFd, F_SETFL, flags & ~O_NONBLOCK);
+
+    eventFd = eventfd(0, EFD_CLOEXEC);
+    if (eventFd < 0) {
+        std::cerr << "创建 eventfd 失败: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // 固定文件表：OPENAT 直接把磁盘文件安装到连接号对应的槽位
+    if (ring.registerSparseFiles(MAX_CONNS) < 0) {
+        std::cerr << "注册固定文件表失败: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // 固定缓冲区：注册失败（例如超出 memlock 限制）时退回普通的 READ/WRITE
+    size_t total = size_t(NUM_BUFFER_PAIRS) * 2 * URING_CHUNK;
+    void* mem = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "分配缓冲区失败: " << strerror(errno) << std::endl;
+        return false;
+    }
+    bufferMem = static_cast<char*>(mem);
+    std::vector<iovec> iovs(NUM_BUFFER_PAIRS * 2);
+    for (size_t i = 0; i < iovs.size(); ++i) {
+        iovs[i].iov_base = bufferMem + i * URING_CHUNK;
+        iovs[i].iov_len = URING_CHUNK;
+    }
+    fixedBuffers = ring.registerBuffers(iovs.data(), iovs.size()) == 0;
+    if (!fixedBuffers) {
+        std::cerr << "注册固定缓冲区失败，使用普通读写: " << strerror(errno) << std::endl;
+    }
+
+    conns.resize(MAX_CONNS);
+    for (int i = MAX_CONNS - 1; i >= 0; --i) freeSlots.push_back(i);
+    for (int i = NUM_BUFFER_PAIRS - 1; i >= 0; --i) freePairs.push_back(i);
+    return true;
+}
+
+void UringServer::run() {
+    submitAccept();
+    submitDiskWait();
+    if (config.idleTimeout > 0) submitTick();
+    while (true) {
+        int r = ring.submitAndWait(1);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            std::cerr << "io_uring_enter 失败: " << strerror(errno) << std::endl;
+            return;
+        }
+        while (io_uring_cqe* cqe = ring.peekCqe()) {
+            uint64_t userData = cqe->user_data;
+            int res = cqe->res;
+            ring.cqeSeen();
+            dispatch(userData, res);
+        }
+    }
+}
+
+char* UringServer::bufferAddr(const Conn& c, int buf) const {
+    return bufferMem + (size_t(c.pair) * 2 + buf) * URING_CHUNK;
+}
+
+/**
+ * @brief 填写一个 SQE 并计入连接的未完成请求数
+ *
+ * 文件操作使用固定文件（槽位号 = 连接号）和固定缓冲区，网络操作使用普通 socket。
+ */
+void UringServer::prep(Conn& c, Op op, int buf, io_uring_sqe* sqe) {
+    sqe->user_data = encode(c.slot, buf, op);
+    ++c.inflight;
+}
+
+void UringServer::submitAccept() {
+    io_uring_sqe* sqe = nextSqe(ring);
+    acceptLen = sizeof(acceptAddr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->addr = (uint64_t)&acceptAddr;
+    sqe->addr2 = (uint64_t)&acceptLen;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = encode(ACCEPT_SLOT, 0, OpAccept);
+}
+
+void UringServer::submitRecvLine(Conn& c) {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c.sock;
+    sqe->addr = (uint64_t)c.lineBuf;
+    sqe->len = sizeof(c.lineBuf);
+    prep(c, OpRecvLine, 0, sqe);
+}
+
+// 提交一个 1 秒后到期的超时请求，到期时检查空闲连接
+void UringServer::submitTick() {
+    io_uring_sqe* sqe = nextSqe(ring);
+    tickTs.tv_sec = 1;
+    tickTs.tv_nsec = 0;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)&tickTs;
+    sqe->len = 1;
+    sqe->user_data = encode(TICK_SLOT, 0, OpTick);
+}
+
+// 关闭超过 idleTimeout 没有任何完成事件的连接；排队等待缓冲区的连接不算空闲
+void UringServer::sweepIdle() {
+    auto now = std::chrono::steady_clock::now();
+    // 顺便丢弃下载缓存中已失效的条目
+    sweepFileCache();
+    for (int slot = 0; slot < MAX_CONNS; ++slot) {
+        Conn* c = conns[slot].get();
+        if (!c || c->closing) continue;
+        if (c->lent) {
+            c->lent->checkIdle(now);
+            updateLent(*c);
+            continue;
+        }
+        if ((c->phase == Phase::Upload || c->phase == Phase::Download) && c->pair < 0 && !c->cached) continue;
+        if (now - c->lastActive < std::chrono::seconds(config.idleTimeout)) continue;
+        if (c->phase == Phase::Upload) {
+            fail(*c, "连接空闲超时，接收文件不完整: " + c->peer);
+        } else {
+            std::cout << "连接空闲超时: " << c->peer << std::endl;
+            teardown(*c);
+        }
+    }
+}
+
+void UringServer::dispatch(uint64_t userData, int res) {
+    uint32_t slot = userData >> 16;
+    int buf = (userData >> 8) & 0xFF;
+    Op op = Op(userData & 0xFF);
+    if (slot == ACCEPT_SLOT) {
+        onAccept(res);
+        return;
+    }
+    if (slot == TICK_SLOT) {
+        sweepIdle();
+        submitTick();
+        return;
+    }
+    if (slot == DONE_SLOT) {
+        drainDiskCompletions();
+        submitDiskWait();
+        return;
+    }
+    Conn& c = *conns[slot];
+    --c.inflight;
+    c.lastActive = std::chrono::steady_clock::now();
+    if (c.closing) {
+        // 关闭流程中只记录文件状态，其余完成事件直接丢弃
+        if (op == OpOpen && res >= 0) c.fileOpen = true;
+        if (op == OpCloseFile) c.fileOpen = false;
+        if (op == OpWrite && res > 0) c.bufOff[buf] += res;  // 用于计算已连续写入的字节数
+        advanceClose(c);
+        return;
+    }
+    // 处理函数可能回收连接，之后不能再访问 c
+    switch (op) {
+        case OpRecvLine:   onRecvLine(c, res); break;
+        case OpStat:       onStat(c, res); break;
+        case OpOpen:       onOpen(c, res); break;
+        case OpRecv:       onRecv(c, buf, res); break;
+        case OpWrite:      onWrite(c, buf, res); break;
+        case OpRead:       onRead(c, buf, res); break;
+        case OpSendHeader: onSendHeader(c, res); break;
+        case OpSend:       onSend(c, buf, res); break;
+        case OpSendCached: onSendCached(c, res); break;
+        case OpCloseFile:  onCloseFile(c); break;
+        case OpFallocate:  break;  // 预分配失败不影响写入
+        case OpPoll:       onPoll(c, res); break;
+        case OpPollRemove: break;
+        default: break;
+    }
+}
+
+void UringServer::onAccept(int res) {
+    submitAccept();
+    if (res < 0) return;
+    if (freeSlots.empty()) {
+        close(res);  // 连接数已满
+        return;
+    }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    conns[slot] = std::make_unique<Conn>();
+    Conn& c = *conns[slot];
+    c.slot = slot;
+    c.sock = res;
+    c.lastActive = std::chrono::steady_clock::now();
+
+    //获取客户端的IP地址和端口号
+    char ipStr[INET_ADDRSTRLEN] = {0};
+    auto* addr = reinterpret_cast<sockaddr_in*>(&acceptAddr);
+    inet_ntop(AF_INET, &addr->sin_addr, ipStr, sizeof(ipStr));
+    c.peer = std::string(ipStr) + ":" + std::to_string(ntohs(addr->sin_port));
+    submitRecvLine(c);
+}
+
+void UringServer::onRecvLine(Conn& c, int res) {
+    if (res <= 0) {
+        // 如果接收失败或连接关闭，关闭客户端连接
+        if (c.phase == Phase::ReadSize) std::cerr << "客户端关闭了连接" << std::endl;
+        teardown(c);
+        return;
+    }
+    c.inBuf.append(c.lineBuf, res);
+    if (parseLines(c)) submitRecvLine(c);
+}
+
+/**
+ * @brief 解析已接收的命令行和大小行
+ *
+ * 命令之后已经收到的文件数据留在 inBuf 中，由上传流程先写入文件。
+ *
+ * @return 还需要继续接收行数据时返回 true
+ */
+bool UringServer::parseLines(Conn& c) {
+    while (true) {
+        std::string line;
+        if (!c.inBuf.getLine(line)) {
+            if (c.inBuf.size() > MAX_LINE) {
+                teardown(c);
+                return false;
+            }
+            return true;
+        }
+
+        if (c.phase == Phase::ReadCommand) {
+            Command cmd = parseCommand(line);
+            c.basename = cmd.basename;
+            c.fullpath = "filedir/" + c.basename;
+            if (!cmd.error.empty()) {
+                c.closeAfterReply = cmd.closeOnError;
+                reply(c, cmd.error);
+                return false;
+            }
+            // 快速路径只处理普通的传输，压缩传输、校验传输、增量上传、点云处理、BOX 查询和 MERGE 合并下载
+            // 交给共用的 Connection 处理
+            bool transfer = cmd.type == CommandType::Upload || cmd.type == CommandType::Chunk ||
+                            cmd.type == CommandType::Download;
+            if (((cmd.compress || cmd.verify) && transfer) || (cmd.type == CommandType::Download && cmd.transform.active()) ||
+                cmd.type == CommandType::Signature || cmd.type == CommandType::Delta || cmd.type == CommandType::Box ||
+                cmd.type == CommandType::Merge) {
+                lend(c, line);
+                return false;
+            }
+            switch (cmd.type) {
+            case CommandType::Exit:
+                std::cout << "断开连接: " << c.peer << std::endl;
+                teardown(c);
+                return false;
+            case CommandType::Upload:
+            case CommandType::Chunk:
+                if (cmd.type == CommandType::Upload) std::cout << "客户端 " << c.peer << " 请求上传文件" << std::endl;
+                c.chunked = cmd.type == CommandType::Chunk;
+                c.phase = Phase::ReadSize;
+                break;
+            case CommandType::Query:
+                // 查询未完成的上传已经收到了多少字节："QUERY name size\n" -> "OK <bytes>\n"
+                c.fileSize = cmd.size;
+                runDisk(c, [&c] {
+                    c.diskResult = stagedBytes(c.basename, c.fileSize);
+                }, [this, &c] {
+                    reply(c, "OK " + std::to_string(c.diskResult) + "\n");
+                });
+                return false;
+            case CommandType::Hash: {
+                // 秒传第一步："HASH name size sha256\n"，服务端已有这份内容时回复挑战 "PROVE <offset> <length> <nonce>\n"，
+                // 否则回复 "NEED lzf crc32c\n"，同时告知客户端可以压缩上传和校验上传（见 blobstore.h）
+                c.fileSize = cmd.size;
+                auto challenge = std::make_shared<BlobChallenge>();
+                bool room = c.challenges.size() < MAX_CHALLENGES;
+                runDisk(c, [&c, hex = cmd.digest, challenge, room] {
+                    c.diskResult = room && challengeBlob(hex, c.fileSize, *challenge) ? 0 : -1;
+                }, [this, &c, challenge] {
+                    if (c.diskResult < 0) {
+                        reply(c, std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n");
+                        return;
+                    }
+                    reply(c, "PROVE " + std::to_string(challenge->offset) + " " + std::to_string(challenge->length) + " " +
+                             challenge->nonce + "\n");
+                    c.challenges[c.basename] = std::move(*challenge);
+                });
+                return false;
+            }
+            case CommandType::Proof: {
+                // 秒传第二步："PROOF name answer\n"，回答正确时链接为该文件名并回复 "OK <size>\n"，否则回复 "NEED lzf crc32c\n"
+                auto it = c.challenges.find(c.basename);
+                if (it == c.challenges.end()) {
+                    reply(c, std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n");
+                    return false;
+                }
+                auto challenge = std::make_shared<BlobChallenge>(std::move(it->second));
+                c.challenges.erase(it);
+                c.fileSize = challenge->size;
+                runDisk(c, [&c, challenge, answer = cmd.answer] {
+                    c.diskResult = linkBlob(*challenge, answer, c.basename) ? 0 : -1;
+                    if (c.diskResult == 0) recordPcdFile(c.basename, nullptr);
+                }, [this, &c] {
+                    if (c.diskResult < 0) {
+                        std::cerr << "秒传证明不正确: " << c.basename << " 来自 " << c.peer << std::endl;
+                        reply(c, std::string("NEED ") + COMPRESS_OPTION + " " + CHECKSUM_OPTION + "\n");
+                        return;
+                    }
+                    std::cout << "秒传完成: " << c.basename << " (大小: " << c.fileSize << " 字节) 来自 " << c.peer << std::endl;
+                    afterStore(c, nullptr);
+                    reply(c, "OK " + std::to_string(c.fileSize) + "\n");
+                });
+                return false;
+            }
+            case CommandType::Find: {
+                // 点云元数据查询只访问内存中的目录，与 epoll 后端相同
+                std::vector<PcdMeta> found = findPcdFiles(cmd.query);
+                std::string lines;
+                for (const PcdMeta& meta : found) lines += formatPcdMeta(meta);
+                reply(c, "OK " + std::to_string(found.size()) + "\n" + lines);
+                return false;
+            }
+            case CommandType::Stat: {
+                // 点云统计："STAT name\n" -> 包围盒、点数和直方图（见 pcdstats.h）
+                auto stats = std::make_shared<PcdStats>();
+                auto error = std::make_shared<std::string>();
+                runDisk(c, [&c, stats, error] {
+                    loadPcdStats(c.basename, *stats, *error);
+                }, [this, &c, stats, error] {
+                    reply(c, error->empty() ? formatPcdStats(*stats) : "ERROR " + *error + "\n");
+                });
+                return false;
+            }
+            case CommandType::Download: {
+                std::cout << "客户端 " << c.peer << " 请求下载文件" << std::endl;
+                c.phase = Phase::Download;
+                c.range = cmd.range;
+                // 热点小文件直接从内存缓存发送，不访问文件系统
+                if (CachedFilePtr entry = lookupCachedFile(c.basename)) {
+                    sendCached(c, std::move(entry));
+                    return false;
+                }
+                io_uring_sqe* sqe = nextSqe(ring);
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)c.fullpath.c_str();
+                sqe->len = STATX_TYPE | STATX_SIZE;
+                sqe->off = (uint64_t)&c.stx;
+                prep(c, OpStat, 0, sqe);
+                return false;
+            }
+            default:
+                teardown(c);
+                return false;
+            }
+        } else {
+            SizeLine sizes;
+            std::string error;
+            if (!parseSizeLine(line, c.chunked, sizes, error)) {
+                std::cerr << error << std::endl;
+                teardown(c);
+                return false;
+            }
+            c.fileSize = sizes.size;
+            uint64_t offset = sizes.offset, length = sizes.length;
+            if (c.chunked) {
+                // 预分配整个暂存文件可能要分配大量磁盘块，并且要在所有分块之间加锁，交给线程池；
+                // 完成后按普通上传写入分块的范围，之前收到的分块数据留在 inBuf 中
+                runDisk(c, [&c] {
+                    c.diskResult = prepareChunkTarget(c.basename, c.fileSize) ? 0 : -1;
+                }, [this, &c, offset, length] {
+                    if (c.diskResult < 0) {
+                        fail(c, "无法创建文件: " + stagingPath(c.basename));
+                        return;
+                    }
+                    c.phase = Phase::Upload;
+                    c.fullpath = stagingPath(c.basename);
+                    c.netPos = c.diskPos = c.rangeStart = offset;
+                    c.rangeEnd = offset + length;
+                    startTransfer(c);
+                });
+                return false;
+            }
+            // 在线程池中检查续传位置并把进度记录先写成 offset，与 epoll 后端的 startUpload 相同
+            runDisk(c, [&c, offset] {
+                c.diskResult = 0;
+                if (offset > 0 && stagedBytes(c.basename, c.fileSize) < offset) {
+                    c.diskResult = -1;  // 续传位置无效
+                    return;
+                }
+                writeStagingRecord(c.basename, c.fileSize, offset);
+            }, [this, &c, offset] {
+                if (c.diskResult < 0) {
+                    // 随后的文件数据无法与命令区分，回复错误后关闭连接
+                    std::cerr << "续传位置无效: " << c.basename << " 偏移 " << offset << std::endl;
+                    c.closeAfterReply = true;
+                    reply(c, "ERROR 续传位置无效\n");
+                    return;
+                }
+                std::cout << "准备接收文件: " << c.basename << " (预期大小: " << c.fileSize << " 字节";
+                if (offset > 0) std::cout << "，从 " << offset << " 字节处续传";
+                std::cout << ") 来自 " << c.peer << std::endl;
+                // 写入暂存文件，从 offset 处继续接收
+                c.phase = Phase::Upload;
+                c.fullpath = stagingPath(c.basename);
+                c.netPos = c.diskPos = c.rangeStart = offset;
+                c.rangeEnd = c.fileSize;
+                startTransfer(c);
+            });
+            return false;
+        }
+    }
+}
+
+void UringServer::onStat(Conn& c, int res) {
+    if (res < 0 || !S_ISREG(c.stx.stx_mode)) {
+        // 如果文件不存在，发送错误信息，连接继续处理下一条命令
+        reply(c, "ERROR 文件不存在\n");
+        return;
+    }
+    c.fileSize = c.stx.stx_size;
+    if (cacheableSize(c.fileSize) && !c.range.probe()) {
+        // 小文件在线程池中整个读入缓存，本次和之后的下载都从内存发送；无法缓存时按普通方式传输
+        // 只查询大小时不读入，以免挤掉真正的热点文件
+        runDisk(c, [&c] {
+            uint64_t generation = fileCacheGeneration(c.basename);
+            int fd = open(c.fullpath.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st{};
+            if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                c.cached = loadCachedFile(fd, st.st_size, generation);
+            }
+            if (fd >= 0) close(fd);
+        }, [this, &c] {
+            if (c.cached) {
+                keepCachedFile(c.basename, c.cached);
+                sendCached(c, std::move(c.cached));
+            } else if (!c.range.resolve(c.fileSize)) {
+                reply(c, "ERROR 范围无效\n");
+            } else {
+                c.netPos = c.diskPos = c.rangeStart = c.range.offset;
+                c.rangeEnd = c.range.offset + c.range.length;
+                startTransfer(c);
+            }
+        });
+        return;
+    }
+    if (!c.range.resolve(c.fileSize)) {
+        reply(c, "ERROR 范围无效\n");
+        return;
+    }
+    // 只读取并发送请求的范围
+    c.netPos = c.diskPos = c.rangeStart = c.range.offset;
+    c.rangeEnd = c.range.offset + c.range.length;
+    startTransfer(c);
+}
+
+// 取得一对缓冲区后打开文件；缓冲区不足时排队等待
+void UringServer::startTransfer(Conn& c) {
+    if (freePairs.empty()) {
+        waiters.push_back(c.slot);
+        return;
+    }
+    c.pair = freePairs.back();
+    freePairs.pop_back();
+    openFile(c);
+}
+
+void UringServer::openFile(Conn& c) {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)c.fullpath.c_str();
+    // 固定文件不属于进程的文件描述符表，不能带 O_CLOEXEC
+    if (c.phase == Phase::Upload) {
+        // 新上传截断暂存文件，续传和分块上传保留已有的数据
+        if (c.chunked) {
+            sqe->open_flags = O_WRONLY;
+        } else {
+            sqe->open_flags = O_WRONLY | O_CREAT | (c.netPos == 0 ? O_TRUNC : 0);
+        }
+        sqe->len = 0644;
+    } else {
+        sqe->open_flags = O_RDONLY;
+    }
+    sqe->file_index = c.slot + 1;  // 直接安装到固定文件表，槽位号从 1 开始编码
+    prep(c, OpOpen, 0, sqe);
+}
+
+void UringServer::onOpen(Conn& c, int res) {
+    if (res < 0) {
+        if (c.phase == Phase::Upload) {
+            std::cerr << "无法创建文件: " << c.fullpath << std::endl;
+            teardown(c);
+        } else {
+            // 没有打开文件，直接归还缓冲区对
+            releasePair(c);
+            reply(c, "ERROR 文件不存在\n");
+        }
+        return;
+    }
+    c.fileOpen = true;
+
+    if (c.phase == Phase::Upload) {
+        c.staged = !c.chunked;  // 分块上传不写进度记录，不完整的分块由客户端重传
+        if (!c.chunked) {
+            // 文件大小事先已知，异步预分配剩余部分（KEEP_SIZE：文件长度仍只反映已写入的数据）；
+            // 结果不影响写入，失败时照常写入。分块上传的文件已经整体预分配过
+            io_uring_sqe* sqe = nextSqe(ring);
+            sqe->opcode = IORING_OP_FALLOCATE;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = c.slot;
+            sqe->off = c.netPos;
+            sqe->addr = c.rangeEnd - c.netPos;
+            sqe->len = FALLOC_FL_KEEP_SIZE;
+            prep(c, OpFallocate, 0, sqe);
+        }
+        // 从头开始的上传在写盘之前把数据依次交给统计，分块和续传在文件存入后统计
+        c.statsBuilder.start(c.chunked ? std::string() : c.basename, c.netPos);
+        // 命令之后已经收到的数据先写入文件
+        size_t early = c.inBuf.take(bufferAddr(c, 0), std::min(URING_CHUNK, c.rangeEnd - c.netPos));
+        c.statsBuilder.feed(c.netPos, bufferAddr(c, 0), early);
+        if (early > 0) {
+            c.bufState[0] = BufState::Disk;
+            c.bufLen[0] = early;
+            c.bufOff[0] = 0;
+            c.bufFileOff[0] = c.netPos;
+            c.netPos += early;
+            submitWrite(c, 0);
+        }
+        pumpUpload(c);
+    } else {
+        std::cout << "准备发送文件: " << c.basename << " (总大小: " << c.fileSize << " 字节";
+        if (c.range.ranged) std::cout << "，范围: " << c.range.offset << "+" << c.range.length;
+        std::cout << ") 发送至 " << c.peer << std::endl;
+        c.outBuf = c.range.header(c.fileSize);
+        c.outOff = 0;
+        c.replyOnly = false;
+        sendHeader(c);
+        pumpDownload(c);  // 发送响应头的同时开始读盘
+    }
+}
+
+// 发送一行响应，发送完成后处理下一条命令
+void UringServer::reply(Conn& c, const std::string& msg) {
+    c.outBuf = msg;
+    c.outOff = 0;
+    c.replyOnly = true;
+    sendHeader(c);
+}
+
+void UringServer::sendHeader(Conn& c) {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c.sock;
+    sqe->addr = (uint64_t)(c.outBuf.data() + c.outOff);
+    sqe->len = c.outBuf.size() - c.outOff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    prep(c, OpSendHeader, 0, sqe);
+}
+
+void UringServer::onSendHeader(Conn& c, int res) {
+    if (res < 0) {
+        teardown(c);
+        return;
+    }
+    c.outOff += res;
+    if (c.outOff < c.outBuf.size()) {
+        sendHeader(c);
+        return;
+    }
+    if (c.closeAfterReply) {
+        teardown(c);
+        return;
+    }
+    if (c.replyOnly) {
+        nextCommand(c);
+        return;
+    }
+    c.headerSent = true;
+    if (c.cached) {
+        pumpCached(c);
+        return;
+    }
+    pumpDownload(c);
+}
+
+/**
+ * @brief 推进上传：同一时间最多一个 recv 和若干写盘请求
+ *
+ * recv 总是按顺序接收到空闲的缓冲区，收到后立即提交 WRITE_FIXED 写到对应偏移，
+ * 同时用另一块缓冲区继续接收。recv 带 MSG_WAITALL，收满到下一个 URING_CHUNK 边界才完成，
+ * 因此除了头尾，每次写盘都是按 URING_CHUNK 对齐的整块。
+ */
+void UringServer::pumpUpload(Conn& c) {
+    if (c.diskPos == c.rangeEnd) {
+        if (!c.chunked) std::cout << "上传完成: " << c.basename << " (大小: " << c.diskPos << " 字节) 来自 " << c.peer << std::endl;
+        finishTransfer(c);
+        return;
+    }
+    if (c.netBusy || c.netPos >= c.rangeEnd) return;
+    for (int b = 0; b < 2; ++b) {
+        if (c.bufState[b] != BufState::Free) continue;
+        c.bufState[b] = BufState::Net;
+        c.bufFileOff[b] = c.netPos;
+        io_uring_sqe* sqe = nextSqe(ring);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = c.sock;
+        sqe->addr = (uint64_t)bufferAddr(c, b);
+        sqe->len = std::min(URING_CHUNK - c.netPos % URING_CHUNK, c.rangeEnd - c.netPos);
+        sqe->msg_flags = MSG_WAITALL;
+        prep(c, OpRecv, b, sqe);
+        c.netBusy = true;
+        return;
+    }
+}
+
+void UringServer::onRecv(Conn& c, int buf, int res) {
+    c.netBusy = false;
+    if (res <= 0) {
+        c.bufState[buf] = BufState::Free;
+        if (res == 0) {
+            fail(c, "客户端断开连接，接收文件不完整");
+        } else {
+            fail(c, std::string("接收文件数据失败: ") + strerror(-res));
+        }
+        return;
+    }
+    c.bufState[buf] = BufState::Disk;
+    c.bufLen[buf] = res;
+    c.bufOff[buf] = 0;
+    c.statsBuilder.feed(c.netPos, bufferAddr(c, buf), res);
+    c.netPos += res;
+    submitWrite(c, buf);
+    pumpUpload(c);
+}
+
+// 把缓冲区中尚未写盘的部分写到文件的对应偏移
+void UringServer::submitWrite(Conn& c, int buf) {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = c.slot;
+    sqe->addr = (uint64_t)(bufferAddr(c, buf) + c.bufOff[buf]);
+    sqe->len = c.bufLen[buf] - c.bufOff[buf];
+    sqe->off = c.bufFileOff[buf] + c.bufOff[buf];
+    sqe->buf_index = c.pair * 2 + buf;
+    prep(c, OpWrite, buf, sqe);
+}
+
+void UringServer::onWrite(Conn& c, int buf, int res) {
+    if (res <= 0) {
+        fail(c, std::string("写入文件失败: ") + strerror(res < 0 ? -res : EIO));
+        return;
+    }
+    c.bufOff[buf] += res;
+    if (c.bufOff[buf] < c.bufLen[buf]) {
+        submitWrite(c, buf);  // 部分写入，继续写剩余部分
+        return;
+    }
+    c.bufState[buf] = BufState::Free;
+    size_t before = c.diskPos;
+    c.diskPos += c.bufLen[buf];
+    reportProgress(c, "已接收", before, c.diskPos);
+    pumpUpload(c);
+}
+
+/**
+ * @brief 推进下载：一块缓冲区在读盘的同时，另一块按顺序发送
+ */
+void UringServer::pumpDownload(Conn& c) {
+    if (c.netPos == c.rangeEnd && c.headerSent) {
+        std::cout << "下载完成: " << c.basename << " (总大小: " << c.fileSize << " 字节) 发送至 " << c.peer << std::endl;
+        finishTransfer(c);
+        return;
+    }
+    if (!c.diskBusy && c.diskPos < c.rangeEnd) {
+        for (int b = 0; b < 2; ++b) {
+            if (c.bufState[b] != BufState::Free) continue;
+            c.bufState[b] = BufState::Disk;
+            c.bufFileOff[b] = c.diskPos;
+            io_uring_sqe* sqe = nextSqe(ring);
+            sqe->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = c.slot;
+            sqe->addr = (uint64_t)bufferAddr(c, b);
+            sqe->len = std::min(URING_CHUNK, c.rangeEnd - c.diskPos);
+            sqe->off = c.diskPos;
+            sqe->buf_index = c.pair * 2 + b;
+            prep(c, OpRead, b, sqe);
+            c.diskBusy = true;
+            break;
+        }
+    }
+    if (c.headerSent && !c.netBusy && !c.ready.empty()) {
+        int b = c.ready.front();
+        c.bufState[b] = BufState::Net;
+        io_uring_sqe* sqe = nextSqe(ring);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c.sock;
+        sqe->addr = (uint64_t)(bufferAddr(c, b) + c.bufOff[b]);
+        sqe->len = c.bufLen[b] - c.bufOff[b];
+        sqe->msg_flags = MSG_NOSIGNAL;
+        prep(c, OpSend, b, sqe);
+        c.netBusy = true;
+    }
+}
+
+void UringServer::onRead(Conn& c, int buf, int res) {
+    c.diskBusy = false;
+    if (res <= 0) {
+        fail(c, std::string("读取文件失败: ") + strerror(res < 0 ? -res : EIO));
+        return;
+    }
+    c.bufState[buf] = BufState::Ready;
+    c.bufLen[buf] = res;
+    c.bufOff[buf] = 0;
+    c.diskPos += res;
+    c.ready.push_back(buf);
+    pumpDownload(c);
+}
+
+void UringServer::onSend(Conn& c, int buf, int res) {
+    c.netBusy = false;
+    if (res < 0) {
+        fail(c, std::string("发送文件数据失败: ") + strerror(-res));
+        return;
+    }
+    c.bufOff[buf] += res;
+    if (c.bufOff[buf] < c.bufLen[buf]) {
+        c.bufState[buf] = BufState::Ready;  // 部分发送，留在队首继续发送
+        pumpDownload(c);
+        return;
+    }
+    c.ready.pop_front();
+    c.bufState[buf] = BufState::Free;
+    size_t before = c.netPos;
+    c.netPos += c.bufLen[buf];
+    reportProgress(c, "已发送", before, c.netPos);
+    pumpDownload(c);
+}
+
+// 从内存中的文件内容发送下载响应，完整文件使用缓存条目中预先生成的响应头
+void UringServer::sendCached(Conn& c, CachedFilePtr entry) {
+    c.fileSize = entry->data.size();
+    if (!c.range.resolve(c.fileSize)) {
+        reply(c, "ERROR 范围无效\n");
+        return;
+    }
+    c.phase = Phase::Download;
+    c.netPos = c.rangeStart = c.range.offset;
+    c.rangeEnd = c.range.offset + c.range.length;
+    c.outBuf = c.range.ranged ? c.range.header(c.fileSize) : entry->header;
+    c.outOff = 0;
+    c.replyOnly = false;
+    c.cached = std::move(entry);
+    sendHeader(c);
+}
+
+// 直接从缓存条目的内存发送剩余的范围，发送完后处理下一条命令
+void UringServer::pumpCached(Conn& c) {
+    if (c.netPos == c.rangeEnd) {
+        c.cached.reset();
+        nextCommand(c);
+        return;
+    }
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c.sock;
+    sqe->addr = (uint64_t)(c.cached->data.data() + c.netPos);
+    sqe->len = c.rangeEnd - c.netPos;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    prep(c, OpSendCached, 0, sqe);
+}
+
+void UringServer::onSendCached(Conn& c, int res) {
+    if (res < 0) {
+        fail(c, std::string("发送文件数据失败: ") + strerror(-res));
+        return;
+    }
+    c.netPos += res;
+    pumpCached(c);
+}
+
+// 传输结束：先关闭固定文件，完成后归还缓冲区对（onCloseFile）
+void UringServer::finishTransfer(Conn& c) {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = c.slot + 1;
+    prep(c, OpCloseFile, 0, sqe);
+}
+
+void UringServer::onCloseFile(Conn& c) {
+    c.fileOpen = false;
+    releasePair(c);
+    if (c.phase == Phase::Upload && c.chunked) {
+        // 记录分块区间；最后一个分块在回复之前把文件存入 filedir/（需要计算摘要，在线程池中执行）
+        runDisk(c, [&c] {
+            c.diskResult = (ssize_t)completeChunk(c.basename, c.fileSize, c.rangeStart, c.rangeEnd - c.rangeStart, nullptr);
+            if ((ChunkStatus)c.diskResult == ChunkStatus::Complete) recordPcdFile(c.basename, nullptr);
+        }, [this, &c] {
+            ChunkStatus status = (ChunkStatus)c.diskResult;
+            if (status == ChunkStatus::Failed) {
+                std::cerr << "保存分块失败: " << c.basename << " [" << c.rangeStart << ", " << c.rangeEnd << ")" << std::endl;
+                reply(c, "ERROR 保存文件失败\n");
+                return;
+            }
+            if (status == ChunkStatus::Complete) {
+                std::cout << "分块上传完成: " << c.basename << " (大小: " << c.fileSize << " 字节)" << std::endl;
+                afterStore(c, nullptr);
+            }
+            reply(c, "OK " + std::to_string(c.rangeEnd - c.rangeStart) + "\n");
+        });
+    } else if (c.phase == Phase::Upload) {
+        // 文件已完整写入并关闭，存入 filedir/ 后回复上传确认
+        c.staged = false;
+        auto stats = std::make_shared<PcdStats>();
+        auto streamed = std::make_shared<bool>(false);  // 统计已在接收时算出
+        runDisk(c, [&c, stats, streamed] {
+            c.diskResult = promoteStaged(c.basename, nullptr) ? 0 : -1;
+            c.diskErrno = errno;
+            if (c.diskResult == 0) recordPcdFile(c.basename, nullptr);
+            *streamed = c.diskResult == 0 && c.statsBuilder.finish(c.fileSize, *stats);
+            if (*streamed) savePcdStats(c.basename, *stats);
+        }, [this, &c, stats, streamed] {
+            if (c.diskResult < 0) {
+                std::cerr << "保存文件失败: " << c.basename << " " << strerror(c.diskErrno) << std::endl;
+                reply(c, "ERROR 保存文件失败\n");
+                return;
+            }
+            afterStore(c, *streamed ? stats : nullptr);
+            reply(c, "OK " + std::to_string(c.fileSize) + "\n");
+        });
+    } else {
+        nextCommand(c);
+    }
+}
+
+// 点云文件已存入并记入点云目录：回复之后在线程池中按配置转存、补算统计（见 finishStoredPcd），
+// 与 epoll 后端的 Connection::afterStore 相同
+void UringServer::afterStore(const Conn& c, std::shared_ptr<const PcdStats> streamed) {
+    if (!isPcdName(c.basename) || (streamed && !config.pcdCompress)) return;
+    std::string name = c.basename;
+    bool transcode = config.pcdCompress;
+    pool.enqueue([name, transcode, streamed] { finishStoredPcd(name, transcode, streamed.get()); });
+}
+
+/**
+ * @brief 把当前命令借给 Connection 处理
+ *
+ * line 为这条命令的原始命令行，连同 inBuf 中已收到的后续数据一起交给 Connection，
+ * 由它从头解析这条命令；之后按 Connection::interest 提交 POLL_ADD 推进（updateLent）。
+ */
+void UringServer::lend(Conn& c, const std::string& line) {
+    std::string pending = line + "\n";
+    std::string rest(c.inBuf.size(), '\0');
+    c.inBuf.take(&rest[0], rest.size());
+    pending += rest;
+    int flags = fcntl(c.sock, F_GETFL, 0);
+    if (flags != -1) fcntl(c.sock, F_SETFL, flags | O_NONBLOCK);
+    c.phase = Phase::Lent;
+    c.lent = std::make_unique<Connection>(c.sock, *this, config, pending);
+    lentSlots[c.sock] = c.slot;
+    c.lent->handleEvent(POLLIN);
+    updateLent(c);
+}
+
+/**
+ * @brief 借出的连接推进之后：结束、交还或按需要的事件重新提交 POLL_ADD
+ *
+ * Connection 的 interest 使用 epoll 的事件位，EPOLLIN/EPOLLOUT 与 poll 的 POLLIN/POLLOUT 数值相同。
+ * 需要的事件变化时先取消已提交的 POLL_ADD，等它完成后再提交新的。
+ */
+void UringServer::updateLent(Conn& c) {
+    Connection& lent = *c.lent;
+    if (lent.closed()) {
+        teardown(c);  // Connection 在连接回收时析构
+        return;
+    }
+    uint32_t want = lent.lendDone() ? 0 : lent.interest();
+    if (c.polled != want && c.polled != 0 && !c.pollRemoving) {
+        io_uring_sqe* sqe = nextSqe(ring);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = encode(c.slot, 0, OpPoll);
+        prep(c, OpPollRemove, 0, sqe);
+        c.pollRemoving = true;
+    }
+    if (lent.lendDone()) {
+        // 交还：Connection 多收到的输入留给下一条命令，socket 恢复为阻塞模式
+        std::string rest = lent.takeInput();
+        lentSlots.erase(c.sock);
+        c.lent.reset();
+        int flags = fcntl(c.sock, F_GETFL, 0);
+        if (flags != -1) fcntl(c.sock, F_SETFL, flags & ~O_NONBLOCK);
+        c.inBuf.append(rest.data(), rest.size());
+        nextCommand(c);
+        return;
+    }
+    if (c.polled != 0 || want == 0) return;
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c.sock;
+    sqe->poll32_events = want;
+    prep(c, OpPoll, 0, sqe);
+    c.polled = want;
+}
+
+// POLL_ADD 完成（或被取消）：socket 就绪时推进借出的连接；连接已交还时只记录状态
+void UringServer::onPoll(Conn& c, int res) {
+    c.polled = 0;
+    c.pollRemoving = false;
+    if (!c.lent) return;
+    if (res > 0 && c.lent->interest() != 0) c.lent->handleEvent(res);
+    updateLent(c);
+}
+
+// 重置传输状态，继续解析已收到的命令（客户端可能已经流水线发送），不够一行时再接收
+void UringServer::nextCommand(Conn& c) {
+    c.phase = Phase::ReadCommand;
+    c.fileSize = 0;
+    c.headerSent = false;
+    c.replyOnly = false;
+    for (int b = 0; b < 2; ++b) {
+        c.bufState[b] = BufState::Free;
+        c.bufLen[b] = c.bufOff[b] = 0;
+        c.bufFileOff[b] = 0;
+    }
+    c.ready.clear();
+    c.cached.reset();
+    c.netPos = c.diskPos = 0;
+    c.netBusy = c.diskBusy = false;
+    if (parseLines(c)) submitRecvLine(c);
+}
+
+/**
+ * @brief 把一个阻塞的磁盘操作交给线程池
+ *
+ * 任务计入连接的未完成请求数，因此执行期间连接不会被回收；work 在线程池中执行，
+ * 只能访问本连接的文件相关成员，then 在事件循环线程中执行。
+ */
+void UringServer::runDisk(Conn& c, std::function<void()> work, std::function<void()> then) {
+    ++c.inflight;
+    c.diskThen = std::move(then);
+    int slot = c.slot;
+    pool.enqueue([this, slot, work = std::move(work)]() {
+        work();
+        postDone(Done{slot, false});
+    });
+}
+
+// 放入完成队列并写 eventfd，由 io_uring 上等待 eventfd 的读取唤醒事件循环
+void UringServer::postDone(Done done) {
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        doneSlots.push_back(done);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(eventFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// 借出的连接的线程池任务：与 runDisk 一样计入未完成请求数，完成后回调 Connection
+void UringServer::submitLent(Connection& conn, bool background, std::function<void()> work) {
+    Conn& c = *conns[lentSlots.at(conn.fd())];
+    ++c.inflight;
+    int slot = c.slot;
+    pool.enqueue([this, slot, background, work = std::move(work)]() {
+        work();
+        postDone(Done{slot, background});
+    });
+}
+
+void UringServer::submitDisk(Connection& conn, std::function<void()> work) {
+    submitLent(conn, false, std::move(work));
+}
+
+void UringServer::submitWrite(Connection& conn, std::function<void()> work) {
+    submitLent(conn, true, std::move(work));
+}
+
+void UringServer::submitBatch(Connection& conn, std::vector<std::function<void()>> work, std::function<void()> join) {
+    if (work.empty()) {
+        submitLent(conn, false, join ? std::move(join) : [] {});
+        return;
+    }
+    // 与 Reactor::submitBatch 相同：计数归零的那个线程执行 join
+    Conn& c = *conns[lentSlots.at(conn.fd())];
+    ++c.inflight;
+    int slot = c.slot;
+    auto left = std::make_shared<std::atomic<size_t>>(work.size());
+    auto last = std::make_shared<std::function<void()>>(std::move(join));
+    for (auto& task : work) {
+        pool.enqueue([this, slot, left, last, task = std::move(task)]() {
+            task();
+            if (left->fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (*last) (*last)();
+            postDone(Done{slot, false});
+        });
+    }
+}
+
+void UringServer::submitBackground(std::function<void()> work) {
+    pool.enqueue(std::move(work));
+}
+
+// 通过 io_uring 读取 eventfd，线程池有任务完成时产生一个完成事件
+void UringServer::submitDiskWait() {
+    io_uring_sqe* sqe = nextSqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = eventFd;
+    sqe->addr = (uint64_t)&eventCount;
+    sqe->len = sizeof(eventCount);
+    sqe->user_data = encode(DONE_SLOT, 0, OpDiskDone);
+}
+
+// 取出所有已完成的线程池任务，在事件循环线程中继续推进对应的连接
+void UringServer::drainDiskCompletions() {
+    std::vector<Done> ready;
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        ready.swap(doneSlots);
+    }
+    for (const Done& done : ready) {
+        Conn& c = *conns[done.slot];
+        --c.inflight;
+        c.lastActive = std::chrono::steady_clock::now();
+        if (c.closing) {
+            advanceClose(c);
+        } else if (c.lent) {
+            if (done.background) {
+                c.lent->onWriteDone();
+            } else {
+                c.lent->onDiskDone();
+            }
+            updateLent(c);  // 可能回收连接
+        } else {
+            std::function<void()> then = std::move(c.diskThen);
+            then();  // 可能回收连接，之后不能再访问 c
+        }
+    }
+}
+
+void UringServer::fail(Conn& c, const std::string& reason) {
+    std::cerr << reason << std::endl;
+    teardown(c);
+}
+
+/**
+ * @brief 上传中断时从文件开头起已连续写入的字节数
+ *
+ * 两块缓冲区的写盘可能乱序完成，文件长度不能代表已写入的数据；
+ * 取已接收的位置与所有未写完缓冲区的写入位置中最小的一个。
+ */
+uint64_t UringServer::uploadPrefix(const Conn& c) const {
+    uint64_t prefix = c.netPos;
+    for (int b = 0; b < 2; ++b) {
+        if (c.bufState[b] == BufState::Disk) prefix = std::min<uint64_t>(prefix, c.bufFileOff[b] + c.bufOff[b]);
+    }
+    return prefix;
+}
+
+/**
+ * @brief 开始关闭连接
+ *
+ * 关闭 socket 的读写方向，使尚未完成的 recv/send 尽快返回；
+ * 等所有请求完成后再依次关闭固定文件、记录未完成上传的进度并回收连接。
+ */
+void UringServer::teardown(Conn& c) {
+    if (c.closing) return;
+    c.closing = true;
+    shutdown(c.sock, SHUT_RDWR);
+    advanceClose(c);
+}
+
+void UringServer::advanceClose(Conn& c) {
+    if (c.inflight > 0) return;
+    if (c.fileOpen) {
+        io_uring_sqe* sqe = nextSqe(ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = c.slot + 1;
+        prep(c, OpCloseFile, 0, sqe);
+        return;
+    }
+    if (c.staged) {
+        // 未完成的上传保留在暂存区，记录已写入的字节数以便续传
+        // 记录交给线程池写入，完成后再次进入这里回收连接
+        c.staged = false;
+        uint64_t prefix = uploadPrefix(c);
+        std::cout << "已保留未完成的上传: " << c.basename << " (" << prefix << "/" << c.fileSize << " 字节)，可续传" << std::endl;
+        runDisk(c, [&c, prefix] {
+            writeStagingRecord(c.basename, c.fileSize, prefix);
+        }, nullptr);
+        return;
+    }
+    release(c);
+}
+
+// 回收连接：关闭 socket，归还缓冲区对
+void UringServer::release(Conn& c) {
+    if (c.lent) lentSlots.erase(c.sock);
+    close(c.sock);
+    int slot = c.slot;
+    // 连接在排队时被关闭，从等待队列中移除
+    for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        if (*it == slot) {
+            waiters.erase(it);
+            break;
+        }
+    }
+    releasePair(c);
+    conns[slot].reset();
+    freeSlots.push_back(slot);
+}
+
+// 归还连接持有的缓冲区对，有等待者时直接交给队首的连接
+void UringServer::releasePair(Conn& c) {
+    int pair = c.pair;
+    c.pair = -1;
+    if (pair < 0) return;
+    if (waiters.empty()) {
+        freePairs.push_back(pair);
+        return;
+    }
+    Conn& next = *conns[waiters.front()];
+    waiters.pop_front();
+    next.pair = pair;
+    openFile(next);
+}
+
+// 每跨过 1MB 边界输出一次传输进度
+void UringServer::reportProgress(const Conn& c, const char* verb, size_t before, size_t now) {
+    constexpr size_t MB = 1024 * 1024;
+    if (now / MB != before / MB) {
+        std::cout << verb << ": " << now << "/" << c.fileSize << " 字节 ("
+                  << (now * 100 / c.fileSize) << "%)" << std::endl;
+    }
+}
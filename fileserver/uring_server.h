@@ -0,0 +1,194 @@
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/time_types.h>
+#include "connection.h"
+#include "linebuffer.h"
+#include "uring.h"
+#include "threadpool.h"
+#include "filecache.h"
+#include "blobstore.h"
+
+/**
+ * @brief 基于 io_uring 的文件服务端（USE_IO_URING 编译时可用）
+ *
+ * accept、recv、send 以及文件的 statx/open/read/write/close 全部以异步请求
+ * 提交给同一个 io_uring，在一个线程中按完成事件推进每个连接。
+ * 磁盘文件通过 OPENAT 直接安装到固定文件表（槽位号即连接号），文件读写使用
+ * 注册过的固定缓冲区（READ_FIXED/WRITE_FIXED）。每个传输持有两块缓冲区：
+ * 上传时一块在写盘、另一块在接收；下载时一块在发送、另一块在读盘，
+ * 从而让同一个传输的网络和磁盘操作重叠进行。
+ * 连接是持久的：传输结束后关闭文件、归还缓冲区对，再回到 ReadCommand 处理下一条命令；
+ * 空闲超时由每秒一次的 IORING_OP_TIMEOUT 定时检查。
+ * 无法以 io_uring 请求表达的磁盘操作（续传查询和进度记录、分块上传预分配暂存文件、上传完成后计算摘要、
+ * 存入内容目录以及秒传查找）不在环线程中同步执行，交给一个小线程池（runDisk），
+ * 完成后经 eventfd 通知，eventfd 的读取同样由 io_uring 完成。
+ * 快速路径之外的命令（压缩传输等）借给与 epoll 后端共用的 Connection 处理（lend）：
+ * socket 暂时改为非阻塞，由 IORING_OP_POLL_ADD 的就绪通知驱动，Connection 的线程池任务也交给
+ * 这里的线程池（UringServer 实现 ConnectionHost）；一条命令处理完后连接交还给快速路径。
+ */
+class UringServer : public ConnectionHost {
+public:
+    UringServer(int listenFd, const ServerConfig& config, size_t diskThreads);
+    ~UringServer();
+
+    bool init();  // 创建 io_uring、注册缓冲区和固定文件表
+    void run();   // 进入事件循环，不返回
+
+    // ConnectionHost：借出的连接的磁盘任务、写盘和并行任务都交给线程池，完成后同样经 eventfd 通知
+    void submitDisk(Connection& conn, std::function<void()> work) override;
+    void submitWrite(Connection& conn, std::function<void()> work) override;
+    void submitBatch(Connection& conn, std::vector<std::function<void()>> work, std::function<void()> join) override;
+    void submitBackground(std::function<void()> work) override;
+
+private:
+    enum Op : uint8_t {
+        OpAccept, OpRecvLine, OpStat, OpOpen, OpRecv, OpWrite,
+        OpRead, OpSendHeader, OpSend, OpSendCached, OpCloseFile, OpTick, OpDiskDone, OpFallocate,
+        OpPoll, OpPollRemove
+    };
+    enum class Phase { ReadCommand, ReadSize, Upload, Download, Lent };
+    enum class BufState { Free, Net, Disk, Ready };
+
+    struct Conn {
+        int slot = -1;  // 连接号，同时是磁盘文件在固定文件表中的槽位
+        int sock = -1;
+        std::string peer;
+        Phase phase = Phase::ReadCommand;
+        char lineBuf[4096];   // 读取命令行/大小行的接收缓冲区
+        LineBuffer inBuf;     // 已接收但尚未解析的数据
+        std::string basename;
+        std::string fullpath;
+        struct statx stx;
+        std::string outBuf;   // 响应行
+        size_t outOff = 0;
+        bool replyOnly = false;  // 响应发送完即结束当前命令（错误信息、上传确认）
+        bool closeAfterReply = false;
+        bool headerSent = false;
+
+        bool fileOpen = false;
+        size_t fileSize = 0;
+        ByteRange range;        // 下载请求的字节范围
+        size_t rangeStart = 0;  // 本次传输的文件范围 [rangeStart, rangeEnd)
+        size_t rangeEnd = 0;
+        bool chunked = false;   // 当前上传是多连接分块上传中的一个分块
+        PcdStatsBuilder statsBuilder;  // 上传：边接收边统计点云，存入后保存统计
+        std::unordered_map<std::string, BlobChallenge> challenges;  // 秒传：已回复 PROVE、等待 PROOF 的文件名
+        CachedFilePtr cached;   // 下载：从内存缓存发送时的文件内容，不占用缓冲区对
+        int pair = -1;        // 持有的缓冲区对，-1 表示未持有
+        BufState bufState[2] = {BufState::Free, BufState::Free};
+        size_t bufLen[2] = {0, 0};
+        size_t bufOff[2] = {0, 0};       // 已写盘/已发送的字节数
+        uint64_t bufFileOff[2] = {0, 0}; // 缓冲区数据在文件中的偏移
+        std::deque<int> ready;           // 下载：已读出、等待按顺序发送的缓冲区
+        size_t netPos = 0;    // 上传：已提交接收的字节数；下载：已确认发送到的文件偏移
+        size_t diskPos = 0;   // 上传：已写盘的字节数；下载：已提交读取到的文件偏移
+        bool netBusy = false;
+        bool diskBusy = false;
+
+        int inflight = 0;     // 尚未完成的 io_uring 请求数
+        bool closing = false;
+        bool staged = false;  // 上传：暂存文件已打开且尚未移入 filedir/，关闭连接时写入进度记录
+        std::chrono::steady_clock::time_point lastActive;
+
+        ssize_t diskResult = 0;  // 线程池任务的结果
+        int diskErrno = 0;
+        std::function<void()> diskThen;
+
+        std::unique_ptr<Connection> lent;  // 借出时处理当前命令的 Connection
+        uint32_t polled = 0;       // 已提交的 POLL_ADD 等待的事件，0 表示没有
+        bool pollRemoving = false;  // 已提交 POLL_REMOVE，等这次 POLL_ADD 完成后再按新的事件提交
+    };
+
+    // 线程池任务完成：background 为借出的连接的后台写盘（onWriteDone）
+    struct Done {
+        int slot;
+        bool background;
+    };
+
+    void submitAccept();
+    void submitRecvLine(Conn& c);
+    void prep(Conn& c, Op op, int buf, io_uring_sqe* sqe);
+    void dispatch(uint64_t userData, int res);
+
+    void onAccept(int res);
+    void onRecvLine(Conn& c, int res);
+    bool parseLines(Conn& c);
+    void startTransfer(Conn& c);
+    void openFile(Conn& c);
+    void onStat(Conn& c, int res);
+    void onOpen(Conn& c, int res);
+    void sendHeader(Conn& c);
+    void onSendHeader(Conn& c, int res);
+    void reply(Conn& c, const std::string& msg);
+    void finishTransfer(Conn& c);
+    void onCloseFile(Conn& c);
+    void nextCommand(Conn& c);
+    void afterStore(const Conn& c, std::shared_ptr<const PcdStats> streamed);
+    void lend(Conn& c, const std::string& line);
+    void updateLent(Conn& c);
+    void onPoll(Conn& c, int res);
+
+    void pumpUpload(Conn& c);
+    void onRecv(Conn& c, int buf, int res);
+    void submitWrite(Conn& c, int buf);
+    void onWrite(Conn& c, int buf, int res);
+    void pumpDownload(Conn& c);
+    void onRead(Conn& c, int buf, int res);
+    void onSend(Conn& c, int buf, int res);
+    void sendCached(Conn& c, CachedFilePtr entry);
+    void pumpCached(Conn& c);
+    void onSendCached(Conn& c, int res);
+
+    void fail(Conn& c, const std::string& reason);
+    uint64_t uploadPrefix(const Conn& c) const;
+    void teardown(Conn& c);
+    void advanceClose(Conn& c);
+    void release(Conn& c);
+    void releasePair(Conn& c);
+    void submitTick();
+    void sweepIdle();
+    void runDisk(Conn& c, std::function<void()> work, std::function<void()> then);
+    void submitLent(Connection& conn, bool background, std::function<void()> work);
+    void postDone(Done done);
+    void submitDiskWait();
+    void drainDiskCompletions();
+    char* bufferAddr(const Conn& c, int buf) const;
+    void reportProgress(const Conn& c, const char* verb, size_t before, size_t now);
+
+    int listenFd;
+    const ServerConfig& config;
+    IoUring ring;
+
+    std::vector<std::unique_ptr<Conn>> conns;
+    std::vector<int> freeSlots;
+
+    char* bufferMem = nullptr;   // 所有缓冲区对的连续内存
+    bool fixedBuffers = false;   // 缓冲区是否注册成功
+    std::vector<int> freePairs;
+    std::deque<int> waiters;     // 等待空闲缓冲区对的连接
+
+    sockaddr_storage acceptAddr{};
+    socklen_t acceptLen = 0;
+    __kernel_timespec tickTs{};  // 空闲检查定时器的间隔
+
+    int eventFd = -1;             // 线程池任务完成通知
+    uint64_t eventCount = 0;      // eventfd 读取缓冲区
+    std::mutex doneMutex;         // 保护 doneSlots
+    std::vector<Done> doneSlots;  // 线程池任务已完成的连接
+    std::unordered_map<int, int> lentSlots;  // 借出的连接：socket -> 连接号
+    ThreadPool pool;              // 最后声明，析构时先等待所有任务结束
+};
+
+#endif // URING_SERVER_H